@@ -0,0 +1,493 @@
+#include "audio/audioConvert.h"
+#include "audio/audioFilter.h"
+#include "audio/audioConvertFilter.h"
+#include "audio/audioFilterManager.h"
+#include "audio/audioRingBuffer.h"
+#include "audio/pcmCacheFilter.h"
+#include "console/console.h"
+#include "console/simBase.h"
+#include "core/fileStream.h"
+#include "platform/platformMutex.h"
+#include "platform/platformSemaphore.h"
+#include "platform/platformThread.h"
+
+// Static variables
+Vector<AudioConvertJob*> AudioConvertQueue::smJobs;
+Vector<Thread*> AudioConvertQueue::smWorkers;
+void *AudioConvertQueue::smMutex = NULL;
+void *AudioConvertQueue::smSemaphore = NULL;
+U32 AudioConvertQueue::smNumPending = 0;
+U32 AudioConvertQueue::smNextId = 1;
+bool AudioConvertQueue::smShutdown = false;
+S32 AudioConvertQueue::smNumThreads = 2;
+
+//--------------------------------------------------------------------------
+/// Passes a job's progress back to the main thread, where it is safe to call script
+class AudioConvertEvent : public SimEvent
+{
+   U32 mId;
+   StringTableEntry mInFile;
+   StringTableEntry mOutFile;
+   StringTableEntry mCallback;
+   F32 mProgress;
+   char mStatus[32];      ///< Copied, as the StringTable may only be touched on the main thread
+   char mError[256];
+
+  public:
+   AudioConvertEvent(AudioConvertJob *job, const char *status)
+   {
+      mId = job->mId;
+      mInFile = job->mInFile;
+      mOutFile = job->mOutFile;
+      mCallback = job->mCallback;
+      mProgress = job->mBytesTotal ? F32(job->mBytesDone) / F32(job->mBytesTotal) : 1.0;
+      dStrncpy(mStatus, status, sizeof(mStatus) - 1);
+      mStatus[sizeof(mStatus) - 1] = '\0';
+      dStrcpy(mError, job->mError);
+   }
+
+   void process(SimObject *object)
+   {
+      if (mError[0] != '\0')
+         Con::errorf("filterConvert: %s (converting %s to %s)", mError, mInFile, mOutFile);
+
+      if (mCallback)
+      {
+         char idBuf[16], progressBuf[16];
+         dSprintf(idBuf, sizeof(idBuf), "%d", mId);
+         dSprintf(progressBuf, sizeof(progressBuf), "%g", mProgress);
+         Con::executef(6, mCallback, idBuf, mInFile, mOutFile, progressBuf, mStatus);
+      }
+   }
+};
+
+//--------------------------------------------------------------------------
+/// Decodes a job's source into the ring buffer
+class AudioConvertDecoder : public Thread
+{
+   AudioFilter *mFilter;
+   AudioRingBuffer *mRing;
+   U32 mSize;
+
+  public:
+   volatile bool mDone;   ///< Set once everything has been put in the ring (or decoding failed)
+   volatile bool mFailed;
+   volatile bool mAbort;  ///< Set by the encoder to stop decoding early
+
+   AudioConvertDecoder(AudioFilter *filter, AudioRingBuffer *ring, U32 size) : Thread(0, 0, false)
+   {
+      mFilter = filter;
+      mRing = ring;
+      mSize = size;
+      mDone = mFailed = mAbort = false;
+   }
+
+   virtual void run(S32 arg)
+   {
+      U8 chunk[CONVERT_CHUNKSIZE];
+      U32 decoded = 0;
+      while (decoded < mSize && !mAbort)
+      {
+         U32 chunkSize = getMin(mSize - decoded, (U32)CONVERT_CHUNKSIZE);
+         if (!mFilter->read(chunkSize, chunk)) {
+            mFailed = true;
+            break;
+         }
+         decoded += chunkSize;
+
+         // Wait for the encoder to make room
+         U8 *ptr = chunk;
+         while (chunkSize != 0 && !mAbort)
+         {
+            U32 written = mRing->write(ptr, chunkSize);
+            ptr += written;
+            chunkSize -= written;
+            if (chunkSize != 0)
+               Platform::sleep(1);
+         }
+      }
+      AUDIO_MEMORY_BARRIER();
+      mDone = true;
+   }
+};
+
+//--------------------------------------------------------------------------
+AudioConvertJob::AudioConvertJob(const char *inFile, const char *outFile, U8 quality, F32 vbrQuality, const char *callback, U32 samplingRate)
+{
+   mId = 0;
+   mInFile = StringTable->insert(inFile);
+   mOutFile = StringTable->insert(outFile);
+   mCallback = (callback && callback[0]) ? StringTable->insert(callback) : NULL;
+   mQuality = quality;
+   mVBRQuality = vbrQuality;
+   mSamplingRate = samplingRate;
+   mBytesTotal = 0;
+   mBytesDone = 0;
+   mError[0] = '\0';
+}
+
+//--------------------------------------------------------------------------
+void AudioConvertJob::postProgress(const char *status)
+{
+   Sim::postEvent(Sim::getRootGroup(), new AudioConvertEvent(this, status), Sim::getCurrentTime());
+}
+
+//--------------------------------------------------------------------------
+bool AudioConvertJob::run()
+{
+   // Set up the filters
+   AudioFilter *in_filter = AudioFilterManager::getFilterFromFile(mInFile, AudioFilterManager::AudioRead);
+   if (!in_filter)
+   {
+      dStrcpy(mError, "could not open filter to read");
+      return false;
+   }
+   AudioFilter *out_filter = AudioFilterManager::getFilterFromFile(mOutFile, AudioFilterManager::AudioWrite);
+   if (!out_filter)
+   {
+      dStrcpy(mError, "could not open filter to write");
+      AudioFilterManager::closeFilter(in_filter);
+      return false;
+   }
+
+   FileStream in;
+   FileStream out;
+   if (!in.open(mInFile, FileStream::Read) || !out.open(mOutFile, FileStream::Write))
+   {
+      dStrcpy(mError, "could not open file");
+      AudioFilterManager::closeFilter(in_filter);
+      AudioFilterManager::closeFilter(out_filter);
+      return false;
+   }
+
+   in_filter->attachStream(&in);
+   out_filter->attachStream(&out);
+
+   // Pick the closest format the encoder will take, converting if need be
+   AudioFilter *source = in_filter;
+   AudioConvertFilter *convert = NULL;
+   U8 inFormat = in_filter->getChannelFormat();
+   U8 outFormat = inFormat;
+   if (!out_filter->setChannelFormat(inFormat))
+   {
+      U8 tryFormats[3] = {getFormatChannels(inFormat) == 2 ? AudioFilter::CHANNEL_STEREO_16 : AudioFilter::CHANNEL_MONO_16,
+                          AudioFilter::CHANNEL_MONO_16, AudioFilter::CHANNEL_STEREO_16};
+      for (U32 i=0; i<3; i++)
+      {
+         if (out_filter->setChannelFormat(tryFormats[i])) {
+            outFormat = tryFormats[i];
+            break;
+         }
+      }
+   }
+
+   // Encoders may only take certain rates, and pick the nearest they can do
+   out_filter->setSamplingRate(mSamplingRate ? mSamplingRate : in_filter->getSamplingRate());
+   U32 outRate = out_filter->getSamplingRate();
+   if (outFormat != inFormat || outRate != in_filter->getSamplingRate())
+   {
+      convert = new AudioConvertFilter(outFormat, outRate);
+      if (!convert->attachStream(in_filter))
+      {
+         dStrcpy(mError, "could not convert input");
+         delete convert;
+         out_filter->detachStream();
+         in_filter->detachStream();
+         AudioFilterManager::closeFilter(in_filter);
+         AudioFilterManager::closeFilter(out_filter);
+         return false;
+      }
+      source = convert;
+   }
+   mBytesTotal = source->getStreamSize();
+
+   out_filter->setSize(mBytesTotal);
+   out_filter->setQuality(mQuality);
+   out_filter->setVBRQuality(mVBRQuality);
+   out_filter->setSamplingRate(source->getSamplingRate());
+   out_filter->writeHeader(); // Header is very important
+
+   // Decode on another thread while we encode on this one
+   AudioRingBuffer ring(CONVERT_RINGSIZE);
+   AudioConvertDecoder decoder(source, &ring, mBytesTotal);
+   decoder.start();
+
+   U8 chunk[CONVERT_CHUNKSIZE];
+   U32 nextProgress = mBytesTotal / 10;
+   bool success = true;
+   while (mBytesDone < mBytesTotal)
+   {
+      U32 got = ring.read(chunk, getMin(mBytesTotal - mBytesDone, (U32)CONVERT_CHUNKSIZE));
+      if (got == 0)
+      {
+         // Only trust an empty ring once the decoder has stopped adding to it
+         if (decoder.mDone && ring.getReadAvailable() == 0)
+            break;
+         Platform::sleep(1);
+         continue;
+      }
+
+      if (!out_filter->write(got, chunk))
+      {
+         dStrcpy(mError, "could not write output");
+         success = false;
+         break;
+      }
+      mBytesDone += got;
+
+      if (mCallback && mBytesDone >= nextProgress && mBytesDone < mBytesTotal)
+      {
+         postProgress("");
+         nextProgress += mBytesTotal / 10;
+      }
+   }
+
+   decoder.mAbort = true;
+   decoder.join();
+   if (success && (decoder.mFailed || mBytesDone != mBytesTotal))
+   {
+      dStrcpy(mError, "could not decode input");
+      success = false;
+   }
+
+   // Encoders finish off their streams on detach, so this must happen before the files are closed
+   out_filter->detachStream();
+   if (success && out_filter->getStatus() == Stream::IOError)
+   {
+      dStrcpy(mError, "could not finish writing output");
+      success = false;
+   }
+   if (convert)
+      delete convert;
+   in_filter->detachStream();
+   out.close();
+   in.close();
+   AudioFilterManager::closeFilter(in_filter);
+   AudioFilterManager::closeFilter(out_filter);
+
+   // Anything decoded from the file we just wrote over is out of date
+   AudioPCMCache::invalidate(mOutFile);
+   return success;
+}
+
+//--------------------------------------------------------------------------
+class AudioConvertWorker : public Thread
+{
+  public:
+   AudioConvertWorker() : Thread(0, 0, false) {}
+   virtual void run(S32 arg) {AudioConvertQueue::workerMain();}
+};
+
+//--------------------------------------------------------------------------
+void AudioConvertQueue::init()
+{
+   smMutex = Mutex::createMutex();
+   smSemaphore = Semaphore::createSemaphore(0);
+   smShutdown = false;
+   Con::addVariable("$Audio::convertThreads", TypeS32, &smNumThreads);
+}
+
+//--------------------------------------------------------------------------
+void AudioConvertQueue::destroy()
+{
+   if (!smMutex)
+      return;
+
+   // Workers finish the queue before they see the shutdown
+   smShutdown = true;
+   for (U32 i=0; i<smWorkers.size(); i++)
+      Semaphore::releaseSemaphore(smSemaphore);
+   for (U32 i=0; i<smWorkers.size(); i++)
+   {
+      smWorkers[i]->join();
+      delete smWorkers[i];
+   }
+   smWorkers.clear();
+
+   Mutex::destroyMutex(smMutex);
+   Semaphore::destroySemaphore(smSemaphore);
+   smMutex = smSemaphore = NULL;
+}
+
+//--------------------------------------------------------------------------
+U32 AudioConvertQueue::queue(AudioConvertJob *job)
+{
+   AssertFatal(smMutex, "AudioConvertQueue::queue: not initialized!");
+
+   Mutex::lockMutex(smMutex);
+   U32 id = job->mId = smNextId++;
+   smJobs.push_back(job);
+   smNumPending++;
+   U32 numPending = smNumPending;
+   Mutex::unlockMutex(smMutex);
+
+   // Start more workers if there is enough work for them
+   while (smWorkers.size() < getMax(smNumThreads, 1) && smWorkers.size() < numPending)
+   {
+      Thread *worker = new AudioConvertWorker();
+      worker->start();
+      smWorkers.push_back(worker);
+   }
+
+   Semaphore::releaseSemaphore(smSemaphore); // job may be gone as soon as this returns
+   return id;
+}
+
+//--------------------------------------------------------------------------
+U32 AudioConvertQueue::getNumPending()
+{
+   Mutex::lockMutex(smMutex);
+   U32 numPending = smNumPending;
+   Mutex::unlockMutex(smMutex);
+   return numPending;
+}
+
+//--------------------------------------------------------------------------
+void AudioConvertQueue::waitIdle()
+{
+   while (getNumPending() != 0)
+      Platform::sleep(10);
+}
+
+//--------------------------------------------------------------------------
+void AudioConvertQueue::workerMain()
+{
+   while (1)
+   {
+      Semaphore::acquireSemaphore(smSemaphore, true);
+
+      Mutex::lockMutex(smMutex);
+      AudioConvertJob *job = NULL;
+      if (smJobs.size() != 0)
+      {
+         job = smJobs[0];
+         smJobs.erase(U32(0));
+      }
+      Mutex::unlockMutex(smMutex);
+
+      if (!job)
+      {
+         if (smShutdown)
+            return;
+         continue;
+      }
+
+      bool success = job->run();
+      job->postProgress(success ? "done" : "failed");
+      delete job;
+
+      Mutex::lockMutex(smMutex);
+      smNumPending--;
+      Mutex::unlockMutex(smMutex);
+   }
+}
+
+/// @name Conversion Functions
+/// @{
+
+//--------------------------------------------------------------------------
+
+/// Converts 1 file to another, in the background
+/// @param 1 Input File
+/// @param 2 Output File
+/// @param 3 Output Quality (Optional)
+/// @param 4 Output VBR Quality (Optional)
+/// @param 5 Function to call with progress (Optional)
+/// @param 6 Output sampling rate (Optional, defaults to the input's)
+///
+/// Example usage :
+/// @code
+/// function onConverted(%id, %in, %out, %progress, %status)
+/// {
+///    echo(%out SPC "is" SPC mFloor(%progress * 100) @ "% done" SPC %status);
+/// }
+/// filterConvert("mymusic.ogg", "myvoicemusic.spx", 5, 0.5, "onConverted");
+/// @endcode
+///
+/// @return Id of the conversion (passed to the callback)
+/// @note Conversions happen on worker threads; use filterConvertWait() to wait for them to finish.
+ConsoleFunction(filterConvert, S32, 3, 7, "filterConvert(filename in, filename out [, quality, vbrquality, callback, rate])")
+{
+   U8 quality=8;
+   F32 vbrquality=-1;
+   const char *callback = NULL;
+   U32 rate=0;
+
+   if (argc > 3)
+   	quality = dAtoi(argv[3]);
+   if (argc > 4)
+   	vbrquality = dAtof(argv[4]);
+   if (argc > 5)
+   	callback = argv[5];
+   if (argc > 6)
+   	rate = dAtoi(argv[6]);
+
+   return AudioConvertQueue::queue(new AudioConvertJob(argv[1], argv[2], quality, vbrquality, callback, rate));
+}
+
+/// Converts every audio file in a directory (and its subdirectories) to another format, several at once
+/// @param 1 Directory
+/// @param 2 Extension of the format to convert to (e.g. ".spx")
+/// @param 3 Output Quality (Optional)
+/// @param 4 Output VBR Quality (Optional)
+/// @param 5 Function to call with progress (Optional)
+/// @param 6 Output sampling rate (Optional, defaults to each input's)
+///
+/// Converted files are written next to their source, with the new extension. Files which are already in
+/// the output format, or which no filter can read, are skipped.
+///
+/// @return Number of files queued for conversion
+ConsoleFunction(filterConvertDir, S32, 3, 7, "filterConvertDir(directory, out extension [, quality, vbrquality, callback, rate])")
+{
+   U8 quality=8;
+   F32 vbrquality=-1;
+   const char *callback = NULL;
+   U32 rate=0;
+
+   if (argc > 3)
+   	quality = dAtoi(argv[3]);
+   if (argc > 4)
+   	vbrquality = dAtof(argv[4]);
+   if (argc > 5)
+   	callback = argv[5];
+   if (argc > 6)
+   	rate = dAtoi(argv[6]);
+
+   const char *outExtension = argv[2];
+   if (!AudioFilterManager::findFilterInfoForFile(outExtension))
+   {
+      Con::errorf("filterConvertDir: no filter writes %s files!", outExtension);
+      return 0;
+   }
+
+   Vector<Platform::FileInfo> files;
+   if (!Platform::dumpPath(argv[1], files))
+   {
+      Con::errorf("filterConvertDir: could not read directory %s!", argv[1]);
+      return 0;
+   }
+
+   S32 numQueued = 0;
+   char inFile[1024];
+   char outFile[1024];
+   for (Vector<Platform::FileInfo>::iterator itr = files.begin(); itr != files.end(); itr++)
+   {
+      const char *extension = extractFileExtension(itr->pFileName);
+      if (!dStricmp(extension, outExtension) || !AudioFilterManager::findFilterInfoForFile(itr->pFileName))
+         continue;
+
+      dSprintf(inFile, sizeof(inFile), "%s/%s", itr->pFullPath, itr->pFileName);
+      dSprintf(outFile, sizeof(outFile), "%s/%.*s%s", itr->pFullPath, (S32)(extension - itr->pFileName), itr->pFileName, outExtension);
+      AudioConvertQueue::queue(new AudioConvertJob(inFile, outFile, quality, vbrquality, callback, rate));
+      numQueued++;
+   }
+   return numQueued;
+}
+
+/// Waits until every conversion started with filterConvert or filterConvertDir has finished
+ConsoleFunction(filterConvertWait, void, 1, 1, "filterConvertWait()")
+{
+   AudioConvertQueue::waitIdle();
+}
+
+/// @}
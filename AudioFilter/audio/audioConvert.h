@@ -0,0 +1,73 @@
+#ifndef _AUDIOCONVERT_H_
+#define _AUDIOCONVERT_H_
+
+#ifndef _PLATFORM_H_
+#include "platform/platform.h"
+#endif
+#ifndef _TVECTOR_H_
+#include "core/tVector.h"
+#endif
+
+#define CONVERT_CHUNKSIZE 16384   // PCM passed from decoder to encoder at a time
+#define CONVERT_RINGSIZE 131072   // PCM buffered between decoder and encoder
+
+class Thread;
+
+//----------------------------------------------------------------------
+/// Converts one audio file into another.
+///
+/// The source is decoded on a thread of its own, into a small AudioRingBuffer which the encoder drains as it goes,
+/// so only CONVERT_RINGSIZE bytes of PCM are held at once, however long the audio is. If the encoder can't take
+/// the source's channel format, or a different sampling rate is asked for, the source is read through an
+/// AudioConvertFilter.
+class AudioConvertJob
+{
+  public:
+   U32 mId;                   ///< Id returned to script
+   StringTableEntry mInFile;  ///< File to decode
+   StringTableEntry mOutFile; ///< File to encode to (the filter is picked by extension)
+   StringTableEntry mCallback;///< Script function notified of progress (NULL for none)
+   U8 mQuality;               ///< Output quality
+   F32 mVBRQuality;           ///< Output VBR quality
+   U32 mSamplingRate;         ///< Output sampling rate (0 to keep the source's)
+
+   U32 mBytesTotal;           ///< Decoded size of the source
+   volatile U32 mBytesDone;   ///< PCM encoded so far
+   char mError[256];          ///< Why the conversion failed
+
+   AudioConvertJob(const char *inFile, const char *outFile, U8 quality, F32 vbrQuality, const char *callback, U32 samplingRate = 0);
+
+   bool run();                ///< Does the conversion on the calling thread
+   void postProgress(const char *status); ///< Tells the main thread how far we've got
+};
+
+//----------------------------------------------------------------------
+/// Runs AudioConvertJob's on a pool of worker threads.
+///
+/// Progress and completion are passed back to the main thread as SimEvent's, which call the job's
+/// callback as callback(%id, %in, %out, %progress, %status), %status being "" while the job is running,
+/// then "done" or "failed".
+class AudioConvertQueue
+{
+   static Vector<AudioConvertJob*> smJobs; ///< Jobs waiting for a worker
+   static Vector<Thread*> smWorkers;       ///< Worker threads
+   static void *smMutex;                   ///< Guards smJobs and smNumPending
+   static void *smSemaphore;               ///< Released once per queued job (and once per worker on shutdown)
+   static U32 smNumPending;                ///< Jobs queued or running
+   static U32 smNextId;
+   static bool smShutdown;
+
+  public:
+   static S32 smNumThreads;                ///< Most jobs run at once ($Audio::convertThreads)
+
+   static void init();
+   static void destroy();                  ///< Finishes off any queued jobs, then stops the workers
+
+   static U32 queue(AudioConvertJob *job); ///< Takes ownership of job; returns its id
+   static U32 getNumPending();
+   static void waitIdle();                 ///< Blocks until every queued job has finished
+
+   static void workerMain();               ///< Main loop of each worker
+};
+
+#endif //_AUDIOCONVERT_H_
@@ -0,0 +1,749 @@
+#include "audio/audioConvertFilter.h"
+#include "console/console.h"
+#include "math/mMath.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define AUDIOCONVERT_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// Lets the SSE2 and AVX routines be compiled without enabling those instruction sets for the whole file;
+// they are only called once the CPU has been checked
+#if defined(AUDIOCONVERT_X86) && defined(__GNUC__)
+#define AUDIOCONVERT_TARGET(t) __attribute__((target(t)))
+#else
+#define AUDIOCONVERT_TARGET(t)
+#endif
+
+// Conversion routines
+//
+// Everything is converted to float, mixed into one buffer per channel, resampled, then interleaved and converted
+// to the output format. Each step has a plain C version, plus SSE2 and AVX versions where they help.
+//--------------------------------------------------------------------------
+struct AudioConvertKernels
+{
+   const char *name;
+   void (*s16ToFloat)(const S16 *in, F32 *out, U32 count);
+   void (*floatToS16)(const F32 *in, S16 *out, U32 count);
+   void (*u8ToFloat)(const U8 *in, F32 *out, U32 count);
+   void (*floatToU8)(const F32 *in, U8 *out, U32 count);
+   void (*deinterleave)(const F32 *in, F32 *left, F32 *right, U32 frames);
+   void (*downmix)(const F32 *in, F32 *out, U32 frames);
+   void (*interleave)(const F32 *left, const F32 *right, F32 *out, U32 frames);
+   F32 (*dotProduct)(const F32 *a, const F32 *b, U32 count);
+};
+
+static AudioConvertKernels gKernels;
+static bool gKernelsInit = false;
+
+static inline S16 floatToS16Sample(F32 v)
+{
+   v *= 32768.0f;
+   if (v > 32767.0f) return 32767;
+   if (v < -32768.0f) return -32768;
+   return S16(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+static inline U8 floatToU8Sample(F32 v)
+{
+   v = v * 128.0f + 128.0f;
+   if (v > 255.0f) return 255;
+   if (v < 0.0f) return 0;
+   return U8(v + 0.5f);
+}
+
+//--------------------------------------------------------------------------
+static void s16ToFloatC(const S16 *in, F32 *out, U32 count)
+{
+   for (U32 i=0; i<count; i++)
+      out[i] = in[i] * (1.0f / 32768.0f);
+}
+
+static void floatToS16C(const F32 *in, S16 *out, U32 count)
+{
+   for (U32 i=0; i<count; i++)
+      out[i] = floatToS16Sample(in[i]);
+}
+
+static void u8ToFloatC(const U8 *in, F32 *out, U32 count)
+{
+   // 8bit samples are unsigned, centred on 128
+   for (U32 i=0; i<count; i++)
+      out[i] = (S32(in[i]) - 128) * (1.0f / 128.0f);
+}
+
+static void floatToU8C(const F32 *in, U8 *out, U32 count)
+{
+   for (U32 i=0; i<count; i++)
+      out[i] = floatToU8Sample(in[i]);
+}
+
+static void deinterleaveC(const F32 *in, F32 *left, F32 *right, U32 frames)
+{
+   for (U32 i=0; i<frames; i++) {
+      left[i] = in[i*2];
+      right[i] = in[i*2+1];
+   }
+}
+
+static void downmixC(const F32 *in, F32 *out, U32 frames)
+{
+   for (U32 i=0; i<frames; i++)
+      out[i] = (in[i*2] + in[i*2+1]) * 0.5f;
+}
+
+static void interleaveC(const F32 *left, const F32 *right, F32 *out, U32 frames)
+{
+   for (U32 i=0; i<frames; i++) {
+      out[i*2] = left[i];
+      out[i*2+1] = right[i];
+   }
+}
+
+static F32 dotProductC(const F32 *a, const F32 *b, U32 count)
+{
+   F32 sum = 0;
+   for (U32 i=0; i<count; i++)
+      sum += a[i] * b[i];
+   return sum;
+}
+
+#ifdef AUDIOCONVERT_X86
+//--------------------------------------------------------------------------
+AUDIOCONVERT_TARGET("sse2") static void s16ToFloatSSE2(const S16 *in, F32 *out, U32 count)
+{
+   const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+   U32 i = 0;
+   for (; i + 8 <= count; i += 8)
+   {
+      // Unpacking a value with itself then shifting back down sign extends it
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+      __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+      _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+      _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+   }
+   s16ToFloatC(in + i, out + i, count - i);
+}
+
+AUDIOCONVERT_TARGET("sse2") static void floatToS16SSE2(const F32 *in, S16 *out, U32 count)
+{
+   // Packing saturates, so 1.0 (32768) comes out as 32767
+   const __m128 scale = _mm_set1_ps(32768.0f);
+   const __m128 maxVal = _mm_set1_ps(1.0f);
+   const __m128 minVal = _mm_set1_ps(-1.0f);
+   U32 i = 0;
+   for (; i + 8 <= count; i += 8)
+   {
+      __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), minVal), maxVal);
+      __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), minVal), maxVal);
+      __m128i ia = _mm_cvtps_epi32(_mm_mul_ps(a, scale));
+      __m128i ib = _mm_cvtps_epi32(_mm_mul_ps(b, scale));
+      _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(ia, ib));
+   }
+   floatToS16C(in + i, out + i, count - i);
+}
+
+AUDIOCONVERT_TARGET("sse2") static void u8ToFloatSSE2(const U8 *in, F32 *out, U32 count)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i bias = _mm_set1_epi16(128);
+   const __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+   U32 i = 0;
+   for (; i + 16 <= count; i += 16)
+   {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+      __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), bias);
+      __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), bias);
+      _mm_storeu_ps(out + i,      _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16)), scale));
+      _mm_storeu_ps(out + i + 4,  _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16)), scale));
+      _mm_storeu_ps(out + i + 8,  _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16)), scale));
+      _mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16)), scale));
+   }
+   u8ToFloatC(in + i, out + i, count - i);
+}
+
+AUDIOCONVERT_TARGET("sse2") static void floatToU8SSE2(const F32 *in, U8 *out, U32 count)
+{
+   const __m128 scale = _mm_set1_ps(128.0f);
+   const __m128 maxVal = _mm_set1_ps(1.0f);
+   const __m128 minVal = _mm_set1_ps(-1.0f);
+   const __m128i bias = _mm_set1_epi16(128);
+   U32 i = 0;
+   for (; i + 16 <= count; i += 16)
+   {
+      __m128i v[4];
+      for (U32 j=0; j<4; j++)
+         v[j] = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + j*4), minVal), maxVal), scale));
+      __m128i lo = _mm_add_epi16(_mm_packs_epi32(v[0], v[1]), bias);
+      __m128i hi = _mm_add_epi16(_mm_packs_epi32(v[2], v[3]), bias);
+      _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+   }
+   floatToU8C(in + i, out + i, count - i);
+}
+
+AUDIOCONVERT_TARGET("sse2") static void deinterleaveSSE2(const F32 *in, F32 *left, F32 *right, U32 frames)
+{
+   U32 i = 0;
+   for (; i + 4 <= frames; i += 4)
+   {
+      __m128 a = _mm_loadu_ps(in + i*2);
+      __m128 b = _mm_loadu_ps(in + i*2 + 4);
+      _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+      _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+   }
+   deinterleaveC(in + i*2, left + i, right + i, frames - i);
+}
+
+AUDIOCONVERT_TARGET("sse2") static void downmixSSE2(const F32 *in, F32 *out, U32 frames)
+{
+   const __m128 half = _mm_set1_ps(0.5f);
+   U32 i = 0;
+   for (; i + 4 <= frames; i += 4)
+   {
+      __m128 a = _mm_loadu_ps(in + i*2);
+      __m128 b = _mm_loadu_ps(in + i*2 + 4);
+      __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+      __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+      _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(l, r), half));
+   }
+   downmixC(in + i*2, out + i, frames - i);
+}
+
+AUDIOCONVERT_TARGET("sse2") static void interleaveSSE2(const F32 *left, const F32 *right, F32 *out, U32 frames)
+{
+   U32 i = 0;
+   for (; i + 4 <= frames; i += 4)
+   {
+      __m128 l = _mm_loadu_ps(left + i);
+      __m128 r = _mm_loadu_ps(right + i);
+      _mm_storeu_ps(out + i*2, _mm_unpacklo_ps(l, r));
+      _mm_storeu_ps(out + i*2 + 4, _mm_unpackhi_ps(l, r));
+   }
+   interleaveC(left + i, right + i, out + i*2, frames - i);
+}
+
+AUDIOCONVERT_TARGET("sse2") static F32 dotProductSSE2(const F32 *a, const F32 *b, U32 count)
+{
+   // count is always a multiple of 8 (RESAMPLE_TAPS)
+   __m128 sum0 = _mm_setzero_ps();
+   __m128 sum1 = _mm_setzero_ps();
+   for (U32 i=0; i<count; i+=8)
+   {
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+   }
+   __m128 sum = _mm_add_ps(sum0, sum1);
+   sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+   sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+   return _mm_cvtss_f32(sum);
+}
+
+AUDIOCONVERT_TARGET("avx") static F32 dotProductAVX(const F32 *a, const F32 *b, U32 count)
+{
+   __m256 sum = _mm256_setzero_ps();
+   for (U32 i=0; i<count; i+=8)
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+   __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+   half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+   half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+   return _mm_cvtss_f32(half);
+}
+
+//--------------------------------------------------------------------------
+static void getCPUFeatures(bool &sse2, bool &avx)
+{
+#if defined(_MSC_VER)
+   int info[4];
+   __cpuid(info, 1);
+   sse2 = (info[3] & (1 << 26)) != 0;
+   // AVX also needs the OS to save the upper halves of the registers
+   avx = (info[2] & (1 << 28)) && (info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6);
+#else
+   __builtin_cpu_init();
+   sse2 = __builtin_cpu_supports("sse2");
+   avx = __builtin_cpu_supports("avx");
+#endif
+}
+#endif
+
+//--------------------------------------------------------------------------
+void AudioConvertFilter::initKernels()
+{
+   if (gKernelsInit)
+      return;
+
+   gKernels.name = "C";
+   gKernels.s16ToFloat = s16ToFloatC;
+   gKernels.floatToS16 = floatToS16C;
+   gKernels.u8ToFloat = u8ToFloatC;
+   gKernels.floatToU8 = floatToU8C;
+   gKernels.deinterleave = deinterleaveC;
+   gKernels.downmix = downmixC;
+   gKernels.interleave = interleaveC;
+   gKernels.dotProduct = dotProductC;
+
+#ifdef AUDIOCONVERT_X86
+   bool sse2, avx;
+   getCPUFeatures(sse2, avx);
+   if (sse2)
+   {
+      gKernels.name = "SSE2";
+      gKernels.s16ToFloat = s16ToFloatSSE2;
+      gKernels.floatToS16 = floatToS16SSE2;
+      gKernels.u8ToFloat = u8ToFloatSSE2;
+      gKernels.floatToU8 = floatToU8SSE2;
+      gKernels.deinterleave = deinterleaveSSE2;
+      gKernels.downmix = downmixSSE2;
+      gKernels.interleave = interleaveSSE2;
+      gKernels.dotProduct = dotProductSSE2;
+   }
+   if (sse2 && avx)
+   {
+      // Only the resampling filter is long enough to be worth 8 wide
+      gKernels.name = "AVX";
+      gKernels.dotProduct = dotProductAVX;
+   }
+#endif
+
+   gKernelsInit = true;
+}
+
+//--------------------------------------------------------------------------
+const char *AudioConvertFilter::getKernelName()
+{
+   initKernels();
+   return gKernels.name;
+}
+
+//--------------------------------------------------------------------------
+/// Converts count values of one sample type to float
+static void toFloat(U8 format, const void *in, F32 *out, U32 count)
+{
+   switch (getFormatChannelSize(format))
+   {
+      case 1: gKernels.u8ToFloat((const U8*)in, out, count); break;
+      case 2: gKernels.s16ToFloat((const S16*)in, out, count); break;
+      case 4: dMemcpy(out, in, count * sizeof(F32)); break;
+   }
+}
+
+/// Converts count float values to another sample type
+static void fromFloat(U8 format, const F32 *in, void *out, U32 count)
+{
+   switch (getFormatChannelSize(format))
+   {
+      case 1: gKernels.floatToU8(in, (U8*)out, count); break;
+      case 2: gKernels.floatToS16(in, (S16*)out, count); break;
+      case 4: dMemcpy(out, in, count * sizeof(F32)); break;
+   }
+}
+
+//--------------------------------------------------------------------------
+void AudioConvertFilter::convertSamples(U8 inFormat, const void *in, U8 outFormat, void *out, U32 count)
+{
+   AssertFatal(getFormatChannels(inFormat) == getFormatChannels(outFormat), "AudioConvertFilter::convertSamples: channels differ!");
+   initKernels();
+
+   U32 values = count * getFormatChannels(inFormat);
+   if (getFormatChannelSize(inFormat) == 4) {
+      fromFloat(outFormat, (const F32*)in, out, values);
+      return;
+   }
+
+   F32 buffer[CONVERT_BLOCKSIZE];
+   for (U32 i=0; i<values; i+=CONVERT_BLOCKSIZE)
+   {
+      U32 num = getMin(values - i, (U32)CONVERT_BLOCKSIZE);
+      toFloat(inFormat, (const U8*)in + i * getFormatChannelSize(inFormat), buffer, num);
+      fromFloat(outFormat, buffer, (U8*)out + i * getFormatChannelSize(outFormat), num);
+   }
+}
+
+//--------------------------------------------------------------------------
+AudioConvertFilter::AudioConvertFilter(U8 format, U32 samplingRate)
+{
+   mSource = NULL;
+   mFormat = format;
+   mSamplingRate = samplingRate;
+   mSourceFormat = CHANNEL_UNKNOWN;
+   mSourceRate = 0;
+   mSourceFrames = mSourceRead = 0;
+   mOutFrames = mOutFrame = 0;
+   mPosition = 0;
+   mHistoryStart = 0;
+   mCarrySize = 0;
+   initKernels();
+}
+
+//--------------------------------------------------------------------------
+AudioConvertFilter::~AudioConvertFilter()
+{
+   detachStream();
+}
+
+//--------------------------------------------------------------------------
+bool AudioConvertFilter::attachStream(Stream* io_pSlaveStream)
+{
+   AssertFatal(io_pSlaveStream != NULL, "NULL Slave stream?");
+   AssertFatal(mSource == NULL,       "Already attached!");
+
+   mSource = dynamic_cast<AudioFilter*>(io_pSlaveStream);
+   if (!mSource)
+   {
+      AssertFatal(false, "AudioConvertFilter must be attached to an AudioFilter!");
+      return false;
+   }
+
+   mSourceFormat = mSource->getChannelFormat();
+   mSourceRate = mSource->getSamplingRate();
+   if (getFormatSize(mSourceFormat) == 0 || getFormatSize(mFormat) == 0 || mSourceRate == 0)
+   {
+      Con::errorf("AudioConvertFilter: can't convert from format %d (%dHz) to format %d", mSourceFormat, mSourceRate, mFormat);
+      mSource = NULL;
+      setStatus(IOError);
+      return false;
+   }
+
+   if (mSamplingRate == 0)
+      mSamplingRate = mSourceRate;
+   mSourceFrames = mSource->getStreamSize() / getFormatSize(mSourceFormat);
+   mOutFrames = U32((U64(mSourceFrames) * mSamplingRate) / mSourceRate);
+   mDecodedSize = mOutFrames * getFormatSize(mFormat);
+
+   buildFilter();
+   setPosition(0);
+
+   mAudioCapability = AudioFilter::AudioSeek | AudioFilter::AudioTime;
+   setStatus(Ok);
+   return true;
+}
+
+//--------------------------------------------------------------------------
+void AudioConvertFilter::detachStream()
+{
+   mSource = NULL;
+   mAudioCapability = 0;
+   setStatus(Closed);
+}
+
+//--------------------------------------------------------------------------
+Stream* AudioConvertFilter::getStream()
+{
+   return mSource;
+}
+
+//--------------------------------------------------------------------------
+void AudioConvertFilter::buildFilter()
+{
+   mFilterTable.clear();
+   if (mSamplingRate == mSourceRate)
+      return; // Frames are just copied
+
+   // Cut off below the lower of the two nyquist frequencies, so downsampling doesn't alias
+   F64 cutoff = (mSamplingRate < mSourceRate) ? F64(mSamplingRate) / F64(mSourceRate) : 1.0;
+   cutoff *= 0.95;
+
+   const S32 half = RESAMPLE_TAPS / 2;
+   mFilterTable.setSize((RESAMPLE_PHASES + 1) * RESAMPLE_TAPS);
+   for (U32 phase=0; phase<=RESAMPLE_PHASES; phase++)
+   {
+      F32 *row = mFilterTable.address() + phase * RESAMPLE_TAPS;
+      F64 frac = F64(phase) / RESAMPLE_PHASES;
+      F64 sum = 0;
+      for (S32 k=0; k<RESAMPLE_TAPS; k++)
+      {
+         // Distance from the output sample to input sample k, windowed with a Blackman window
+         F64 x = F64(k - (half - 1)) - frac;
+         F64 sinc = (x == 0) ? 1.0 : mSin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+         F64 w = x / half;
+         F64 window = (w <= -1.0 || w >= 1.0) ? 0.0 : 0.42 + 0.5 * mCos(M_PI * w) + 0.08 * mCos(2.0 * M_PI * w);
+         row[k] = F32(sinc * window);
+         sum += row[k];
+      }
+
+      // Unity gain at DC
+      for (S32 k=0; k<RESAMPLE_TAPS; k++)
+         row[k] = F32(row[k] / sum);
+   }
+}
+
+//--------------------------------------------------------------------------
+bool AudioConvertFilter::fillHistory(S32 lastFrame)
+{
+   U32 inChannels = getFormatChannels(mSourceFormat);
+   U32 outChannels = getFormatChannels(mFormat);
+   U32 sourceSize = getFormatSize(mSourceFormat);
+
+   while (mHistoryStart + S32(mHistory[0].size()) <= lastFrame)
+   {
+      U32 held = mHistory[0].size();
+      U32 frames = getMin(U32(lastFrame - (mHistoryStart + S32(held)) + 1), (U32)CONVERT_BLOCKSIZE);
+
+      // Past the end of the source, the filter just sees silence
+      U32 readFrames = getMin(frames, mSourceFrames - mSourceRead);
+      for (U32 c=0; c<outChannels; c++) {
+         mHistory[c].setSize(held + frames);
+         dMemset(mHistory[c].address() + held + readFrames, 0, (frames - readFrames) * sizeof(F32));
+      }
+      if (readFrames == 0)
+         continue;
+
+      mSourceBuffer.setSize(readFrames * sourceSize);
+      if (!mSource->read(readFrames * sourceSize, mSourceBuffer.address()))
+         return false;
+      mSourceRead += readFrames;
+
+      // To float, then split or mix down into mHistory
+      mFloatBuffer.setSize(readFrames * inChannels);
+      toFloat(mSourceFormat, mSourceBuffer.address(), mFloatBuffer.address(), readFrames * inChannels);
+
+      F32 *left = mHistory[0].address() + held;
+      if (inChannels == outChannels)
+      {
+         if (inChannels == 1)
+            dMemcpy(left, mFloatBuffer.address(), readFrames * sizeof(F32));
+         else
+            gKernels.deinterleave(mFloatBuffer.address(), left, mHistory[1].address() + held, readFrames);
+      }
+      else if (inChannels == 2)
+         gKernels.downmix(mFloatBuffer.address(), left, readFrames);
+      else
+      {
+         dMemcpy(left, mFloatBuffer.address(), readFrames * sizeof(F32));
+         dMemcpy(mHistory[1].address() + held, mFloatBuffer.address(), readFrames * sizeof(F32));
+      }
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------------
+void AudioConvertFilter::resample(U32 frames, F32 *out[2])
+{
+   U32 channels = getFormatChannels(mFormat);
+   const S32 half = RESAMPLE_TAPS / 2;
+   F32 kernel[RESAMPLE_TAPS];
+
+   for (U32 i=0; i<frames; i++)
+   {
+      // Output frame n sits at input frame n * sourceRate / rate
+      U64 pos = U64(mOutFrame + i) * mSourceRate;
+      S32 frame = S32(pos / mSamplingRate);
+
+      if (mFilterTable.size() == 0)
+      {
+         for (U32 c=0; c<channels; c++)
+            out[c][i] = mHistory[c][frame - mHistoryStart];
+         continue;
+      }
+
+      // Blend the two nearest filter phases
+      F32 phasePos = F32(pos % mSamplingRate) * RESAMPLE_PHASES / F32(mSamplingRate);
+      U32 phase = U32(phasePos);
+      F32 blend = phasePos - phase;
+      const F32 *row0 = mFilterTable.address() + phase * RESAMPLE_TAPS;
+      const F32 *row1 = row0 + RESAMPLE_TAPS;
+      for (U32 k=0; k<RESAMPLE_TAPS; k++)
+         kernel[k] = row0[k] + (row1[k] - row0[k]) * blend;
+
+      S32 first = frame - (half - 1) - mHistoryStart;
+      for (U32 c=0; c<channels; c++)
+         out[c][i] = gKernels.dotProduct(mHistory[c].address() + first, kernel, RESAMPLE_TAPS);
+   }
+}
+
+//--------------------------------------------------------------------------
+bool AudioConvertFilter::_read(const U32 numBytes, void *pBuffer)
+{
+   if (numBytes == 0)
+      return true;
+
+   AssertFatal(pBuffer != NULL, "NULL input buffer");
+   if (getStatus() == Closed)
+   {
+      AssertFatal(false, "Attempted read from a closed stream");
+      return false;
+   }
+
+   U8 *buffer = (U8*)pBuffer;
+   U32 left = numBytes;
+   U32 frameSize = getFormatSize(mFormat);
+   U32 channels = getFormatChannels(mFormat);
+   const S32 half = RESAMPLE_TAPS / 2;
+
+   // Rest of a frame split by the last read
+   if (mCarrySize != 0)
+   {
+      U32 amount = getMin(left, mCarrySize);
+      dMemcpy(buffer, mCarry + (frameSize - mCarrySize), amount);
+      buffer += amount;
+      left -= amount;
+      mCarrySize -= amount;
+      mPosition += amount;
+   }
+
+   while (left != 0)
+   {
+      if (mOutFrame >= mOutFrames)
+      {
+         setStatus(EOS);
+         return false;
+      }
+
+      U32 frames = getMin(getMin(mOutFrames - mOutFrame, (U32)CONVERT_BLOCKSIZE), getMax(left / frameSize, (U32)1));
+
+      // Make sure the filter can see every input frame it needs
+      S32 lastFrame = S32((U64(mOutFrame + frames - 1) * mSourceRate) / mSamplingRate);
+      if (mFilterTable.size() != 0)
+         lastFrame += half;
+      if (!fillHistory(lastFrame))
+      {
+         setStatus(IOError);
+         return false;
+      }
+
+      F32 *out[2];
+      for (U32 c=0; c<channels; c++) {
+         mOutBuffer[c].setSize(frames);
+         out[c] = mOutBuffer[c].address();
+      }
+      resample(frames, out);
+      mOutFrame += frames;
+
+      // Interleave, then convert to the output format
+      const F32 *interleaved = out[0];
+      if (channels == 2)
+      {
+         mFloatBuffer.setSize(frames * 2);
+         gKernels.interleave(out[0], out[1], mFloatBuffer.address(), frames);
+         interleaved = mFloatBuffer.address();
+      }
+
+      U32 bytes = frames * frameSize;
+      if (bytes <= left)
+      {
+         fromFloat(mFormat, interleaved, buffer, frames * channels);
+         buffer += bytes;
+         left -= bytes;
+         mPosition += bytes;
+      }
+      else
+      {
+         // Only part of this frame was asked for; keep the rest for next time
+         fromFloat(mFormat, interleaved, mCarry, channels);
+         dMemcpy(buffer, mCarry, left);
+         mCarrySize = frameSize - left;
+         mPosition += left;
+         left = 0;
+      }
+
+      // Drop input frames the filter has finished with
+      S32 nextFrame = S32((U64(mOutFrame) * mSourceRate) / mSamplingRate);
+      S32 keepFrom = nextFrame - (mFilterTable.size() ? (half - 1) : 0);
+      S32 drop = getMin(keepFrom - mHistoryStart, S32(mHistory[0].size()));
+      if (drop > 0)
+      {
+         for (U32 c=0; c<channels; c++) {
+            U32 keep = mHistory[c].size() - drop;
+            dMemmove(mHistory[c].address(), mHistory[c].address() + drop, keep * sizeof(F32));
+            mHistory[c].setSize(keep);
+         }
+         mHistoryStart += drop;
+      }
+   }
+
+   setStatus(Ok);
+   return true;
+}
+
+//--------------------------------------------------------------------------
+bool AudioConvertFilter::_write(const U32 numBytes, const void *pBuffer)
+{
+   AssertFatal(false, "Write on AudioConvertFilter not permitted!");
+   return false;
+}
+
+//--------------------------------------------------------------------------
+U32 AudioConvertFilter::getPosition() const
+{
+   return mPosition;
+}
+
+//--------------------------------------------------------------------------
+bool AudioConvertFilter::setPosition(const U32 newPosition)
+{
+   AssertFatal(mSource != NULL, "Error, not attached");
+   U32 frameSize = getFormatSize(mFormat);
+   U32 frame = newPosition / frameSize;
+   if (frame > mOutFrames)
+      return false;
+
+   // Restart the filter a little before the first input frame it needs
+   const S32 half = RESAMPLE_TAPS / 2;
+   S32 sourceFrame = S32((U64(frame) * mSourceRate) / mSamplingRate);
+   S32 start = mFilterTable.size() ? getMax(sourceFrame - (half - 1), 0) : sourceFrame;
+   if (!mSource->setPosition(start * getFormatSize(mSourceFormat)))
+      return false;
+
+   // Frames before the start of the source are silence
+   U32 channels = getFormatChannels(mFormat);
+   mHistoryStart = mFilterTable.size() ? sourceFrame - (half - 1) : sourceFrame;
+   U32 silence = start - mHistoryStart;
+   for (U32 c=0; c<channels; c++) {
+      mHistory[c].setSize(silence);
+      if (silence) dMemset(mHistory[c].address(), 0, silence * sizeof(F32));
+   }
+   mSourceRead = start;
+   mOutFrame = frame;
+   mPosition = frame * frameSize;
+   mCarrySize = 0;
+
+   // Skip into the frame if need be
+   U32 skip = newPosition - mPosition;
+   if (skip != 0)
+   {
+      U8 scratch[8];
+      if (!read(skip, scratch))
+         return false;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------------
+U32 AudioConvertFilter::getStreamSize()
+{
+   return mDecodedSize;
+}
+
+//--------------------------------------------------------------------------
+U8 AudioConvertFilter::getChannelFormat()
+{
+   return mFormat;
+}
+
+//--------------------------------------------------------------------------
+U32 AudioConvertFilter::getNumSamples()
+{
+   return mOutFrames;
+}
+
+//--------------------------------------------------------------------------
+bool AudioConvertFilter::seekTime(F32 time)
+{
+   return Parent::seekTime(time);
+}
+
+//--------------------------------------------------------------------------
+F32 AudioConvertFilter::getTime()
+{
+   return mSamplingRate ? F32(mOutFrame) / F32(mSamplingRate) : .0;
+}
+
+//--------------------------------------------------------------------------
+F32 AudioConvertFilter::getTimeLength()
+{
+   return mSamplingRate ? F32(mOutFrames) / F32(mSamplingRate) : .0;
+}
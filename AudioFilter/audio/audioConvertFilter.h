@@ -0,0 +1,105 @@
+#ifndef _AUDIOCONVERTFILTER_H_
+#define _AUDIOCONVERTFILTER_H_
+
+#ifndef _AUDIOFILTER_H_
+#include "audio/audioFilter.h"
+#endif
+#ifndef _TVECTOR_H_
+#include "core/tVector.h"
+#endif
+
+#define RESAMPLE_TAPS 32      // Length of the resampling filter (in input samples)
+#define RESAMPLE_PHASES 256   // Number of filter positions between two input samples
+#define CONVERT_BLOCKSIZE 1024// Frames converted at a time
+
+//----------------------------------------------------------------------
+/// Converts the output of another AudioFilter to a different channel format and/or sampling rate.
+///
+/// Attach it to the AudioFilter to convert (which must already be attached to its own stream) rather than to a plain
+/// stream. Channels are mixed up or down as needed, samples converted between 8bit, 16bit and float, and the sampling
+/// rate changed with a windowed sinc filter (RESAMPLE_TAPS long, interpolated between RESAMPLE_PHASES positions).
+/// The heavy lifting is done with SSE2, and AVX for the resampling filter, where the CPU supports them.
+///
+/// e.g. to normalise a clip to 44.1KHz 16bit stereo as it is loaded :
+/// @code
+///  AudioFilter *filter = AudioFilterManager::getFilterFromFile("~/sound.spx", AudioFilterManager::AudioRead);
+///  filter->attachStream(fs);
+///  AudioConvertFilter convert(AudioFilter::CHANNEL_STEREO_16, 44100);
+///  convert.attachStream(filter);
+///  convert.read(convert.getStreamSize(), data);
+/// @endcode
+///
+/// @note Only reading is supported.
+class AudioConvertFilter : public AudioFilter
+{
+   typedef AudioFilter Parent;
+
+   AudioFilter* mSource;         ///< Filter being converted
+   U8  mFormat;                  ///< Output channel format
+   U8  mSourceFormat;            ///< Channel format of mSource
+   U32 mSourceRate;              ///< Sampling rate of mSource
+   U32 mSourceFrames;            ///< Length of mSource (in frames)
+   U32 mSourceRead;              ///< Frames read from mSource so far
+   U32 mOutFrames;               ///< Length of the converted audio (in frames)
+   U32 mOutFrame;                ///< Next frame to output
+   U32 mPosition;                ///< Bytes output so far
+
+   /// @name Resampler
+   /// @{
+   Vector<F32> mFilterTable;     ///< (RESAMPLE_PHASES+1) rows of RESAMPLE_TAPS coefficients
+   Vector<F32> mHistory[2];      ///< Input frames (one channel each, after mixing) which the filter still needs
+   S32 mHistoryStart;            ///< Input frame held in mHistory[n][0]
+   void buildFilter();           ///< Fills in mFilterTable for the current rates
+   bool fillHistory(S32 lastFrame); ///< Makes sure mHistory holds every input frame up to lastFrame
+   void resample(U32 frames, F32 *out[2]); ///< Produces the next frames output frames
+   /// @}
+
+   /// @name Buffers
+   /// @{
+   Vector<U8>  mSourceBuffer;    ///< Raw data read from mSource
+   Vector<F32> mFloatBuffer;     ///< mSourceBuffer as float, or output frames being interleaved
+   Vector<F32> mOutBuffer[2];    ///< Output frames, one channel each
+   U8  mCarry[8];                ///< Frame which only partly fitted into the last read
+   U32 mCarrySize;               ///< Amount of mCarry left to hand out
+   /// @}
+
+  public:
+   AudioConvertFilter(U8 format, U32 samplingRate = 0); ///< A samplingRate of 0 keeps the source's rate
+   virtual ~AudioConvertFilter();
+
+   /// @name Overrides of NFilterStream
+   /// @{
+  public:
+   bool    attachStream(Stream* io_pSlaveStream); ///< io_pSlaveStream must be an AudioFilter
+   void    detachStream();
+   Stream* getStream();
+   /// @}
+
+   /// @name Mandatory overrides
+   /// @{
+  protected:
+   bool _read(const U32 in_numBytes,  void* out_pBuffer);
+   bool _write(const U32 in_numBytes, const void* in_pBuffer);
+  public:
+   U32  getPosition() const;
+   bool setPosition(const U32 in_newPosition);
+   U32  getStreamSize();
+   /// @}
+
+   /// @name AudioFilter Management
+   /// @{
+  U8 getChannelFormat();
+  U32 getNumSamples();
+  bool seekTime(F32 time);
+  F32 getTime();
+  F32 getTimeLength();
+  /// @}
+
+  static void initKernels();            ///< Picks the fastest conversion routines for this CPU
+  static const char *getKernelName();   ///< Name of the routines in use ("C", "SSE2" or "AVX")
+
+  /// Converts count samples between formats (where the channel counts match)
+  static void convertSamples(U8 inFormat, const void *in, U8 outFormat, void *out, U32 count);
+};
+
+#endif //_AUDIOCONVERTFILTER_H_
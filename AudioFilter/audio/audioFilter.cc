@@ -120,6 +120,7 @@ U32 AudioFilter::getStreamSize()
 //--------------------------------------
 void AudioFilter::setQuality(U8 num)
 {
+   mQuality = num;
 }
 
 //--------------------------------------
@@ -140,10 +141,30 @@ U8 AudioFilter::getChannelFormat()
 	return 255;
 }
 
+//--------------------------------------
+bool AudioFilter::seekSample(U32 sample)
+{
+	// Filters whose setPosition() lands on an exact sample need not override this
+	U32 sampleSize = getFormatSize(getChannelFormat());
+	if (sampleSize == 0 || !hasAudioCapability(AudioSeek))
+		return false;
+	return setPosition(sample * sampleSize);
+}
+
+//--------------------------------------
+U32 AudioFilter::getSample()
+{
+	U32 sampleSize = getFormatSize(getChannelFormat());
+	return sampleSize ? getPosition() / sampleSize : 0;
+}
+
 //--------------------------------------
 bool AudioFilter::seekTime(F32 time)
 {
-	return false;
+	if (mSamplingRate == 0 || time < 0)
+		return false;
+	// Round to the nearest sample, so a time from getTime() comes back to the same place
+	return seekSample(U32(time * mSamplingRate + 0.5f));
 }
 
 //--------------------------------------
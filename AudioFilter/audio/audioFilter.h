@@ -120,9 +120,12 @@ class AudioFilter : public FilterStream
    virtual void setSamplingRate(U32 val) {mSamplingRate = val;} ///< Set Sampling Rate
    
    virtual U8 getChannelFormat(); ///< Get Channel Format
-   virtual bool setChannelFormat(){return true;} ///< Sets Channels Format. Not implemented by all Filters.
+   virtual bool setChannelFormat(U8 format){return false;} ///< Sets Channels Format. Not implemented by all Filters (returns false if the format can't be used).
    virtual U32 getNumSamples(); ///< Get total number of samples (per channel)
 
+   virtual bool seekSample(U32 sample); ///< Seek to a specific sample (per channel) in stream. Lands exactly on it, unlike seeking by bytes in some formats.
+   virtual U32 getSample(); ///< Get current sample (per channel) in stream
+
    virtual F32 getTime(); ///< Get current time in stream
    virtual bool seekTime(F32 time); ///< Seek to specific time in stream
    virtual F32 getTimeLength(); ///< Get current time length
@@ -135,6 +138,8 @@ class AudioFilter : public FilterStream
 	CHANNEL_MONO_16,
 	CHANNEL_STEREO_8,
 	CHANNEL_STEREO_16,
+	CHANNEL_MONO_FLOAT,	///< 32bit float, -1.0 to 1.0
+	CHANNEL_STEREO_FLOAT,
 	CHANNEL_UNKNOWN=255
    };
    /// @}
@@ -145,16 +150,52 @@ inline U8 getFormatSize(U8 format)
 {
 	switch (format)
 	{
+		case AudioFilter::CHANNEL_MONO_8:
+			return 1;
+		break;
+		case AudioFilter::CHANNEL_STEREO_8:
 		case AudioFilter::CHANNEL_MONO_16:
 			return 2;
 		break;
 		case AudioFilter::CHANNEL_STEREO_16:
+		case AudioFilter::CHANNEL_MONO_FLOAT:
 			return 4;
 		break;
+		case AudioFilter::CHANNEL_STEREO_FLOAT:
+			return 8;
+		break;
+		default:
+			return 0;
+		break;
+	};
+}
+
+/// Function to get number of channels in format
+inline U8 getFormatChannels(U8 format)
+{
+	switch (format)
+	{
+		case AudioFilter::CHANNEL_MONO_8:
+		case AudioFilter::CHANNEL_MONO_16:
+		case AudioFilter::CHANNEL_MONO_FLOAT:
+			return 1;
+		break;
+		case AudioFilter::CHANNEL_STEREO_8:
+		case AudioFilter::CHANNEL_STEREO_16:
+		case AudioFilter::CHANNEL_STEREO_FLOAT:
+			return 2;
+		break;
 		default:
 			return 0;
 		break;
 	};
 }
 
+/// Function to get size of each channel's value in format
+inline U8 getFormatChannelSize(U8 format)
+{
+	U8 channels = getFormatChannels(format);
+	return channels ? getFormatSize(format) / channels : 0;
+}
+
 #endif //_AUDIOFILTER_H_
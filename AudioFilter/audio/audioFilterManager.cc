@@ -11,11 +11,19 @@
 #include "audio/speexFilter.h"
 #endif
 
+#ifndef NO_OPUSFILTER
+#include "audio/opusFilter.h"
+#endif
+
 #include "audio/rawFilter.h"
 
 #endif
 
 #include "audio/audioFilterManager.h"
+#include "audio/audioConvert.h"
+#include "audio/audioConvertFilter.h"
+#include "audio/audioStreamService.h"
+#include "audio/pcmCacheFilter.h"
 #include "audio/audioBuffer.h"
 #include "console/console.h"
 
@@ -34,6 +42,13 @@ AudioFilter* createSpeexFilter()
 }
 #endif
 
+#ifndef NO_OPUSFILTER
+AudioFilter *createOpusFilter()
+{
+	return new OpusFilter();
+}
+#endif
+
 #ifndef NO_VORBISFILTER
 AudioFilter *createVorbisFilter()
 {
@@ -58,16 +73,29 @@ void AudioFilterManager::init()
 	info = new FilterInfo;
 	info->audioCapability = AudioFilter::AudioEncode;
 	info->name = StringTable->insert("SPEEX");
+	info->qualityLevels = 25;
 	info->extension = ".spx";
 	info->createFunc = &createSpeexFilter;
 	registerFilter(info);
 	ResourceManager->registerExtension(".spx", AudioBuffer::construct);
 	#endif
+
+	#ifndef NO_OPUSFILTER
+	info = new FilterInfo;
+	info->audioCapability = AudioFilter::AudioEncode | AudioFilter::AudioSeek | AudioFilter::AudioTime;
+	info->name = StringTable->insert("OPUS");
+	info->qualityLevels = 11;
+	info->extension = ".opus";
+	info->createFunc = &createOpusFilter;
+	registerFilter(info);
+	ResourceManager->registerExtension(".opus", AudioBuffer::construct);
+	#endif
 	
 	#ifndef NO_VORBISFILTER
 	info = new FilterInfo;
-	info->audioCapability = AudioFilter::AudioSeek | AudioFilter::AudioTime;
+	info->audioCapability = AudioFilter::AudioEncode | AudioFilter::AudioSeek | AudioFilter::AudioTime;
 	info->name = StringTable->insert("VORBIS");
+	info->qualityLevels = 11;
 	info->extension = ".ogg";
 	info->createFunc = &createVorbisFilter;
 	registerFilter(info);
@@ -77,6 +105,7 @@ void AudioFilterManager::init()
 	info = new FilterInfo;
 	info->audioCapability = AudioFilter::AudioSeek | AudioFilter::AudioTime | AudioFilter::AudioEncode;
 	info->name = StringTable->insert("RAW");
+	info->qualityLevels = 1;
 	info->extension = ".raw";
 	info->createFunc = &createRawFilter;
 	registerFilter(info);
@@ -86,11 +115,21 @@ void AudioFilterManager::init()
 	// This is here to prevent any fatal assert's as a result of the .wav extension not being registered.
 	ResourceManager->registerExtension(".wav", AudioBuffer::construct);
 	#endif
+
+	AudioConvertFilter::initKernels();
+	AudioConvertQueue::init();
+	AudioStreamService::init();
+	AudioPCMCache::init();
 }
 
 //--------------------------------------------------------------------------
 void AudioFilterManager::destroy()
 {
+	// Conversions and streams use the filters, so finish those off first
+	AudioConvertQueue::destroy();
+	AudioStreamService::destroy();
+	AudioPCMCache::destroy();
+
 	// Destroy all the FilterInfo's
 	for (U8 i=0;i<filterList.size();i++)
 	{
@@ -102,8 +141,20 @@ void AudioFilterManager::destroy()
 //--------------------------------------------------------------------------
 AudioFilter * AudioFilterManager::getFilterFromFile(const char *filename, U8 mode)
 {
-	S32 len = dStrlen(filename);
-	
+	FilterInfo *info = findFilterInfoForFile(filename);
+	if (!info)
+		return NULL;
+
+	// Reads go through the PCM cache, which decides whether the clip is small enough to keep once it is opened.
+	// Raw audio has no header, so its format and rate aren't known until the caller sets them; it is read directly.
+	if (mode == AudioRead && AudioPCMCache::isEnabled() && dStricmp(info->name, "RAW"))
+		return new PCMCacheFilter(info, filename);
+	return initializeFilter(info, mode);
+}
+
+//--------------------------------------------------------------------------
+FilterInfo *AudioFilterManager::findFilterInfoForFile(const char *filename)
+{
 	const char *extension = extractFileExtension(filename);
 	
 	// Loop through the FilterInfo's and find appropriate filter for extension
@@ -115,7 +166,7 @@ AudioFilter * AudioFilterManager::getFilterFromFile(const char *filename, U8 mod
 		{
 			if (!dStricmp(strPtr, extension))
 			{
-				return initializeFilter(filterList[i], mode);
+				return filterList[i];
 			}
 			strPtr = extractListToken(strPtr, ' ');
 		}
@@ -288,99 +339,6 @@ AudioFilter *AudioFilterManager::createFilter(const char*name, U8 mode)
 
 //--------------------------------------------------------------------------
 
-/// Converts 1 file to another
-/// @param 3 Input File
-/// @param 4 Output File
-/// @param 5 Output Quality (Optional)
-/// @param 6 Output VBR Quality
-///
-/// Example usage :
-/// @code
-/// filterConvert("mymusic.ogg", "myvoicemusic.spx", 5, 0.5);
-/// @endcode
-///
-/// @note Any errors will be reported in the console; Beware that this function may cause torque to hang for 
-/// an extended period of time depending on the size of the audio you are converting.
-ConsoleFunction(filterConvert, void, 3, 5, "filterConvert(filename in, filename out [quality, vbrquality])")
-{
-   FileStream *in;
-   FileStream *out;
-   AudioFilter *in_filter;
-   AudioFilter *out_filter;
-   char *decoded_buffer;
-   
-   U8 quality=8;
-   F32 vbrquality=-1;
-   
-   if (argc > 3)
-   {
-   	quality = dAtoi(argv[3]);
-   	if (argc > 4)
-   		vbrquality = dAtof(argv[4]);
-   }
-
-   U32 samplingRate;
-   
-   // Set up the filters and the reading buffer
-   in_filter = AudioFilterManager::getFilterFromFile(argv[1],AudioFilterManager::AudioRead);
-   if (!in_filter)
-   {
-      Con::errorf("Error: could not open filter to read!");
-   }
-   out_filter = AudioFilterManager::getFilterFromFile(argv[2],AudioFilterManager::AudioWrite);
-   if (!out_filter)
-   {
-      Con::errorf("Error: could not open filter to write!");
-      AudioFilterManager::closeFilter(in_filter);
-      return;
-   }
-
-   // Read in input audio...
-   in = new FileStream();
-   in->open(argv[1], FileStream::Read);
-
-   // Write out output audio...
-   out = new FileStream();
-   out->open(argv[2], FileStream::Write);
-
-   // Filter Data
-   Con::printf("Filtering Data...");
-   in_filter->attachStream(in);
-   out_filter->attachStream(out);
-   U32 size = in_filter->getStreamSize();
-   Con::printf("File Sampling Rate is : %d", in_filter->getSamplingRate());
-   Con::printf("Reading %d bytes", size);
-   decoded_buffer = new char[size];
-
-   // read in Data
-   Con::printf("Decoding Data...");
-   in_filter->read(size, decoded_buffer);
-
-   // write decoded data
-   Con::printf("Encoding Data to out, quality %d, VBR quality %f", vbrquality);
-   Con::printf("Attached to stream, now writing...");
-   out_filter->setSize(size);
-   out_filter->setQuality(quality);
-   out_filter->setVBRQuality(vbrquality);
-   out_filter->setSamplingRate(in_filter->getSamplingRate());
-   out_filter->writeHeader(); // Header is very important
-   out_filter->write(size, decoded_buffer);
-
-   // Cleanup
-   Con::printf("Detatched from stream");
-   in_filter->detachStream();
-
-   Con::printf("Cleanup");
-   out->close();
-   in->close();
-   delete in;
-   AudioFilterManager::closeFilter(in_filter);
-   AudioFilterManager::closeFilter(out_filter);
-   delete out;
-
-   delete [] decoded_buffer;
-}
-
 /// Lists available filters in the AudioFilterManager
 ConsoleFunction(filterList, void, 1, 1, "filterList")
 {
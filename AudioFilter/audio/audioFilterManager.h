@@ -88,6 +88,7 @@ class AudioFilterManager
 			static Vector<FilterInfo*> *getFilterList(){return &filterList;} ///< Returns reference to existing FilterInfo Vector.
 			static FilterInfo *findFilterInfo(const char *filterName); ///< Finds a FilterInfo. that has a name, filterName
 			static FilterInfo *getFilterInfo(U8 id); ///< Finds a FilterInfo with the specified id.
+			static FilterInfo *findFilterInfoForFile(const char *filename); ///< Finds the FilterInfo which handles filename's extension.
 		/// @}
 		
 		/// @name Functions to open / close filter streams 
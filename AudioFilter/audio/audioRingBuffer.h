@@ -0,0 +1,97 @@
+#ifndef _AUDIORINGBUFFER_H_
+#define _AUDIORINGBUFFER_H_
+
+#ifndef _PLATFORM_H_
+#include "platform/platform.h"
+#endif
+
+/// Orders the data copied into an AudioRingBuffer against the position that publishes it
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AUDIO_MEMORY_BARRIER() _ReadWriteBarrier() // x86 keeps stores (and loads) in order, so stopping the compiler is enough
+#else
+#define AUDIO_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+//----------------------------------------------------------------------
+/// Fixed size ring buffer of PCM data, passed from one thread to another.
+///
+/// Safe without locking so long as one thread only ever writes, and one other thread only ever reads.
+/// Positions only ever count upwards (wrapping round at 4GB), and the size is a power of two,
+/// so the amount of data held is simply the difference between them.
+///
+/// @code
+///  // Decoder thread
+///  U32 written = ring.write(decoded, size);
+///  // Mixer thread
+///  U32 read = ring.read(out, size);
+/// @endcode
+class AudioRingBuffer
+{
+   U8 *mData;              ///< Buffer
+   U32 mSize;              ///< Size of mData (a power of two)
+   volatile U32 mReadPos;  ///< Total bytes read; only changed by the reader
+   volatile U32 mWritePos; ///< Total bytes written; only changed by the writer
+
+  public:
+   AudioRingBuffer(U32 size=0) : mData(NULL), mSize(0), mReadPos(0), mWritePos(0) {if (size) init(size);}
+   ~AudioRingBuffer() {if (mData) delete [] mData;}
+
+   /// Allocates the buffer, rounded up to a power of two. Not thread safe.
+   void init(U32 size)
+   {
+      if (mData) delete [] mData;
+      mSize = 1;
+      while (mSize < size) mSize <<= 1;
+      mData = new U8[mSize];
+      mReadPos = mWritePos = 0;
+   }
+
+   /// Empties the buffer. Neither side may be using it.
+   void clear() {mReadPos = mWritePos = 0;}
+
+   U32 getSize() const {return mSize;}
+   U32 getReadAvailable() const {return mWritePos - mReadPos;}             ///< Bytes ready to read
+   U32 getWriteAvailable() const {return mSize - (mWritePos - mReadPos);}  ///< Bytes free to write
+
+   /// Copies in as much of data as will fit; returns the amount copied. Writer thread only.
+   U32 write(const void *data, U32 bytes)
+   {
+      U32 pos = mWritePos;
+      U32 space = mSize - (pos - mReadPos);
+      if (bytes > space) bytes = space;
+      if (bytes == 0) return 0;
+
+      U32 start = pos & (mSize-1);
+      U32 first = getMin(bytes, mSize - start);
+      dMemcpy(mData + start, data, first);
+      if (first < bytes)
+         dMemcpy(mData, (const U8*)data + first, bytes - first);
+
+      AUDIO_MEMORY_BARRIER(); // Data must land before the reader can see it
+      mWritePos = pos + bytes;
+      return bytes;
+   }
+
+   /// Copies out up to bytes of data; returns the amount copied. Reader thread only.
+   U32 read(void *data, U32 bytes)
+   {
+      U32 pos = mReadPos;
+      U32 avail = mWritePos - pos;
+      if (bytes > avail) bytes = avail;
+      if (bytes == 0) return 0;
+
+      AUDIO_MEMORY_BARRIER(); // Don't read data older than the position we just saw
+      U32 start = pos & (mSize-1);
+      U32 first = getMin(bytes, mSize - start);
+      dMemcpy(data, mData + start, first);
+      if (first < bytes)
+         dMemcpy((U8*)data + first, mData, bytes - first);
+
+      AUDIO_MEMORY_BARRIER(); // Finish with the data before the writer can reuse it
+      mReadPos = pos + bytes;
+      return bytes;
+   }
+};
+
+#endif //_AUDIORINGBUFFER_H_
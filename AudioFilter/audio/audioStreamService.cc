@@ -0,0 +1,262 @@
+#include "audio/audioStreamService.h"
+#include "audio/audioFilter.h"
+#include "console/console.h"
+#include "platform/platformMutex.h"
+#include "platform/platformSemaphore.h"
+#include "platform/platformThread.h"
+
+// Static variables
+Vector<AudioStreamServiceSource*> AudioStreamService::smSources;
+Vector<Thread*> AudioStreamService::smWorkers;
+void *AudioStreamService::smMutex = NULL;
+void *AudioStreamService::smSemaphore = NULL;
+bool AudioStreamService::smShutdown = false;
+S32 AudioStreamService::smNumThreads = 1;
+U32 AudioStreamService::smUnderruns = 0;
+U32 AudioStreamService::smUnderrunBytes = 0;
+
+//--------------------------------------------------------------------------
+AudioStreamServiceSource::AudioStreamServiceSource(AudioFilter *filter, U32 bufferSize, bool loop)
+ : mRing(bufferSize)
+{
+   mFilter = filter;
+   mDecodedPos = filter->getPosition();
+   mDecodedSize = filter->getStreamSize();
+   mLooping = loop;
+   mEndOfStream = false;
+   mFillRequested = true;
+   mBusy = false;
+   mUnderruns = mUnderrunBytes = mBytesRead = 0;
+}
+
+//--------------------------------------------------------------------------
+U32 AudioStreamServiceSource::read(void *out, U32 bytes)
+{
+   U32 got = mRing.read(out, bytes);
+   mBytesRead += got;
+
+   if (got < bytes && !mEndOfStream)
+   {
+      mUnderruns++;
+      mUnderrunBytes += bytes - got;
+      AudioStreamService::smUnderruns++;
+      AudioStreamService::smUnderrunBytes += bytes - got;
+   }
+
+   // Top up once we're down to half
+   if (!mEndOfStream && !mFillRequested && mRing.getReadAvailable() < mRing.getSize() / 2)
+      AudioStreamService::requestFill(this);
+
+   return got;
+}
+
+//--------------------------------------------------------------------------
+class AudioStreamWorker : public Thread
+{
+  public:
+   AudioStreamWorker() : Thread(0, 0, false) {}
+   virtual void run(S32 arg) {AudioStreamService::workerMain();}
+};
+
+//--------------------------------------------------------------------------
+void AudioStreamService::init()
+{
+   smMutex = Mutex::createMutex();
+   smSemaphore = Semaphore::createSemaphore(0);
+   smShutdown = false;
+   Con::addVariable("$Audio::streamThreads", TypeS32, &smNumThreads);
+}
+
+//--------------------------------------------------------------------------
+void AudioStreamService::destroy()
+{
+   if (!smMutex)
+      return;
+
+   smShutdown = true;
+   for (U32 i=0; i<smWorkers.size(); i++)
+      Semaphore::releaseSemaphore(smSemaphore);
+   for (U32 i=0; i<smWorkers.size(); i++)
+   {
+      smWorkers[i]->join();
+      delete smWorkers[i];
+   }
+   smWorkers.clear();
+
+   for (U32 i=0; i<smSources.size(); i++)
+      delete smSources[i];
+   smSources.clear();
+
+   Mutex::destroyMutex(smMutex);
+   Semaphore::destroySemaphore(smSemaphore);
+   smMutex = smSemaphore = NULL;
+}
+
+//--------------------------------------------------------------------------
+AudioStreamServiceSource *AudioStreamService::addSource(AudioFilter *filter, U32 bufferSize, bool loop)
+{
+   AssertFatal(smMutex, "AudioStreamService::addSource: not initialized!");
+
+   if (bufferSize == 0)
+      bufferSize = (filter->getSamplingRate() * getFormatSize(filter->getChannelFormat()) * AUDIOSTREAM_BUFFERMS) / 1000;
+   if (bufferSize < AUDIOSTREAM_CHUNKSIZE * 2)
+      bufferSize = AUDIOSTREAM_CHUNKSIZE * 2;
+
+   AudioStreamServiceSource *source = new AudioStreamServiceSource(filter, bufferSize, loop);
+
+   Mutex::lockMutex(smMutex);
+   smSources.push_back(source);
+   Mutex::unlockMutex(smMutex);
+
+   // Workers are started on demand
+   while (smWorkers.size() < getMax(smNumThreads, 1))
+   {
+      Thread *worker = new AudioStreamWorker();
+      worker->start();
+      smWorkers.push_back(worker);
+   }
+
+   Semaphore::releaseSemaphore(smSemaphore);
+   return source;
+}
+
+//--------------------------------------------------------------------------
+void AudioStreamService::removeSource(AudioStreamServiceSource *source)
+{
+   // Once it's out of the list no worker can pick it up, but one may still be filling it
+   while (1)
+   {
+      Mutex::lockMutex(smMutex);
+      bool busy = source->mBusy;
+      if (!busy)
+      {
+         for (U32 i=0; i<smSources.size(); i++)
+         {
+            if (smSources[i] == source) {
+               smSources.erase(i);
+               break;
+            }
+         }
+      }
+      Mutex::unlockMutex(smMutex);
+
+      if (!busy)
+         break;
+      Platform::sleep(1);
+   }
+
+   delete source;
+}
+
+//--------------------------------------------------------------------------
+void AudioStreamService::requestFill(AudioStreamServiceSource *source)
+{
+   source->mFillRequested = true;
+   Semaphore::releaseSemaphore(smSemaphore);
+}
+
+//--------------------------------------------------------------------------
+AudioStreamServiceSource *AudioStreamService::pickSource()
+{
+   // Emptiest first, as it is closest to running out
+   AudioStreamServiceSource *best = NULL;
+   Mutex::lockMutex(smMutex);
+   for (U32 i=0; i<smSources.size(); i++)
+   {
+      AudioStreamServiceSource *source = smSources[i];
+      if (source->mBusy || !source->mFillRequested || source->mEndOfStream)
+         continue;
+      if (!best || source->mRing.getReadAvailable() < best->mRing.getReadAvailable())
+         best = source;
+   }
+   if (best)
+   {
+      best->mBusy = true;
+      best->mFillRequested = false;
+   }
+   Mutex::unlockMutex(smMutex);
+   return best;
+}
+
+//--------------------------------------------------------------------------
+void AudioStreamService::fillSource(AudioStreamServiceSource *source)
+{
+   U8 chunk[AUDIOSTREAM_CHUNKSIZE];
+   AudioFilter *filter = source->mFilter;
+
+   while (source->mRing.getWriteAvailable() >= AUDIOSTREAM_CHUNKSIZE && !smShutdown)
+   {
+      if (source->mDecodedPos >= source->mDecodedSize)
+      {
+         if (!source->mLooping || source->mDecodedSize == 0 || !filter->setPosition(0))
+         {
+            source->mEndOfStream = true;
+            break;
+         }
+         source->mDecodedPos = 0;
+      }
+
+      U32 chunkSize = getMin(source->mDecodedSize - source->mDecodedPos, (U32)AUDIOSTREAM_CHUNKSIZE);
+      if (!filter->read(chunkSize, chunk))
+      {
+         source->mEndOfStream = true;
+         break;
+      }
+      source->mDecodedPos += chunkSize;
+      source->mRing.write(chunk, chunkSize);
+   }
+}
+
+//--------------------------------------------------------------------------
+void AudioStreamService::workerMain()
+{
+   while (1)
+   {
+      Semaphore::acquireSemaphore(smSemaphore, true);
+      if (smShutdown)
+         return;
+
+      // Keep going while there is work, in case requests arrived while we were busy
+      AudioStreamServiceSource *source;
+      while ((source = pickSource()) != NULL)
+      {
+         fillSource(source);
+
+         Mutex::lockMutex(smMutex);
+         source->mBusy = false;
+         Mutex::unlockMutex(smMutex);
+      }
+   }
+}
+
+//--------------------------------------------------------------------------
+void AudioStreamService::printStats()
+{
+   Mutex::lockMutex(smMutex);
+   Con::printf("%d streaming sources, %d workers", smSources.size(), smWorkers.size());
+   for (U32 i=0; i<smSources.size(); i++)
+   {
+      AudioStreamServiceSource *source = smSources[i];
+      Con::printf("  %d : %d / %d bytes buffered, %d underruns (%d bytes)%s", i,
+                  source->mRing.getReadAvailable(), source->mRing.getSize(),
+                  source->mUnderruns, source->mUnderrunBytes,
+                  source->mEndOfStream ? ", finished decoding" : "");
+   }
+   Con::printf("%d underruns in total (%d bytes)", smUnderruns, smUnderrunBytes);
+   Mutex::unlockMutex(smMutex);
+}
+
+/// Prints the state of every streaming source
+ConsoleFunction(audioStreamStats, void, 1, 1, "audioStreamStats()")
+{
+   AudioStreamService::printStats();
+}
+
+/// Returns the total number of streaming underruns, optionally resetting the count
+ConsoleFunction(getAudioStreamUnderruns, S32, 1, 2, "getAudioStreamUnderruns([bool reset])")
+{
+   S32 underruns = AudioStreamService::smUnderruns;
+   if (argc > 1 && dAtob(argv[1]))
+      AudioStreamService::smUnderruns = AudioStreamService::smUnderrunBytes = 0;
+   return underruns;
+}
@@ -0,0 +1,105 @@
+#ifndef _AUDIOSTREAMSERVICE_H_
+#define _AUDIOSTREAMSERVICE_H_
+
+#ifndef _PLATFORM_H_
+#include "platform/platform.h"
+#endif
+#ifndef _TVECTOR_H_
+#include "core/tVector.h"
+#endif
+#ifndef _AUDIORINGBUFFER_H_
+#include "audio/audioRingBuffer.h"
+#endif
+
+#define AUDIOSTREAM_CHUNKSIZE 8192   // PCM decoded by a worker at a time
+#define AUDIOSTREAM_BUFFERMS 500     // Default amount of audio decoded ahead of playback
+
+class AudioFilter;
+class Thread;
+
+//----------------------------------------------------------------------
+/// An AudioFilter being decoded ahead of playback by AudioStreamService.
+///
+/// Once added to the service, the filter belongs to the worker threads until the source is removed, so it must not be
+/// read, seeked or detached in the meantime. The mixer only calls read(), which copies out of the source's ring buffer.
+class AudioStreamServiceSource
+{
+   friend class AudioStreamService;
+
+   AudioFilter *mFilter;        ///< Filter being decoded (not owned)
+   AudioRingBuffer mRing;       ///< Decoded PCM waiting for the mixer
+   U32 mDecodedPos;             ///< Position in mFilter (worker side)
+   U32 mDecodedSize;            ///< Decoded size of mFilter
+   bool mLooping;               ///< Go back to the start when the end is reached?
+   volatile bool mEndOfStream;  ///< Worker has decoded everything
+   volatile bool mFillRequested;///< Mixer has asked for the ring to be topped up
+   bool mBusy;                  ///< Being filled by a worker (guarded by the service mutex)
+
+   AudioStreamServiceSource(AudioFilter *filter, U32 bufferSize, bool loop);
+
+  public:
+   /// @name Stats
+   /// Updated by the mixer, so only approximate when read from elsewhere
+   /// @{
+   U32 mUnderruns;              ///< Number of read()s which came up short
+   U32 mUnderrunBytes;          ///< Total bytes missing from those reads
+   U32 mBytesRead;              ///< Total bytes read by the mixer
+   /// @}
+
+   U32 read(void *out, U32 bytes);  ///< Copies out up to bytes of decoded PCM. Mixer thread only.
+   bool isFinished() const {return mEndOfStream && mRing.getReadAvailable() == 0;}
+   U32 getBuffered() const {return mRing.getReadAvailable();}
+   AudioFilter *getFilter() {return mFilter;}
+};
+
+//----------------------------------------------------------------------
+/// Decodes streaming audio (e.g. music and ambience) on a pool of worker threads.
+///
+/// Each source has a ring buffer which the workers keep topped up, so decoding never happens on the thread
+/// which plays the audio. When a source's ring drops below half full, read() wakes a worker to refill it.
+///
+/// Nothing in the engine plays from the service yet. The stock streaming sources (AudioStreamSource and its OpenAL
+/// subclasses) still decode on the thread which updates them, so whatever mixes the audio has to call read() itself.
+///
+/// @code
+///  AudioFilter *filter = AudioFilterManager::getFilterFromFile("~/music.ogg", AudioFilterManager::AudioRead);
+///  filter->attachStream(stream);
+///  AudioStreamServiceSource *source = AudioStreamService::addSource(filter, 0, true);
+///  ...
+///  // In the mixer
+///  U32 got = source->read(mixBuffer, mixSize);
+///  ...
+///  AudioStreamService::removeSource(source);
+///  AudioFilterManager::closeFilter(filter);
+/// @endcode
+class AudioStreamService
+{
+   static Vector<AudioStreamServiceSource*> smSources;   ///< Sources being streamed
+   static Vector<Thread*> smWorkers;            ///< Worker threads
+   static void *smMutex;                        ///< Guards smSources and each source's mBusy
+   static void *smSemaphore;                    ///< Released when a source needs filling (and once per worker on shutdown)
+   static bool smShutdown;
+
+   static AudioStreamServiceSource *pickSource(); ///< Finds a source which needs filling, and marks it busy
+   static void fillSource(AudioStreamServiceSource *source);
+
+  public:
+   static S32 smNumThreads;                     ///< Number of workers ($Audio::streamThreads)
+   static U32 smUnderruns;                      ///< Underruns across all sources, past and present
+   static U32 smUnderrunBytes;
+
+   static void init();
+   static void destroy();
+
+   /// Starts decoding filter ahead of playback. bufferSize is in bytes (0 picks AUDIOSTREAM_BUFFERMS worth).
+   static AudioStreamServiceSource *addSource(AudioFilter *filter, U32 bufferSize = 0, bool loop = false);
+   /// Stops decoding source and deletes it. The filter can be used (or closed) once this returns.
+   static void removeSource(AudioStreamServiceSource *source);
+   /// Wakes a worker to fill a source
+   static void requestFill(AudioStreamServiceSource *source);
+
+   static void workerMain();                    ///< Main loop of each worker
+   static void printStats();                    ///< Prints buffer levels and underruns to the console
+};
+
+#endif //_AUDIOSTREAMSERVICE_H_
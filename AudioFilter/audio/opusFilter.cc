@@ -0,0 +1,654 @@
+#include "audio/audioFilter.h"
+#include "audio/opusFilter.h"
+#include "console/console.h"
+#include "core/fileStream.h"
+#include "math/mMath.h"
+
+//--------------------------------------------------------------------------
+OpusFilter::OpusFilter()
+ : m_pStream(NULL)
+{
+   // Set some defaults
+   mDetectHeaders = true;
+   mEnableRead = true;
+   mEnableWrite = false;
+   mQuality = 8;
+   mSamplingRate = 0;
+   mDecodedSize = 0;
+   mVBRQuality = -1;
+   mEncoder = NULL;
+   mDecoder = NULL;
+   mChannelFormat = CHANNEL_MONO_16;
+   mFrameSamples = 0;
+   mPreSkip = 0;
+   mPendingBytes = 0;
+   mWriteStarted = false;
+   mReadAhead = NULL;
+}
+
+//--------------------------------------------------------------------------
+OpusFilter::~OpusFilter()
+{
+	if (getStatus() != Closed)
+		detachStream();
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::attachStream(Stream* io_pSlaveStream)
+{
+   AssertFatal(io_pSlaveStream != NULL, "NULL Slave stream?");
+   AssertFatal(m_pStream == NULL,       "Already attached!");
+
+   m_pStream      = io_pSlaveStream;
+   m_pOutputBuffer = m_pInputBuffer = NULL; // make sure these are NULL
+
+   // Setup AudioCapability
+   mAudioCapability = AudioFilter::AudioEncode | AudioFilter::AudioSeek | AudioFilter::AudioTime;
+
+   trackedPosition = 0;
+   mSkipSamples = 0;
+   mSamplesWritten = 0;
+   mReadAhead = (mEnableRead and m_pStream->hasCapability(StreamRead)) ? new U8[OPUS_READAHEAD] : NULL;
+   flushReadAhead();
+   mSeekIndex.clear();
+   mSeekIndexLoaded = false;
+   mFramesWritten = 0;
+   mPendingBytes = 0;
+
+   // Determine if we should detect headers or not (the encoder is set up by writeHeader())
+   bool DetectHeaders = (mEnableRead and m_pStream->hasCapability(StreamRead)) ? mDetectHeaders : false;
+   if (DetectHeaders && !readHeader())
+   {
+      Con::errorf("OpusFilter: stream is not opus audio!");
+      detachStream();
+      setStatus(IOError);
+      return false;
+   }
+
+   setStatus(Ok);
+   return true;
+}
+
+//--------------------------------------------------------------------------
+void OpusFilter::detachStream()
+{
+   if (mWriteStarted && m_pStream)
+   	finishWrite();
+
+   if (mEncoder != NULL)
+   	opus_encoder_destroy(mEncoder);
+   if (mDecoder != NULL)
+   	opus_decoder_destroy(mDecoder);
+   mEncoder = NULL;
+   mDecoder = NULL;
+
+   if (m_pInputBuffer != NULL)
+   	delete [] m_pInputBuffer;
+   if (m_pOutputBuffer != NULL)
+   	delete [] m_pOutputBuffer;
+   if (mReadAhead != NULL)
+   	delete [] mReadAhead;
+   mReadAhead = NULL;
+
+   mAudioCapability = 0;
+   m_pOutputBuffer = NULL;
+   m_pInputBuffer = NULL;
+   m_pStream      = NULL;
+   setStatus(Closed);
+}
+
+//--------------------------------------------------------------------------
+Stream* OpusFilter::getStream()
+{
+   return m_pStream;
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::createBuffers()
+{
+	U32 frameBytes = mFrameSamples * getFormatSize(mChannelFormat);
+	if (frameBytes == 0)
+		return false;
+
+	if (m_pInputBuffer != NULL)
+		delete [] m_pInputBuffer;
+	if (m_pOutputBuffer != NULL)
+		delete [] m_pOutputBuffer;
+
+	// m_pOutputBuffer holds either a decoded frame or an encoded one
+	m_pInputBuffer = new U8[frameBytes];
+	m_pOutputBuffer = new U8[getMax(frameBytes, (U32)OPUS_MAXPACKET)];
+	return true;
+}
+
+//--------------------------------------------------------------------------
+S32 OpusFilter::decodeFrame(const U8 *data, U32 size, void *out)
+{
+	if (getFormatChannelSize(mChannelFormat) == sizeof(F32))
+		return opus_decode_float(mDecoder, data, size, (float*)out, mFrameSamples, 0);
+	return opus_decode(mDecoder, data, size, (opus_int16*)out, mFrameSamples, 0);
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::_read(const U32 numBytes, void *pBuffer)
+{
+	if (numBytes == 0)
+		return true;
+
+	AssertFatal(pBuffer != NULL, "NULL input buffer");
+	if (getStatus() == Closed)
+	{
+		AssertFatal(false, "Attempted read from a closed stream");
+		return false;
+	}
+
+	if (mDecoder == NULL) {
+		Con::warnf("Warning : opus decoder not set up!");
+		return false;
+	}
+
+	U16 FrameSize;	// Size of encoded frame being read
+	U32 DataToRead;	// Size to read into buffer
+	U8 *buffer = (U8*)pBuffer;
+	U32 sampleSize = getFormatSize(mChannelFormat);
+	U32 FrameBytes = mFrameSamples*sampleSize;
+	U32 alignMask = getFormatChannelSize(mChannelFormat) - 1;
+
+	// The last frame is padded out, so stop at the real end
+	U32 DataLeft = numBytes;
+	if (trackedPosition + DataLeft > mDecodedSize)
+		DataLeft = mDecodedSize > trackedPosition ? mDecodedSize - trackedPosition : 0;
+	U32 shortBy = numBytes - DataLeft;
+
+	while (DataLeft != 0)
+	{
+		// Finish off the frame the last read stopped part way through
+		if (mDecodedLeft != 0)
+		{
+			DataToRead = (DataLeft > mDecodedLeft) ? mDecodedLeft : DataLeft;
+			dMemcpy(buffer, m_pOutputBuffer + (mDecodedBytes - mDecodedLeft), DataToRead);
+			buffer += DataToRead;
+			trackedPosition += DataToRead;
+			mDecodedLeft -= DataToRead;
+			DataLeft -= DataToRead;
+			continue;
+		}
+
+		if (!fillReadAhead(sizeof(U16)))
+			break; // Out of data
+		dMemcpy(&FrameSize, mReadAhead + mReadAheadPos, sizeof(U16)); // Read encoded size
+		if (FrameSize == 0)
+			break; // Terminator
+
+		if (FrameSize > OPUS_MAXPACKET || !fillReadAhead(sizeof(U16) + FrameSize))
+			return false; // Bail out
+		const U8 *data = mReadAhead + mReadAheadPos + sizeof(U16);
+		mReadAheadPos += sizeof(U16) + FrameSize;
+
+		// Whole frames go straight into the caller's buffer (if it is suitably aligned, and nothing is to be skipped).
+		// Otherwise decode into m_pOutputBuffer, and keep what's left over for the next read.
+		bool direct = (mSkipSamples == 0) && (DataLeft >= FrameBytes) && (((dsize_t)buffer & alignMask) == 0);
+		S32 samples = decodeFrame(data, FrameSize, direct ? buffer : m_pOutputBuffer);
+		if (samples < 0) {
+			Con::warnf("opus_decode failed : %s", opus_strerror(samples));
+			return false;
+		}
+
+		if (direct)
+		{
+			DataToRead = samples*sampleSize;
+			buffer += DataToRead;
+			trackedPosition += DataToRead;
+			DataLeft -= DataToRead;
+		}
+		else
+		{
+			// Throw away anything before the pre skip or seek point
+			U32 skip = getMin(mSkipSamples, (U32)samples);
+			mSkipSamples -= skip;
+			mDecodedBytes = samples*sampleSize;
+			mDecodedLeft = mDecodedBytes - skip*sampleSize;
+		}
+	}
+
+	if (DataLeft != 0 || shortBy != 0)
+	{
+		setStatus(EOS);
+		return false;
+	}
+
+	// Tell torque we're ok...
+	setStatus(Ok);
+	return true;
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::fillReadAhead(U32 needed)
+{
+	U32 left = mReadAheadSize - mReadAheadPos;
+	if (left >= needed)
+		return true;
+
+	// Move what's left to the front, then top up from the stream
+	if (left != 0 && mReadAheadPos != 0)
+		dMemmove(mReadAhead, mReadAhead + mReadAheadPos, left);
+	mReadAheadPos = 0;
+	mReadAheadSize = left;
+
+	U32 streamPos = m_pStream->getPosition();
+	U32 streamSize = m_pStream->getStreamSize();
+	U32 amount = OPUS_READAHEAD - left;
+	if (streamPos + amount > streamSize)
+		amount = streamPos < streamSize ? streamSize - streamPos : 0;
+
+	if (amount != 0 && !m_pStream->read(amount, mReadAhead + left))
+		return false;
+	mReadAheadSize += amount;
+
+	return mReadAheadSize >= needed;
+}
+
+//--------------------------------------------------------------------------
+void OpusFilter::flushReadAhead()
+{
+	mReadAheadSize = mReadAheadPos = 0;
+	mDecodedLeft = mDecodedBytes = 0;
+}
+
+bool OpusFilter::seekFailed()
+{
+	// The slave stream and decoder are somewhere between the old position and the new one, so neither can be trusted
+	flushReadAhead();
+	opus_decoder_ctl(mDecoder, OPUS_RESET_STATE);
+	mSkipSamples = 0;
+	trackedPosition = mDecodedSize;
+	setStatus(IOError);
+	return false;
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::_write(const U32 numBytes, const void *pBuffer)
+{
+   U32 bytesToCopy = 0;	// Bytes we can add to the current frame
+   U32 bytesLeft = 0;	// Bytes remaining
+   U8 *buffer;		// Pointer to where we read from
+
+   AssertFatal(pBuffer != NULL, "NULL input buffer");
+   if (getStatus() == Closed)
+   {
+      AssertFatal(false, "Attempted write to a closed stream");
+      return false;
+   }
+
+   // The header sets up the encoder
+   if (mEncoder == NULL && !writeHeader())
+      return false;
+
+   buffer = (U8*)pBuffer;
+   bytesLeft = numBytes;
+   U32 FrameBytes = mFrameSamples*getFormatSize(mChannelFormat);
+
+   // Gather the data into whole frames, encoding each as it fills up.
+   // Anything left over waits for the next write (or detachStream())
+   while (bytesLeft != 0) {
+      bytesToCopy = FrameBytes - mPendingBytes;
+      if (bytesToCopy > bytesLeft)
+      	bytesToCopy = bytesLeft;
+
+      dMemcpy(m_pInputBuffer + mPendingBytes, buffer, bytesToCopy);
+      mPendingBytes += bytesToCopy;
+
+      // Increment pointers
+      bytesLeft -= bytesToCopy;
+      buffer += bytesToCopy;
+      trackedPosition += bytesToCopy;
+
+      if (mPendingBytes == FrameBytes && !writeFrame())
+      	return false;
+   }
+
+   // Tell torque we're ok...
+   setStatus(Ok);
+
+   return true;
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::writeFrame()
+{
+   S32 EncodedSize;
+   if (getFormatChannelSize(mChannelFormat) == sizeof(F32))
+      EncodedSize = opus_encode_float(mEncoder, (const float*)m_pInputBuffer, mFrameSamples, m_pOutputBuffer, OPUS_MAXPACKET);
+   else
+      EncodedSize = opus_encode(mEncoder, (const opus_int16*)m_pInputBuffer, mFrameSamples, m_pOutputBuffer, OPUS_MAXPACKET);
+   mPendingBytes = 0;
+
+   if (EncodedSize <= 0) {
+      Con::warnf("opus_encode failed : %s", opus_strerror(EncodedSize));
+      return false;
+   }
+
+   // Note where every SEEKINDEX_INTERVAL'th frame starts
+   if ((mFramesWritten++ % SEEKINDEX_INTERVAL) == 0)
+   {
+      GranuleEntry entry;
+      entry.granule = mSamplesWritten;
+      entry.offset = m_pStream->getPosition();
+      mSeekIndex.push_back(entry);
+   }
+   mSamplesWritten += mFrameSamples;
+
+   // Write the data
+   U16 FrameSize = EncodedSize;
+   if (!m_pStream->write(sizeof(U16), &FrameSize))  // Size in bytes of Frame
+   	return false;
+   return m_pStream->write(FrameSize, m_pOutputBuffer); // Write the opus data
+}
+
+//--------------------------------------------------------------------------
+void OpusFilter::finishWrite()
+{
+   // Pad out with silence until the encoder has output everything it was given (it runs mPreSkip samples behind)
+   U32 FrameBytes = mFrameSamples*getFormatSize(mChannelFormat);
+   U32 samplesNeeded = trackedPosition / getFormatSize(mChannelFormat) + mPreSkip;
+   while (mSamplesWritten < samplesNeeded)
+   {
+   	dMemset(m_pInputBuffer + mPendingBytes, 0, FrameBytes - mPendingBytes);
+   	if (!writeFrame())
+   		break;
+   }
+
+   // Write terminator
+   U16 EncodedSize = 0;
+   m_pStream->write(sizeof(U16), &EncodedSize);
+   writeSeekIndex();
+
+   // Put the real length in the header
+   if (mDecodedSize != trackedPosition && m_pStream->hasCapability(StreamPosition))
+   {
+   	U32 endPos = m_pStream->getPosition();
+   	mDecodedSize = trackedPosition;
+   	m_pStream->setPosition(0);
+   	writeHeader();
+   	m_pStream->setPosition(endPos);
+   }
+   mWriteStarted = false;
+}
+
+//--------------------------------------------------------------------------
+U32 OpusFilter::getPosition() const
+{
+   AssertFatal(m_pStream != NULL, "Error, not attached");
+   return trackedPosition;
+}
+
+//---------------------------------------------------------------------------
+bool OpusFilter::setPosition(const U32 newPosition)
+{
+   AssertFatal(m_pStream != NULL, "Error, not attached");
+   U32 sampleSize = getFormatSize(mChannelFormat);
+   if (mDecoder == NULL || newPosition > mDecodedSize)
+   	return false; // Only reads can seek
+
+   if (!mSeekIndexLoaded)
+   	loadSeekIndex();
+
+   // Start decoding a few frames early so the decoder has settled by the time we reach the sample
+   U32 sample = newPosition / sampleSize;
+   U32 target = sample + mPreSkip;
+   U32 frame = target / mFrameSamples;
+   U32 startGranule = (frame > OPUS_PREROLL_FRAMES ? frame - OPUS_PREROLL_FRAMES : 0) * mFrameSamples;
+
+   // Find the last indexed frame at or before startGranule
+   U32 pos = HEADER_SIZE;
+   U32 granule = 0;
+   U32 lo = 0, hi = mSeekIndex.size();
+   while (lo < hi)
+   {
+	U32 mid = (lo + hi) / 2;
+	if (mSeekIndex[mid].granule <= startGranule)
+		lo = mid + 1;
+	else
+		hi = mid;
+   }
+   if (lo != 0)
+   {
+	pos = mSeekIndex[lo-1].offset;
+	granule = mSeekIndex[lo-1].granule;
+   }
+
+   // Walk the rest of the way
+   U16 encodedFrameSize = 0;
+   flushReadAhead(); // Anything read ahead is from the old position
+   m_pStream->setPosition(pos);
+   while (granule + mFrameSamples <= startGranule)
+   {
+	if (!m_pStream->read(sizeof(U16), &encodedFrameSize) || encodedFrameSize == 0)
+		return seekFailed(); // Past the terminator
+	pos += encodedFrameSize+2; // 2 == sizeof(U16)
+	m_pStream->setPosition(pos);
+	granule += mFrameSamples;
+   }
+
+   opus_decoder_ctl(mDecoder, OPUS_RESET_STATE);
+   mSkipSamples = target - granule;
+   trackedPosition = sample*sampleSize; // Set tracked position to where we are
+   setStatus(Ok); // Clears EOS, or an earlier failed seek
+   return true;
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::loadSeekIndex()
+{
+	mSeekIndex.clear();
+	mSeekIndexLoaded = true;
+
+	// Stream ends with [U32 count][index][U32 index offset][U32 magic] if it has an index
+	U32 streamSize = m_pStream->getStreamSize();
+	if (streamSize >= HEADER_SIZE + sizeof(U16) + sizeof(U32)*3 && m_pStream->setPosition(streamSize - sizeof(U32)*2))
+	{
+		U32 indexOffset = 0;
+		U32 magic = 0;
+		U32 count = 0;
+		m_pStream->read(sizeof(U32), &indexOffset);
+		m_pStream->read(sizeof(U32), &magic);
+		if (magic == SEEKINDEX_MAGIC && indexOffset >= HEADER_SIZE && indexOffset <= streamSize - sizeof(U32)*3 &&
+		    m_pStream->setPosition(indexOffset) && m_pStream->read(sizeof(U32), &count) &&
+		    count * sizeof(GranuleEntry) == streamSize - sizeof(U32)*3 - indexOffset)
+		{
+			mSeekIndex.setSize(count);
+			if (count == 0 || m_pStream->read(count * sizeof(GranuleEntry), mSeekIndex.address()))
+				return true;
+			mSeekIndex.clear();
+		}
+	}
+
+	// No index, so build one by walking the frame headers (only done once)
+	U32 pos = HEADER_SIZE;
+	U32 frame = 0;
+	U16 encodedFrameSize = 0;
+	m_pStream->setPosition(pos);
+	while (m_pStream->read(sizeof(U16), &encodedFrameSize) && encodedFrameSize != 0)
+	{
+		if ((frame % SEEKINDEX_INTERVAL) == 0)
+		{
+			GranuleEntry entry;
+			entry.granule = frame * mFrameSamples;
+			entry.offset = pos;
+			mSeekIndex.push_back(entry);
+		}
+		frame++;
+		pos += encodedFrameSize+2;
+		if (!m_pStream->setPosition(pos))
+			break;
+	}
+	return false;
+}
+
+//--------------------------------------------------------------------------
+void OpusFilter::writeSeekIndex()
+{
+	U32 indexOffset = m_pStream->getPosition();
+	U32 count = mSeekIndex.size();
+	U32 magic = SEEKINDEX_MAGIC;
+	m_pStream->write(sizeof(U32), &count);
+	if (count != 0)
+		m_pStream->write(count * sizeof(GranuleEntry), mSeekIndex.address());
+	m_pStream->write(sizeof(U32), &indexOffset);
+	m_pStream->write(sizeof(U32), &magic);
+	mSeekIndexLoaded = true;
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::seekTime(F32 time)
+{
+	// setPosition() is already sample accurate, so this only has to pick the sample
+	return Parent::seekTime(time);
+}
+
+//--------------------------------------------------------------------------
+U32 OpusFilter::getNumSamples()
+{
+	return mDecodedSize/getFormatSize(mChannelFormat);
+}
+
+//--------------------------------------------------------------------------
+void OpusFilter::setSamplingRate(U32 val)
+{
+	// Can't change once the coders have been created
+	if (mEncoder != NULL || mDecoder != NULL)
+		return;
+
+	static const U32 rates[] = {8000, 12000, 16000, 24000, 48000};
+	mSamplingRate = 48000;
+	for (U32 i=0; i<sizeof(rates)/sizeof(rates[0]); i++)
+	{
+		if (val <= rates[i]) {
+			mSamplingRate = rates[i];
+			break;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------
+U8 OpusFilter::getChannelFormat()
+{
+	return mChannelFormat;
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::setChannelFormat(U8 format)
+{
+	if (mEncoder != NULL || mDecoder != NULL)
+		return format == mChannelFormat;
+
+	switch (format)
+	{
+		case CHANNEL_MONO_16:
+		case CHANNEL_STEREO_16:
+		case CHANNEL_MONO_FLOAT:
+		case CHANNEL_STEREO_FLOAT:
+			mChannelFormat = format;
+			return true;
+		break;
+		default:
+			return false;
+		break;
+	}
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::readHeader()
+{
+	U32 magic = 0;
+	U8 quality = 0;
+	m_pStream->read(sizeof(U32), &magic);
+	if (magic != HEADER_MAGIC)
+		return false;
+
+	m_pStream->read(sizeof(U32), &mDecodedSize);
+	m_pStream->read(sizeof(U32), &mSamplingRate);
+	m_pStream->read(sizeof(U8), &mChannelFormat);
+	m_pStream->read(sizeof(U8), &quality);
+	m_pStream->read(sizeof(F32), &mVBRQuality);
+	m_pStream->read(sizeof(U16), &mPreSkip);
+	m_pStream->read(sizeof(U16), &mFrameSamples);
+	mQuality = quality;
+
+	// Sanity check, opus frames are no more than 120ms
+	U8 channels = getFormatChannels(mChannelFormat);
+	if (channels == 0 || mFrameSamples == 0 || mFrameSamples > (mSamplingRate * 120) / 1000)
+		return false;
+
+	if (mDecoder != NULL)
+		opus_decoder_destroy(mDecoder);
+	int error;
+	mDecoder = opus_decoder_create(mSamplingRate, channels, &error);
+	if (error != OPUS_OK) {
+		Con::errorf("OpusFilter: could not create decoder : %s", opus_strerror(error));
+		mDecoder = NULL;
+		return false;
+	}
+
+	mSkipSamples = mPreSkip;
+	return createBuffers();
+}
+
+//--------------------------------------------------------------------------
+bool OpusFilter::writeHeader()
+{
+	// Set up the encoder the first time through
+	if (mEncoder == NULL)
+	{
+		if (mSamplingRate == 0)
+			setSamplingRate(48000);
+		U8 channels = getFormatChannels(mChannelFormat);
+
+		int error;
+		mEncoder = opus_encoder_create(mSamplingRate, channels, OPUS_APPLICATION_AUDIO, &error);
+		if (error != OPUS_OK) {
+			Con::errorf("OpusFilter: could not create encoder : %s", opus_strerror(error));
+			mEncoder = NULL;
+			return false;
+		}
+
+		// Quality 0-10 picks the bitrate, 6 to 126kbps per channel. A VBR quality < 0 turns off VBR.
+		U32 quality = getMin(mQuality, (U32)10);
+		opus_encoder_ctl(mEncoder, OPUS_SET_BITRATE((6000 + quality * 12000) * channels));
+		opus_encoder_ctl(mEncoder, OPUS_SET_VBR(mVBRQuality < .0 ? 0 : 1));
+		opus_encoder_ctl(mEncoder, OPUS_SET_COMPLEXITY(10));
+
+		opus_int32 lookahead = 0;
+		opus_encoder_ctl(mEncoder, OPUS_GET_LOOKAHEAD(&lookahead));
+		mPreSkip = lookahead;
+		mFrameSamples = mSamplingRate / 50; // 20ms
+		if (!createBuffers())
+			return false;
+		mWriteStarted = true;
+	}
+
+	U32 magic = HEADER_MAGIC;
+	U8 quality = mQuality;
+	m_pStream->write(sizeof(U32), &magic);
+	m_pStream->write(sizeof(U32), &mDecodedSize);
+	m_pStream->write(sizeof(U32), &mSamplingRate);
+	m_pStream->write(sizeof(U8), &mChannelFormat);
+	m_pStream->write(sizeof(U8), &quality);
+	m_pStream->write(sizeof(F32), &mVBRQuality);
+	m_pStream->write(sizeof(U16), &mPreSkip);
+	return m_pStream->write(sizeof(U16), &mFrameSamples);
+}
+
+//--------------------------------------------------------------------------
+F32 OpusFilter::getTime()
+{
+	U32 sampleSize = getFormatSize(mChannelFormat);
+	return mSamplingRate ? F32(trackedPosition/sampleSize) / F32(mSamplingRate) : .0;
+}
+
+//--------------------------------------------------------------------------
+F32 OpusFilter::getTimeLength()
+{
+	U32 sampleSize = getFormatSize(mChannelFormat);
+	return mSamplingRate ? F32(mDecodedSize/sampleSize) / F32(mSamplingRate) : .0;
+}
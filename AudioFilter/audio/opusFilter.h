@@ -0,0 +1,134 @@
+#ifndef _OPUSFILTER_H_
+#define _OPUSFILTER_H_
+
+#ifndef _FILTERSTREAM_H_
+#include "core/filterStream.h"
+#endif
+#ifndef _AUDIOFILTER_H_
+#include "audio/audioFilter.h"
+#endif
+#ifndef _TVECTOR_H_
+#include "core/tVector.h"
+#endif
+
+#include "opus.h" // Opus header
+
+#define OPUS_READAHEAD 32768  // Encoded data read from the slave stream at a time
+#define OPUS_MAXPACKET 1276   // Room for the largest encoded frame (1275 bytes)
+#define OPUS_PREROLL_FRAMES 4 // Frames decoded (and thrown away) ahead of a seek, so the decoder has settled (80ms)
+
+//----------------------------------------------------------------------
+/// This class implements Opus Support.
+///
+/// When attached to a Stream (using attachStream), this class can be used to read and write raw PCM data from and to opus encoded streams.
+/// Opus handles both speech and music well, at lower bitrates than speex, and is cheap to decode.
+///
+/// @note The file format this filter outputs is NOT the same as the official (ogg) opus file format,
+/// use the ConsoleFunction filterConvert to convert audio to the format this filter uses.
+///
+/// Streams are laid out as a header, then each 20ms frame as [U16 size][data], then a 0 size terminator, then a
+/// granule index : the first sample and stream offset of every SEEKINDEX_INTERVAL'th frame. Seeking uses the index to
+/// jump close to the target, decodes OPUS_PREROLL_FRAMES frames to let the decoder settle, then throws away samples
+/// up to the exact one asked for. Streams without an index have one built the first time they are seeked.
+///
+/// Opus only runs at 8, 12, 16, 24 or 48KHz, so setSamplingRate() picks the nearest of these at or above the rate
+/// asked for. Mono and stereo, 16bit or float, can be encoded. The terminator and granule index are written when the
+/// stream is detached (and the header rewritten with the real length, if the stream can seek), so detach the filter
+/// before closing the slave stream.
+///
+/// @see AudioFilter for example usage.
+///
+class OpusFilter : public AudioFilter
+{
+   typedef AudioFilter Parent;
+
+   Stream*      m_pStream; ///< Slave Stream
+
+  public:
+   OpusFilter();
+   virtual ~OpusFilter();
+
+   /// @name Overrides of NFilterStream
+   /// @{
+  public:
+   bool    attachStream(Stream* io_pSlaveStream);
+   void    detachStream();
+   Stream* getStream();
+   /// @}
+
+   /// @name Mandatory overrides
+   /// @{
+  protected:
+   bool _read(const U32 in_numBytes,  void* out_pBuffer);
+   bool _write(const U32 in_numBytes, const void* in_pBuffer);
+  public:
+   U32  getPosition() const;
+   bool setPosition(const U32 in_newPosition);
+   /// @}
+
+   /// @name AudioFilter Management
+   /// @{
+  bool readHeader();		///< Read the header (returns false if this isn't an opus stream)
+  bool writeHeader();		///< Write the header, creating the encoder
+  U8 getChannelFormat();	///< Get Formats for each channel used
+  bool setChannelFormat(U8 format);	///< Set format to encode (mono or stereo, 16bit or float)
+  U32 getNumSamples();		///< Get Number of Samples
+  void setSamplingRate(U32 val);///< Set Sampling rate (rounded up to one opus supports)
+  bool seekTime(F32 time);	///< Seek to time in stream
+  F32 getTime();		///< Get current time in stream
+  F32 getTimeLength();		///< Get current time length
+  /// @}
+
+  /// @name Opus Stuff
+  /// @{
+   OpusEncoder *mEncoder;	///< Encoder (created by writeHeader)
+   OpusDecoder *mDecoder;	///< Decoder (created by readHeader)
+   U8  mChannelFormat;		///< Format of the PCM data
+   U16 mFrameSamples;		///< Samples (per channel) in each frame
+   U16 mPreSkip;		///< Samples of encoder delay at the start of the stream, which are never output
+   U32 mSkipSamples;		///< Decoded samples still to be thrown away (pre skip, or following a seek)
+   U32 mSamplesWritten;		///< Samples encoded so far, including padding
+   U32 trackedPosition;		///< Position we tracked in stream
+   U32 mPendingBytes;		///< Bytes of a partial frame held in m_pInputBuffer, waiting for the next write
+   bool mWriteStarted;		///< Has the header been written? (if so, the stream is finished on detach)
+   bool createBuffers();	///< Allocates m_pInputBuffer and m_pOutputBuffer for the current format
+   bool writeFrame();		///< Encodes and writes out the frame in m_pInputBuffer
+   void finishWrite();		///< Flushes out the encoder, then writes the terminator and granule index
+   S32  decodeFrame(const U8 *data, U32 size, void *out);	///< Decodes one frame, returning the samples decoded
+  /// @}
+
+  /// @name Read ahead
+  /// Encoded frames are read from the slave stream OPUS_READAHEAD bytes at a time, and parsed in memory.
+  /// @{
+   U8 *mReadAhead;		///< Encoded data read ahead of the decoder
+   U32 mReadAheadSize;		///< Amount of mReadAhead filled
+   U32 mReadAheadPos;		///< Position of the next frame in mReadAhead
+   U32 mDecodedLeft;		///< Bytes at the end of m_pOutputBuffer not yet returned by read()
+   U32 mDecodedBytes;		///< Size of the frame in m_pOutputBuffer
+   bool fillReadAhead(U32 needed);	///< Makes sure at least needed bytes are waiting in mReadAhead
+   void flushReadAhead();	///< Forgets everything read ahead, following a seek
+   bool seekFailed();		///< Leaves the filter at the end with IOError set, once setPosition() has failed part way. Returns false
+  /// @}
+
+  /// @name Granule index
+  /// @{
+  enum {
+	HEADER_MAGIC = 0x5355504f,	///< "OPUS", first U32 of the stream
+	HEADER_SIZE = 22,		///< Size of the header written by writeHeader()
+	SEEKINDEX_INTERVAL = 16,	///< Frames between each entry in the granule index
+	SEEKINDEX_MAGIC = 0x4958504f	///< "OPXI", last U32 of a stream with a granule index
+  };
+  struct GranuleEntry
+  {
+	U32 granule;		///< First sample (per channel, including pre skip) in the frame
+	U32 offset;		///< Stream offset of the frame
+  };
+  Vector<GranuleEntry> mSeekIndex;	///< Entry for every SEEKINDEX_INTERVAL'th frame
+  bool mSeekIndexLoaded;	///< Has mSeekIndex been read or built yet?
+  U32 mFramesWritten;		///< Frames encoded so far (for building mSeekIndex on write)
+  bool loadSeekIndex();		///< Reads the index from the end of the stream, or builds it from the frame headers
+  void writeSeekIndex();	///< Writes out mSeekIndex, following the terminator
+  /// @}
+};
+
+#endif //_OPUSFILTER_H_
@@ -0,0 +1,490 @@
+#include "audio/pcmCacheFilter.h"
+#include "audio/audioFilterManager.h"
+#include "console/console.h"
+#include "platform/platformMutex.h"
+
+// Static variables
+AudioPCMCacheEntry *AudioPCMCache::smBuckets[PCMCACHE_BUCKETS];
+AudioPCMCacheEntry *AudioPCMCache::smLRUHead = NULL;
+AudioPCMCacheEntry *AudioPCMCache::smLRUTail = NULL;
+void *AudioPCMCache::smMutex = NULL;
+S32 AudioPCMCache::smBudget = 8 * 1024 * 1024;
+S32 AudioPCMCache::smMaxClipSize = 256 * 1024;
+U32 AudioPCMCache::smHits = 0;
+U32 AudioPCMCache::smMisses = 0;
+U32 AudioPCMCache::smUncached = 0;
+U32 AudioPCMCache::smEvictions = 0;
+U32 AudioPCMCache::smBytesUsed = 0;
+U32 AudioPCMCache::smNumEntries = 0;
+
+//--------------------------------------------------------------------------
+void AudioPCMCacheKey::set(const char *filename, U32 size)
+{
+   name = filename;
+   nameHash = _StringTable::hashString(filename);
+   fileSize = size;
+   if (!Platform::getFileTimes(filename, NULL, &modifyTime))
+      dMemset(&modifyTime, 0, sizeof(modifyTime));
+}
+
+bool AudioPCMCacheKey::isSameFile(const AudioPCMCacheKey &other) const
+{
+   return nameHash == other.nameHash && !dStricmp(name, other.name);
+}
+
+bool AudioPCMCacheKey::isSameVersion(const AudioPCMCacheKey &other) const
+{
+   return isSameFile(other) && fileSize == other.fileSize && Platform::compareFileTimes(modifyTime, other.modifyTime) == 0;
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::init()
+{
+   for (U32 i=0; i<PCMCACHE_BUCKETS; i++)
+      smBuckets[i] = NULL;
+   smMutex = Mutex::createMutex();
+   Con::addVariable("$Audio::pcmCacheBudget", TypeS32, &smBudget);
+   Con::addVariable("$Audio::pcmCacheMaxClip", TypeS32, &smMaxClipSize);
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::destroy()
+{
+   if (!smMutex)
+      return;
+
+   flush();
+   AssertFatal(smNumEntries == 0, "AudioPCMCache::destroy: clips still in use!");
+   Mutex::destroyMutex(smMutex);
+   smMutex = NULL;
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::unlink(AudioPCMCacheEntry *entry)
+{
+   if (entry->lruPrev) entry->lruPrev->lruNext = entry->lruNext;
+   else smLRUHead = entry->lruNext;
+   if (entry->lruNext) entry->lruNext->lruPrev = entry->lruPrev;
+   else smLRUTail = entry->lruPrev;
+   entry->lruPrev = entry->lruNext = NULL;
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::evict(AudioPCMCacheEntry *entry)
+{
+   AudioPCMCacheEntry **walker = &getBucket(entry->key);
+   while (*walker != entry)
+      walker = &(*walker)->hashNext;
+   *walker = entry->hashNext;
+   unlink(entry);
+
+   smBytesUsed -= entry->size;
+   smNumEntries--;
+   smEvictions++;
+
+   // Filters still reading the clip keep it alive
+   entry->evicted = true;
+   if (entry->refCount == 0)
+   {
+      delete [] entry->data;
+      delete [] (char*)entry->key.name;
+      delete entry;
+   }
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::trim(U32 budget)
+{
+   AudioPCMCacheEntry *entry = smLRUTail;
+   while (entry && smBytesUsed > budget)
+   {
+      AudioPCMCacheEntry *prev = entry->lruPrev;
+      evict(entry);
+      entry = prev;
+   }
+}
+
+//--------------------------------------------------------------------------
+AudioPCMCacheEntry *AudioPCMCache::acquire(const AudioPCMCacheKey &key, U8 channelFormat, U32 samplingRate)
+{
+   Mutex::lockMutex(smMutex);
+   AudioPCMCacheEntry *entry = getBucket(key);
+   while (entry)
+   {
+      AudioPCMCacheEntry *next = entry->hashNext;
+      if (entry->key.isSameFile(key))
+      {
+         // The file has changed since this was decoded
+         if (!entry->key.isSameVersion(key))
+            evict(entry);
+         else if ((channelFormat == AudioFilter::CHANNEL_UNKNOWN || entry->channelFormat == channelFormat) &&
+                  (samplingRate == 0 || entry->samplingRate == samplingRate))
+            break;
+      }
+      entry = next;
+   }
+
+   if (entry)
+   {
+      // Move to the front of the LRU list
+      unlink(entry);
+      entry->lruNext = smLRUHead;
+      if (smLRUHead) smLRUHead->lruPrev = entry;
+      smLRUHead = entry;
+      if (!smLRUTail) smLRUTail = entry;
+
+      entry->refCount++;
+      smHits++;
+   }
+   Mutex::unlockMutex(smMutex);
+   return entry;
+}
+
+//--------------------------------------------------------------------------
+AudioPCMCacheEntry *AudioPCMCache::insert(const AudioPCMCacheKey &key, U8 channelFormat, U32 samplingRate, U8 *data, U32 size)
+{
+   char *name = new char[dStrlen(key.name) + 1];
+   dStrcpy(name, key.name);
+
+   AudioPCMCacheEntry *entry = new AudioPCMCacheEntry;
+   entry->key = key;
+   entry->key.name = name;
+   entry->channelFormat = channelFormat;
+   entry->samplingRate = samplingRate;
+   entry->data = data;
+   entry->size = size;
+   entry->refCount = 1;
+   entry->evicted = false;
+
+   Mutex::lockMutex(smMutex);
+
+   // Only one clip of each file is kept (another thread may have decoded it too)
+   for (AudioPCMCacheEntry *other = getBucket(key); other; )
+   {
+      AudioPCMCacheEntry *next = other->hashNext;
+      if (other->key.isSameFile(key))
+         evict(other);
+      other = next;
+   }
+
+   // Make room first, so we never go over budget
+   trim(size < (U32)smBudget ? smBudget - size : 0);
+
+   AudioPCMCacheEntry *&bucket = getBucket(entry->key);
+   entry->hashNext = bucket;
+   bucket = entry;
+   entry->lruPrev = NULL;
+   entry->lruNext = smLRUHead;
+   if (smLRUHead) smLRUHead->lruPrev = entry;
+   smLRUHead = entry;
+   if (!smLRUTail) smLRUTail = entry;
+
+   smBytesUsed += size;
+   smNumEntries++;
+   smMisses++;
+   Mutex::unlockMutex(smMutex);
+   return entry;
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::release(AudioPCMCacheEntry *entry)
+{
+   Mutex::lockMutex(smMutex);
+   AssertFatal(entry->refCount > 0, "AudioPCMCache::release: entry not in use!");
+   entry->refCount--;
+   bool freeEntry = entry->evicted && entry->refCount == 0;
+   Mutex::unlockMutex(smMutex);
+
+   if (freeEntry)
+   {
+      delete [] entry->data;
+      delete [] (char*)entry->key.name;
+      delete entry;
+   }
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::skip()
+{
+   Mutex::lockMutex(smMutex);
+   smUncached++;
+   Mutex::unlockMutex(smMutex);
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::invalidate(const char *filename)
+{
+   if (!smMutex)
+      return;
+
+   AudioPCMCacheKey key;
+   key.name = filename;
+   key.nameHash = _StringTable::hashString(filename);
+
+   Mutex::lockMutex(smMutex);
+   for (AudioPCMCacheEntry *entry = getBucket(key); entry; )
+   {
+      AudioPCMCacheEntry *next = entry->hashNext;
+      if (entry->key.isSameFile(key))
+         evict(entry);
+      entry = next;
+   }
+   Mutex::unlockMutex(smMutex);
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::flush()
+{
+   Mutex::lockMutex(smMutex);
+   trim(0);
+   Mutex::unlockMutex(smMutex);
+}
+
+//--------------------------------------------------------------------------
+void AudioPCMCache::printStats()
+{
+   U32 lookups = smHits + smMisses;
+   Con::printf("PCM cache : %d clips, %d / %d bytes", smNumEntries, smBytesUsed, smBudget);
+   Con::printf("  %d hits, %d misses (%.1f%% hit rate), %d evictions", smHits, smMisses,
+               lookups ? (F32(smHits) * 100.0f) / F32(lookups) : 0.0f, smEvictions);
+   Con::printf("  %d clips too large to cache", smUncached);
+}
+
+/// Prints the PCM cache's hit rate and memory use
+ConsoleFunction(audioPCMCacheStats, void, 1, 1, "audioPCMCacheStats()")
+{
+   AudioPCMCache::printStats();
+}
+
+/// Drops every decoded clip which isn't being played
+ConsoleFunction(audioPCMCacheFlush, void, 1, 1, "audioPCMCacheFlush()")
+{
+   AudioPCMCache::flush();
+}
+
+//--------------------------------------------------------------------------
+PCMCacheFilter::PCMCacheFilter(FilterInfo *info, const char *filename)
+ : m_pStream(NULL)
+{
+   mInfo = info;
+   mName = new char[dStrlen(filename) + 1];
+   dStrcpy(mName, filename);
+   mFilter = NULL;
+   mEntry = NULL;
+   mPosition = 0;
+}
+
+//--------------------------------------------------------------------------
+PCMCacheFilter::~PCMCacheFilter()
+{
+   detachStream();
+   delete [] mName;
+}
+
+//--------------------------------------------------------------------------
+bool PCMCacheFilter::attachStream(Stream* io_pSlaveStream)
+{
+   AssertFatal(io_pSlaveStream != NULL, "NULL Slave stream?");
+   AssertFatal(m_pStream == NULL,       "Already attached!");
+
+   m_pStream = io_pSlaveStream;
+   mPosition = 0;
+
+   AudioPCMCacheKey key;
+   key.set(mName, m_pStream->getStreamSize());
+   mEntry = AudioPCMCache::acquire(key);
+   if (!mEntry)
+   {
+      // Not cached, so open up the real filter
+      mFilter = AudioFilterManager::createFilter(mInfo, AudioFilterManager::AudioRead);
+      if (!mFilter || !mFilter->attachStream(m_pStream))
+      {
+         if (mFilter) AudioFilterManager::closeFilter(mFilter);
+         mFilter = NULL;
+         m_pStream = NULL;
+         setStatus(IOError);
+         return false;
+      }
+
+      // Small enough to keep? Then decode the lot now
+      U32 size = mFilter->getStreamSize();
+      if (AudioPCMCache::canCache(size))
+      {
+         U8 *data = new U8[size ? size : 1];
+         if (mFilter->read(size, data))
+         {
+            mEntry = AudioPCMCache::insert(key, mFilter->getChannelFormat(), mFilter->getSamplingRate(), data, size);
+            AudioFilterManager::closeFilter(mFilter);
+            mFilter = NULL;
+         }
+         else
+         {
+            // Couldn't decode it in one go; start again and let the reader see what happens
+            delete [] data;
+            mFilter->setPosition(0);
+         }
+      }
+      else
+         AudioPCMCache::skip();
+   }
+
+   if (mEntry)
+   {
+      mSamplingRate = mEntry->samplingRate;
+      mDecodedSize = mEntry->size;
+   }
+   else
+   {
+      mSamplingRate = mFilter->getSamplingRate();
+      mDecodedSize = mFilter->getStreamSize();
+   }
+
+   mAudioCapability = AudioFilter::AudioSeek | AudioFilter::AudioTime;
+   setStatus(Ok);
+   return true;
+}
+
+//--------------------------------------------------------------------------
+void PCMCacheFilter::detachStream()
+{
+   if (mEntry)
+      AudioPCMCache::release(mEntry);
+   if (mFilter)
+      AudioFilterManager::closeFilter(mFilter);
+   mEntry = NULL;
+   mFilter = NULL;
+
+   mAudioCapability = 0;
+   m_pStream = NULL;
+   setStatus(Closed);
+}
+
+//--------------------------------------------------------------------------
+Stream* PCMCacheFilter::getStream()
+{
+   return m_pStream;
+}
+
+//--------------------------------------------------------------------------
+bool PCMCacheFilter::_read(const U32 numBytes, void *pBuffer)
+{
+   if (numBytes == 0)
+      return true;
+
+   AssertFatal(pBuffer != NULL, "NULL input buffer");
+   if (getStatus() == Closed)
+   {
+      AssertFatal(false, "Attempted read from a closed stream");
+      return false;
+   }
+
+   if (mFilter)
+      return mFilter->read(numBytes, pBuffer);
+
+   // Straight out of the cache
+   if (mPosition + numBytes > mEntry->size)
+   {
+      U32 left = mEntry->size - mPosition;
+      dMemcpy(pBuffer, mEntry->data + mPosition, left);
+      mPosition = mEntry->size;
+      setStatus(EOS);
+      return false;
+   }
+
+   dMemcpy(pBuffer, mEntry->data + mPosition, numBytes);
+   mPosition += numBytes;
+   setStatus(Ok);
+   return true;
+}
+
+//--------------------------------------------------------------------------
+bool PCMCacheFilter::_write(const U32 numBytes, const void *pBuffer)
+{
+   AssertFatal(false, "Write on PCMCacheFilter not permitted!");
+   return false;
+}
+
+//--------------------------------------------------------------------------
+U32 PCMCacheFilter::getPosition() const
+{
+   AssertFatal(m_pStream != NULL, "Error, not attached");
+   return mFilter ? mFilter->getPosition() : mPosition;
+}
+
+//--------------------------------------------------------------------------
+bool PCMCacheFilter::setPosition(const U32 newPosition)
+{
+   AssertFatal(m_pStream != NULL, "Error, not attached");
+   if (mFilter)
+      return mFilter->setPosition(newPosition);
+
+   if (newPosition > mEntry->size)
+      return false;
+   mPosition = newPosition;
+   return true;
+}
+
+//--------------------------------------------------------------------------
+U32 PCMCacheFilter::getStreamSize()
+{
+   return mDecodedSize;
+}
+
+//--------------------------------------------------------------------------
+U8 PCMCacheFilter::getChannelFormat()
+{
+   if (mFilter)
+      return mFilter->getChannelFormat();
+   return mEntry ? mEntry->channelFormat : CHANNEL_UNKNOWN;
+}
+
+//--------------------------------------------------------------------------
+U32 PCMCacheFilter::getNumSamples()
+{
+   if (mFilter)
+      return mFilter->getNumSamples();
+   U32 sampleSize = getFormatSize(getChannelFormat());
+   return sampleSize ? mDecodedSize / sampleSize : 0;
+}
+
+//--------------------------------------------------------------------------
+bool PCMCacheFilter::seekTime(F32 time)
+{
+   if (mFilter)
+      return mFilter->seekTime(time);
+
+   return Parent::seekTime(time);
+}
+
+//--------------------------------------------------------------------------
+bool PCMCacheFilter::seekSample(U32 sample)
+{
+   if (mFilter)
+      return mFilter->seekSample(sample);
+   return Parent::seekSample(sample);
+}
+
+//--------------------------------------------------------------------------
+U32 PCMCacheFilter::getSample()
+{
+   if (mFilter)
+      return mFilter->getSample();
+   return Parent::getSample();
+}
+
+//--------------------------------------------------------------------------
+F32 PCMCacheFilter::getTime()
+{
+   if (mFilter)
+      return mFilter->getTime();
+   U32 sampleSize = getFormatSize(getChannelFormat());
+   return (sampleSize && mSamplingRate) ? F32(mPosition / sampleSize) / F32(mSamplingRate) : .0;
+}
+
+//--------------------------------------------------------------------------
+F32 PCMCacheFilter::getTimeLength()
+{
+   if (mFilter)
+      return mFilter->getTimeLength();
+   return mSamplingRate ? F32(getNumSamples()) / F32(mSamplingRate) : .0;
+}
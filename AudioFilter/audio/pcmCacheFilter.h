@@ -0,0 +1,158 @@
+#ifndef _PCMCACHEFILTER_H_
+#define _PCMCACHEFILTER_H_
+
+#ifndef _AUDIOFILTER_H_
+#include "audio/audioFilter.h"
+#endif
+
+struct FilterInfo;
+
+#define PCMCACHE_BUCKETS 64
+
+//----------------------------------------------------------------------
+/// Identifies one version of a file in AudioPCMCache.
+///
+/// Filters are created on conversion and streaming threads as well as the main thread, so the name is hashed
+/// with _StringTable::hashString() rather than being put in the StringTable, which isn't thread safe.
+struct AudioPCMCacheKey
+{
+   const char *name;          ///< File the clip is decoded from
+   U32 nameHash;              ///< Hash of name (case insensitive)
+   U32 fileSize;              ///< Stored size of the file
+   FileTime modifyTime;       ///< When the file was last modified (zeroed if it isn't a plain file on disk)
+
+   void set(const char *filename, U32 size);            ///< Fills in the key for filename as it is now
+   bool isSameFile(const AudioPCMCacheKey &other) const;  ///< Same name?
+   bool isSameVersion(const AudioPCMCacheKey &other) const; ///< Same name, size and modification time?
+};
+
+//----------------------------------------------------------------------
+/// A decoded clip held in AudioPCMCache
+struct AudioPCMCacheEntry
+{
+   AudioPCMCacheKey key;      ///< File the clip was decoded from (name is our own copy)
+   U8 channelFormat;          ///< Format of data
+   U32 samplingRate;          ///< Sampling rate of data
+   U8 *data;                  ///< Decoded PCM
+   U32 size;                  ///< Size of data
+   U32 refCount;              ///< Filters reading from this entry
+   bool evicted;              ///< Removed from the cache, and freed once refCount drops to 0
+
+   AudioPCMCacheEntry *hashNext;  ///< Next entry in bucket
+   AudioPCMCacheEntry *lruPrev;   ///< More recently used entry
+   AudioPCMCacheEntry *lruNext;   ///< Less recently used entry
+};
+
+//----------------------------------------------------------------------
+/// Keeps short clips decoded, so sounds which are played over and over (gunshots, footsteps) are only decoded once.
+///
+/// Clips are keyed by file, format and sampling rate. The file's size and modification time are kept with each clip,
+/// so a clip decoded from an older version of the file is dropped rather than handed out, and only one version of a file
+/// is ever kept. Conversions drop any clip of the file they write to as they finish.
+///
+/// Only clips which decode to $Audio::pcmCacheMaxClip bytes or less are kept, and once the cache holds more than
+/// $Audio::pcmCacheBudget bytes, the least recently used clips are dropped. Setting the budget to 0 turns the cache off.
+class AudioPCMCache
+{
+   static AudioPCMCacheEntry *smBuckets[PCMCACHE_BUCKETS];
+   static AudioPCMCacheEntry *smLRUHead;  ///< Most recently used
+   static AudioPCMCacheEntry *smLRUTail;  ///< Least recently used
+   static void *smMutex;
+
+   static AudioPCMCacheEntry *&getBucket(const AudioPCMCacheKey &key) {return smBuckets[key.nameHash % PCMCACHE_BUCKETS];}
+   static void unlink(AudioPCMCacheEntry *entry); ///< Removes entry from the LRU list
+   static void evict(AudioPCMCacheEntry *entry);  ///< Removes entry from the cache
+   static void trim(U32 budget);                  ///< Evicts clips until we're within budget
+
+  public:
+   /// @name Settings
+   /// @{
+   static S32 smBudget;          ///< Most decoded data to hold ($Audio::pcmCacheBudget)
+   static S32 smMaxClipSize;     ///< Largest clip to hold ($Audio::pcmCacheMaxClip)
+   /// @}
+
+   /// @name Stats
+   /// @{
+   static U32 smHits;
+   static U32 smMisses;          ///< Clips decoded into the cache
+   static U32 smUncached;        ///< Clips too large to cache, read straight from their filter
+   static U32 smEvictions;
+   static U32 smBytesUsed;
+   static U32 smNumEntries;
+   /// @}
+
+   static void init();
+   static void destroy();
+
+   static bool isEnabled() {return smBudget > 0;}
+   static bool canCache(U32 size) {return smBudget > 0 && size <= (U32)smMaxClipSize && size <= (U32)smBudget;}
+
+   /// Finds a clip of this version of the file (a format of CHANNEL_UNKNOWN, or a rate of 0, matches any), adding a reference.
+   /// Clips of other versions of the file are dropped.
+   static AudioPCMCacheEntry *acquire(const AudioPCMCacheKey &key, U8 channelFormat = AudioFilter::CHANNEL_UNKNOWN, U32 samplingRate = 0);
+   /// Adds a clip to the cache in place of any other of the same file, taking ownership of data. Returns the entry with a reference added.
+   static AudioPCMCacheEntry *insert(const AudioPCMCacheKey &key, U8 channelFormat, U32 samplingRate, U8 *data, U32 size);
+   static void release(AudioPCMCacheEntry *entry);
+   static void skip();           ///< Counts a clip which was too large to cache
+
+   static void invalidate(const char *filename); ///< Drops every clip of filename (e.g. once it has been written to)
+   static void flush();          ///< Drops every clip not in use
+   static void printStats();
+};
+
+//----------------------------------------------------------------------
+/// Reads audio through AudioPCMCache.
+///
+/// AudioFilterManager::getFilterFromFile hands these out for reading while the cache is enabled (except for RAW
+/// files, whose format and rate are only set after attaching). On attach, if
+/// the clip is already cached it is read straight from memory. Otherwise the real filter is created; if the clip
+/// is small enough it is decoded in one go and cached, else every call is simply passed through to the real filter.
+class PCMCacheFilter : public AudioFilter
+{
+   typedef AudioFilter Parent;
+
+   Stream*      m_pStream;      ///< Slave Stream
+   FilterInfo*  mInfo;          ///< Filter to decode with
+   char*        mName;          ///< File being read (our own copy)
+   AudioFilter* mFilter;        ///< Real filter (when not reading from the cache)
+   AudioPCMCacheEntry *mEntry;  ///< Cached clip (when reading from the cache)
+   U32 mPosition;               ///< Position in mEntry
+
+  public:
+   PCMCacheFilter(FilterInfo *info, const char *filename);
+   virtual ~PCMCacheFilter();
+
+   /// @name Overrides of NFilterStream
+   /// @{
+  public:
+   bool    attachStream(Stream* io_pSlaveStream);
+   void    detachStream();
+   Stream* getStream();
+   /// @}
+
+   /// @name Mandatory overrides
+   /// @{
+  protected:
+   bool _read(const U32 in_numBytes,  void* out_pBuffer);
+   bool _write(const U32 in_numBytes, const void* in_pBuffer);
+  public:
+   U32  getPosition() const;
+   bool setPosition(const U32 in_newPosition);
+   U32  getStreamSize();
+   /// @}
+
+   /// @name AudioFilter Management
+   /// @{
+  U8 getChannelFormat();
+  U32 getNumSamples();
+  bool seekTime(F32 time);
+  bool seekSample(U32 sample);
+  U32 getSample();
+  F32 getTime();
+  F32 getTimeLength();
+  /// @}
+
+  bool isCached() {return mEntry != NULL;}	///< Is the clip being read from the cache?
+};
+
+#endif //_PCMCACHEFILTER_H_
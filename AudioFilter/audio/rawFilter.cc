@@ -119,28 +119,34 @@ U32 RawFilter::getNumSamples()
 }
 
 //--------------------------------------------------------------------------
-bool RawFilter::seekTime(F32 time)
+bool RawFilter::seekSample(U32 sample)
 {
-	// Calulate position considering time, then seek to it
-	U32 sampleSize = getFormatSize((const_cast<RawFilter*>(this))->getChannelFormat());
-	U32 calcPos = U32(mCeil(time * (mSamplingRate) * sampleSize));
+	// Every sample is the same size, so the position is exact
+	U32 sampleSize = getFormatSize(getChannelFormat());
+	U32 calcPos = sample * sampleSize;
 	
-	if (calcPos > m_pStream->getStreamSize())
+	if (sampleSize == 0 || calcPos > m_pStream->getStreamSize())
 		return false;
 	return setPosition(calcPos);
 }
 
+//--------------------------------------------------------------------------
+bool RawFilter::seekTime(F32 time)
+{
+	return Parent::seekTime(time);
+}
+
 //--------------------------------------------------------------------------
 F32 RawFilter::getTime()
 {
-	U32 sampleSize = getFormatSize((const_cast<RawFilter*>(this))->getChannelFormat());
-	return ((m_pStream->getPosition()/sampleSize) / mSamplingRate);
+	U32 sampleSize = getFormatSize(getChannelFormat());
+	return (sampleSize && mSamplingRate) ? F32(m_pStream->getPosition()/sampleSize) / F32(mSamplingRate) : .0;
 }
 
 //--------------------------------------------------------------------------
 F32 RawFilter::getTimeLength()
 {
-	return (getNumSamples()/mSamplingRate);
+	return mSamplingRate ? F32(getNumSamples()) / F32(mSamplingRate) : .0;
 }
 
 //--------------------------------------------------------------------------
@@ -154,7 +160,10 @@ U8 RawFilter::getChannelFormat()
 //--------------------------------------------------------------------------
 bool RawFilter::setChannelFormat(U8 format)
 {
+	if (getFormatSize(format) == 0)
+		return false;
 	mChannelFormat = format;
+	return true;
 }
 
 //--------------------------------------------------------------------------
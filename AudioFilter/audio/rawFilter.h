@@ -55,6 +55,7 @@ class RawFilter : public AudioFilter
   U8 getChannelFormat();		///< Get Formats for each channel used
   bool setChannelFormat(U8 format);	///< Sets Channel format
   U32 getNumSamples();			///< Get Number of Samples
+  bool seekSample(U32 sample);		///< Seeks to sample
   bool seekTime(F32 time);		///< Seeks to time
   F32 getTime();			///< Gets current time
   F32 getTimeLength();			///< Gets length of stream in time
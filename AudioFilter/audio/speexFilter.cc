@@ -18,6 +18,9 @@ SpeexFilter::SpeexFilter()
    mDecodedSize = 0;
    mVBRQuality = -1;
    currentEncoder = SPEEX_NONE;
+   mPendingBytes = 0;
+   mWriteStarted = false;
+   mReadAhead = NULL;
 }
 
 //--------------------------------------------------------------------------
@@ -52,6 +55,12 @@ bool SpeexFilter::attachStream(Stream* io_pSlaveStream)
   }
 
    trackedPosition = 0;
+   mReadAhead = (mEnableRead and m_pStream->hasCapability(StreamRead)) ? new U8[SPEEX_READAHEAD] : NULL;
+   flushReadAhead();
+   mSeekIndex.clear();
+   mSeekIndexLoaded = false;
+   mFramesWritten = 0;
+   mPendingBytes = 0;
    setStatus(Ok);
    return true;
 }
@@ -59,9 +68,16 @@ bool SpeexFilter::attachStream(Stream* io_pSlaveStream)
 //--------------------------------------------------------------------------
 void SpeexFilter::detachStream()
 {  
+   if (mWriteStarted && m_pStream)
+   	finishWrite();
+
    refreshStreams(0); // remove streams
    refreshCoder(SPEEX_NONE); // destroy encoder/decoder
 
+   if (mReadAhead != NULL)
+   	delete [] mReadAhead;
+   mReadAhead = NULL;
+
    mAudioCapability = 0;
    m_pOutputBuffer = NULL;
    m_pInputBuffer = NULL;
@@ -89,7 +105,6 @@ bool SpeexFilter::_read(const U32 numBytes, void *pBuffer)
 	}
 
 	/* Read Bytes */
-	U16 FrameSize;	// Size of encoded frame being read
 	U32 DataLeft;	// Data left
 	U32 DataToRead;	// Size to read into buffer
 	DataLeft = numBytes;
@@ -99,45 +114,49 @@ bool SpeexFilter::_read(const U32 numBytes, void *pBuffer)
 		Con::warnf("Warning : speex frame size is 0!");
 		return false;
 	}
+	U32 FrameBytes = speex_size*speex_samplesize;
 
-	// Read in until we have read numBytes of decoded audio
-	while (1)
+	// Finish off the frame the last read stopped part way through
+	if (mDecodedLeft != 0)
 	{
-		m_pStream->read(sizeof(U16), &FrameSize); // Read encoded size
-
-		// Calculate how many more bytes are left to decode
-		DataToRead = (DataLeft > (speex_size*speex_samplesize)) ? (speex_size*speex_samplesize) : DataLeft;
-
-		if (FrameSize == 0) {
-			m_pStream->setPosition(m_pStream->getPosition()-2); // Trick into reading frame size again
-			break; // Canot read any more, or could be invalid
-		}
+		DataToRead = (DataLeft > mDecodedLeft) ? mDecodedLeft : DataLeft;
+		dMemcpy(buffer, m_pOutputBuffer + (FrameBytes - mDecodedLeft), DataToRead);
+		buffer += DataToRead;
+		trackedPosition += DataToRead;
+		mDecodedLeft -= DataToRead;
+		DataLeft -= DataToRead;
+	}
 
-		if (!m_pStream->read(FrameSize, m_pInputBuffer))  // Buffer Up
+	// Read in until we have read numBytes of decoded audio
+	while (DataLeft != 0)
+	{
+		// Whole frames go straight into the caller's buffer (if it is suitably aligned).
+		// Otherwise decode into m_pOutputBuffer, and keep what's left over for the next read.
+		bool direct = (DataLeft >= FrameBytes) && (((dsize_t)buffer & (sizeof(short)-1)) == 0);
+		S32 decoded = decodeFrame((short*)(direct ? buffer : m_pOutputBuffer));
+		if (decoded == 0)
+			break; // Out of data, or at the terminator (which is left in place, so we stop here again next time)
+		if (decoded < 0)
 			return false; // Bail out
 		
-		// Speex read
-		// We perform all speex operations in the buffers, since the user *may* miss out parts of packets to read.
-		speex_bits_read_from(&bits_decode,(char*)m_pInputBuffer, FrameSize);
-
-		// Then convert
-		if (speex_decode(dec_state, &bits_decode, (short*)m_pOutputBuffer) < 0) {
-			Con::warnf("speex_decode < 0!");
-			return false;
+		DataToRead = (DataLeft > FrameBytes) ? FrameBytes : DataLeft;
+		if (!direct)
+		{
+			dMemcpy(buffer, m_pOutputBuffer, DataToRead);
+			mDecodedLeft = FrameBytes - DataToRead;
 		}
-		
-		// And copy into buffer
-		dMemcpy(buffer, m_pOutputBuffer, DataToRead);
 
 		// Increment pointers and check
 		buffer += DataToRead;
 		trackedPosition += DataToRead;
-		
-		if (DataLeft == DataToRead) {
-			break; // We have finished the frames
-		}
 		DataLeft -= DataToRead; // We've done 1 frame worth of decoded data
 	}
+
+	if (DataLeft != 0)
+	{
+		setStatus(EOS);
+		return false;
+	}
 	
 	// Tell torque we're ok...
 	setStatus(Ok);
@@ -145,13 +164,79 @@ bool SpeexFilter::_read(const U32 numBytes, void *pBuffer)
    return true;
 }
 
+//--------------------------------------------------------------------------
+S32 SpeexFilter::decodeFrame(short *out)
+{
+	U16 FrameSize;	// Size of encoded frame being read
+	if (!fillReadAhead(sizeof(U16)))
+		return 0; // Out of data
+	dMemcpy(&FrameSize, mReadAhead + mReadAheadPos, sizeof(U16)); // Read encoded size
+
+	if (FrameSize == 0)
+		return 0; // Terminator
+
+	if (FrameSize > SPEEX_READAHEAD - sizeof(U16) || !fillReadAhead(sizeof(U16) + FrameSize))
+		return -1;
+	
+	// Speex read, straight out of the read ahead buffer
+	speex_bits_read_from(&bits_decode, (char*)mReadAhead + mReadAheadPos + sizeof(U16), FrameSize);
+	mReadAheadPos += sizeof(U16) + FrameSize;
+
+	if (speex_decode(dec_state, &bits_decode, out) < 0) {
+		Con::warnf("speex_decode < 0!");
+		return -1;
+	}
+	return 1;
+}
+
+//--------------------------------------------------------------------------
+bool SpeexFilter::fillReadAhead(U32 needed)
+{
+	U32 left = mReadAheadSize - mReadAheadPos;
+	if (left >= needed)
+		return true;
+
+	// Move what's left to the front, then top up from the stream
+	if (left != 0 && mReadAheadPos != 0)
+		dMemmove(mReadAhead, mReadAhead + mReadAheadPos, left);
+	mReadAheadPos = 0;
+	mReadAheadSize = left;
+
+	U32 streamPos = m_pStream->getPosition();
+	U32 streamSize = m_pStream->getStreamSize();
+	U32 amount = SPEEX_READAHEAD - left;
+	if (streamPos + amount > streamSize)
+		amount = streamPos < streamSize ? streamSize - streamPos : 0;
+
+	if (amount != 0 && !m_pStream->read(amount, mReadAhead + left))
+		return false;
+	mReadAheadSize += amount;
+
+	return mReadAheadSize >= needed;
+}
+
+//--------------------------------------------------------------------------
+void SpeexFilter::flushReadAhead()
+{
+	mReadAheadSize = mReadAheadPos = 0;
+	mDecodedLeft = 0;
+}
+
+bool SpeexFilter::seekFailed()
+{
+	// The slave stream and decoder are somewhere between the old position and the new one, so neither can be trusted
+	flushReadAhead();
+	trackedPosition = mDecodedSize;
+	setStatus(IOError);
+	return false;
+}
+
 //--------------------------------------------------------------------------
 bool SpeexFilter::_write(const U32 numBytes, const void *pBuffer)
 {
-   U32 bytesToWrite = 0;// Bytes we have yet to write
+   U32 bytesToCopy = 0;	// Bytes we can add to the current frame
    U32 bytesLeft = 0;	// Bytes remaining
-   U16 EncodedSize = 0;	// Size of encoded data
-   U8 *buffer;		// Pointer to where we write
+   U8 *buffer;		// Pointer to where we read from
 
    AssertFatal(pBuffer != NULL, "NULL input buffer");
    if (getStatus() == Closed)
@@ -160,44 +245,33 @@ bool SpeexFilter::_write(const U32 numBytes, const void *pBuffer)
       return false;
    }
 
+   if (speex_size == 0) {
+      Con::warnf("Warning : speex frame size is 0!");
+      return false;
+   }
+
    // Get pointer to our data
    buffer = (U8*)pBuffer;
-   bytesToWrite = 0;
    bytesLeft = numBytes; 
+   mWriteStarted = true;
+
+   // Gather the data into whole frames, encoding each as it fills up.
+   // Anything left over waits for the next write (or detachStream())
+   while (bytesLeft != 0) {
+      bytesToCopy = speex_size*speex_samplesize - mPendingBytes;
+      if (bytesToCopy > bytesLeft)
+      	bytesToCopy = bytesLeft;
+
+      dMemcpy(m_pInputBuffer + mPendingBytes, buffer, bytesToCopy);
+      mPendingBytes += bytesToCopy;
 
-   // Now do a buffered write
-   // Will continue until we have written all of the data
-   while (1) {
-      /* Write Bytes */
-      if (bytesLeft == 0) {
-      	// Write terminator
-	EncodedSize = 0;
-	m_pStream->write(sizeof(U16), &EncodedSize);
-      	break;
-      }
-
-      // Encode in blocks of speex_size (in bytes)
-      bytesToWrite = (bytesLeft > speex_size*speex_samplesize) ? speex_size*speex_samplesize : bytesLeft;
-
-      // Encode this frame
-      speex_bits_reset(&bits_encode); // Reset
-
-      dMemcpy(m_pInputBuffer, buffer, bytesToWrite); // Copy decoded mem from buffer into raw_data
-      speex_encode(enc_state, (short*)m_pInputBuffer, &bits_encode);
-      EncodedSize = speex_bits_write(&bits_encode, (char*)m_pOutputBuffer, bytesToWrite); // (bytes)
-
-      // Write the data
-      m_pStream->write(sizeof(U16), &EncodedSize);  // Size in bytes of Frame
-      m_pStream->write(EncodedSize, m_pOutputBuffer); // Write the speex_data
-      
       // Increment pointers
-      bytesLeft -= bytesToWrite;
-      buffer += bytesToWrite;
-      trackedPosition += bytesToWrite;
-      
-      
-      if (bytesToWrite == bytesLeft)
-      	bytesLeft = 0; // This will write terminator and break next loop 
+      bytesLeft -= bytesToCopy;
+      buffer += bytesToCopy;
+      trackedPosition += bytesToCopy;
+
+      if (mPendingBytes == speex_size*speex_samplesize && !writeFrame())
+      	return false;
    }
 
    // Tell torque we're ok...
@@ -206,6 +280,43 @@ bool SpeexFilter::_write(const U32 numBytes, const void *pBuffer)
    return true;
 }
 
+//--------------------------------------------------------------------------
+bool SpeexFilter::writeFrame()
+{
+   U16 EncodedSize = 0;	// Size of encoded data
+
+   // Encode this frame
+   speex_bits_reset(&bits_encode); // Reset
+   speex_encode(enc_state, (short*)m_pInputBuffer, &bits_encode);
+   EncodedSize = speex_bits_write(&bits_encode, (char*)m_pOutputBuffer, speex_size*speex_samplesize); // (bytes)
+   mPendingBytes = 0;
+
+   // Note where every SEEKINDEX_INTERVAL'th frame starts
+   if ((mFramesWritten++ % SEEKINDEX_INTERVAL) == 0)
+   	mSeekIndex.push_back(m_pStream->getPosition());
+
+   // Write the data
+   if (!m_pStream->write(sizeof(U16), &EncodedSize))  // Size in bytes of Frame
+   	return false;
+   return m_pStream->write(EncodedSize, m_pOutputBuffer); // Write the speex_data
+}
+
+//--------------------------------------------------------------------------
+void SpeexFilter::finishWrite()
+{
+   // Pad out the last frame with silence
+   if (mPendingBytes != 0) {
+   	dMemset(m_pInputBuffer + mPendingBytes, 0, speex_size*speex_samplesize - mPendingBytes);
+   	writeFrame();
+   }
+
+   // Write terminator
+   U16 EncodedSize = 0;
+   m_pStream->write(sizeof(U16), &EncodedSize);
+   writeSeekIndex();
+   mWriteStarted = false;
+}
+
 //--------------------------------------------------------------------------
 U32 SpeexFilter::getPosition() const
 {
@@ -217,48 +328,133 @@ U32 SpeexFilter::getPosition() const
 bool SpeexFilter::setPosition(const U32 newPosition)
 {
    AssertFatal(m_pStream != NULL, "Error, not attached");
-   m_pStream->setPosition(13); // Offset from header
-   if (m_pStream->getStreamSize() >= mDecodedSize)
+   U32 FrameSize = speex_size*speex_samplesize;
+   if (FrameSize == 0 || newPosition > mDecodedSize)
    	return false;
 
-   // Now we need to keep going through the frame's till we get close to our position
-   U32 newPos = 13;
+   if (!mSeekIndexLoaded)
+   	loadSeekIndex();
+
+   bool reading = mEnableRead && m_pStream->hasCapability(StreamRead);
+
+   // Land on the sample, not the frame. When reading, start a few frames early so the decoder settles,
+   // and decode the target frame up to the sample.
+   U32 frame = newPosition / FrameSize;
+   U32 offset = ((newPosition % FrameSize) / speex_samplesize) * speex_samplesize;
+   U32 startFrame = (reading && frame > SPEEX_PREROLL_FRAMES) ? frame - SPEEX_PREROLL_FRAMES : (reading ? 0 : frame);
+
+   // Jump to the nearest indexed frame, then walk the rest of the way
+   U32 newPos = HEADER_SIZE;
+   U32 walkFrames = startFrame;
+   if (mSeekIndex.size() != 0)
+   {
+	U32 entry = getMin(startFrame / SEEKINDEX_INTERVAL, (U32)mSeekIndex.size()-1);
+	newPos = mSeekIndex[entry];
+	walkFrames = startFrame - (entry * SEEKINDEX_INTERVAL);
+   }
+
    U16 encodedFrameSize = 0;
-   U32 FrameSize = speex_size*getFormatSize(getChannelFormat());
-   U32 decodedPos = FrameSize; // Where we are going to be, not where we are
-   
-   while (1)
+   flushReadAhead(); // Anything read ahead is from the old position
+   m_pStream->setPosition(newPos);
+   for (U32 i=0; i<walkFrames; i++)
    {
-	// Check if this frame is within the decoded position
-	if (decodedPos >= newPosition)
-		break;
-	
-	// Otherwise, go to next frame
-	m_pStream->read(sizeof(U16), &encodedFrameSize);
-	decodedPos += FrameSize;
-	
+	if (!m_pStream->read(sizeof(U16), &encodedFrameSize) || encodedFrameSize == 0)
+		return seekFailed(); // Past the terminator
 	newPos += encodedFrameSize+2; // 2 == sizeof(U16)
 	m_pStream->setPosition(newPos);
    }
-   
-   trackedPosition = decodedPos-FrameSize; // Set tracked position to where we are
 
-   if (mEnableRead and m_pStream->hasCapability(StreamRead))
-   	speex_bits_reset(&bits_decode); // Reset decoding bits
+   if (reading)
+   {
+	speex_bits_reset(&bits_decode); // Reset decoding bits
+
+	// Decode (and throw away) the frames ahead of the target
+	for (U32 i=startFrame; i<frame; i++)
+	{
+		if (decodeFrame((short*)m_pOutputBuffer) <= 0)
+			return seekFailed();
+	}
+
+	// Then the partial frame, leaving the rest of it for the next read
+	if (offset != 0)
+	{
+		if (decodeFrame((short*)m_pOutputBuffer) <= 0)
+			return seekFailed();
+		mDecodedLeft = FrameSize - offset;
+	}
+	trackedPosition = frame*FrameSize + offset;
+   }
+   else
+	trackedPosition = frame*FrameSize; // Set tracked position to where we are
+
    if (mEnableWrite and m_pStream->hasCapability(StreamWrite))
    	speex_bits_reset(&bits_encode); // Reset encoding bits
 
+   setStatus(Ok); // Clears EOS, or an earlier failed seek
    return true;
 }
 
+//--------------------------------------------------------------------------
+bool SpeexFilter::loadSeekIndex()
+{
+	mSeekIndex.clear();
+	mSeekIndexLoaded = true;
+
+	// Stream ends with [index][U32 index offset][U32 magic] if it has an index
+	U32 streamSize = m_pStream->getStreamSize();
+	if (streamSize >= HEADER_SIZE + sizeof(U16) + sizeof(U32)*3 && m_pStream->setPosition(streamSize - sizeof(U32)*2))
+	{
+		U32 indexOffset = 0;
+		U32 magic = 0;
+		U32 count = 0;
+		m_pStream->read(sizeof(U32), &indexOffset);
+		m_pStream->read(sizeof(U32), &magic);
+		if (magic == SEEKINDEX_MAGIC && indexOffset >= HEADER_SIZE && indexOffset < streamSize - sizeof(U32)*3 &&
+		    m_pStream->setPosition(indexOffset) && m_pStream->read(sizeof(U32), &count) &&
+		    count * sizeof(U32) == streamSize - sizeof(U32)*3 - indexOffset)
+		{
+			mSeekIndex.setSize(count);
+			if (count == 0 || m_pStream->read(count * sizeof(U32), mSeekIndex.address()))
+				return true;
+			mSeekIndex.clear();
+		}
+	}
+
+	// No index, so build one by walking the frame headers (only done once)
+	U32 pos = HEADER_SIZE;
+	U32 frame = 0;
+	U16 encodedFrameSize = 0;
+	m_pStream->setPosition(pos);
+	while (m_pStream->read(sizeof(U16), &encodedFrameSize) && encodedFrameSize != 0)
+	{
+		if ((frame++ % SEEKINDEX_INTERVAL) == 0)
+			mSeekIndex.push_back(pos);
+		pos += encodedFrameSize+2;
+		if (!m_pStream->setPosition(pos))
+			break;
+	}
+	return false;
+}
+
+//--------------------------------------------------------------------------
+void SpeexFilter::writeSeekIndex()
+{
+	U32 indexOffset = m_pStream->getPosition();
+	U32 count = mSeekIndex.size();
+	U32 magic = SEEKINDEX_MAGIC;
+	m_pStream->write(sizeof(U32), &count);
+	if (count != 0)
+		m_pStream->write(count * sizeof(U32), mSeekIndex.address());
+	m_pStream->write(sizeof(U32), &indexOffset);
+	m_pStream->write(sizeof(U32), &magic);
+	mSeekIndexLoaded = true;
+}
+
 //--------------------------------------------------------------------------
 bool SpeexFilter::seekTime(F32 time)
 {
-	// Calulate position considering time, then seek to it
-	U32 sampleSize = getFormatSize(getChannelFormat());
-	U32 calcPos = U32(mCeil(time * (mSamplingRate) * sampleSize));
-	
-	return setPosition(calcPos);
+	// Goes through seekSample(), so we land on a whole sample
+	return Parent::seekTime(time);
 }
 
 //--------------------------------------------------------------------------
@@ -400,6 +596,12 @@ U8 SpeexFilter::getChannelFormat()
 	return CHANNEL_MONO_16;
 }
 
+//--------------------------------------------------------------------------
+bool SpeexFilter::setChannelFormat(U8 format)
+{
+	return format == CHANNEL_MONO_16;
+}
+
 //--------------------------------------------------------------------------
 void SpeexFilter::refreshCoder(U8 mode)
 {
@@ -469,12 +671,12 @@ void SpeexFilter::refreshCoder(U8 mode)
 F32 SpeexFilter::getTime()
 {
 	U32 sampleSize = getFormatSize(getChannelFormat());
-	return ((trackedPosition/sampleSize) / mSamplingRate);
+	return (sampleSize && mSamplingRate) ? F32(trackedPosition/sampleSize) / F32(mSamplingRate) : .0;
 }
 
 //--------------------------------------------------------------------------
 F32 SpeexFilter::getTimeLength()
 {
 	U32 sampleSize = getFormatSize(getChannelFormat());
-	return ((mDecodedSize/sampleSize) / mSamplingRate);
+	return (sampleSize && mSamplingRate) ? F32(mDecodedSize/sampleSize) / F32(mSamplingRate) : .0;
 }
@@ -7,9 +7,15 @@
 #ifndef _AUDIOFILTER_H_
 #include "audio/audioFilter.h"
 #endif
+#ifndef _TVECTOR_H_
+#include "core/tVector.h"
+#endif
 
 #include "speex.h" // Speex header
 
+#define SPEEX_READAHEAD 32768 // Encoded data read from the slave stream at a time
+#define SPEEX_PREROLL_FRAMES 2 // Frames decoded (and thrown away) ahead of a seek, so the decoder has settled
+
 //----------------------------------------------------------------------
 /// This class implements Speex Support.
 ///
@@ -18,6 +24,15 @@
 /// @note The file format this filter outputs is NOT the same as the official speex file format,
 /// use the ConsoleFunction filterConvert to convert audio to the format this filter uses.
 ///
+/// Streams written by this filter end with a seek index (the stream offset of every SEEKINDEX_INTERVAL'th frame),
+/// placed after the frame terminator so older readers never see it. Streams without one have the index built
+/// by walking the frame headers the first time they are seeked, after which seeking only walks a few frames.
+/// Seeks land on the exact sample : SPEEX_PREROLL_FRAMES frames ahead of the target are decoded and thrown away,
+/// then the part of the target frame before the sample.
+///
+/// Data can be written in any number of pieces. The terminator and seek index are written when the stream is
+/// detached, so detach the filter before closing the slave stream.
+///
 /// @see AudioFilter for example usage.
 /// 
 class SpeexFilter : public AudioFilter
@@ -56,6 +71,7 @@ class SpeexFilter : public AudioFilter
   bool readHeader();		///< Forced user supply of data header
   bool writeHeader();		///< Write the header
   U8 getChannelFormat();	///< Get Formats for each channel used
+  bool setChannelFormat(U8 format);	///< Only CHANNEL_MONO_16 can be encoded
   U32 getNumSamples();		///< Get Number of Samples
   void setSamplingRate(U32 val);///< Set Sampling rate
   void setQuality(U8 num);	///< Set Quality level
@@ -78,6 +94,37 @@ class SpeexFilter : public AudioFilter
    void refreshCoder(U8 mode);	///< Recreates encoder
    U8 currentEncoder;		///< Current Encoder
    U32 trackedPosition;		///< Position we tracked in stream
+   U32 mPendingBytes;		///< Bytes of a partial frame held in m_pInputBuffer, waiting for the next write
+   bool mWriteStarted;		///< Has anything been written? (if so, the stream is finished on detach)
+   bool writeFrame();		///< Encodes and writes out the frame in m_pInputBuffer
+   void finishWrite();		///< Writes out any partial frame, then the terminator and seek index
+  /// @}
+
+  /// @name Read ahead
+  /// Encoded frames are read from the slave stream SPEEX_READAHEAD bytes at a time, and parsed in memory.
+  /// @{
+   U8 *mReadAhead;		///< Encoded data read ahead of the decoder
+   U32 mReadAheadSize;		///< Amount of mReadAhead filled
+   U32 mReadAheadPos;		///< Position of the next frame in mReadAhead
+   U32 mDecodedLeft;		///< Bytes of the last decoded frame (in m_pOutputBuffer) not yet returned by read()
+   bool fillReadAhead(U32 needed);	///< Makes sure at least needed bytes are waiting in mReadAhead
+   void flushReadAhead();	///< Forgets everything read ahead, following a seek
+   bool seekFailed();		///< Leaves the filter at the end with IOError set, once setPosition() has failed part way. Returns false
+   S32  decodeFrame(short *out);	///< Decodes the next frame into out. Returns 1 if decoded, 0 at the end of the data, -1 on error
+  /// @}
+
+  /// @name Seek index
+  /// @{
+  enum {
+	HEADER_SIZE = 13,		///< Size of the header written by writeHeader()
+	SEEKINDEX_INTERVAL = 16,	///< Frames between each entry in the seek index
+	SEEKINDEX_MAGIC = 0x49585053	///< "SPXI", last U32 of a stream with a seek index
+  };
+  Vector<U32> mSeekIndex;	///< Stream offset of every SEEKINDEX_INTERVAL'th frame
+  bool mSeekIndexLoaded;	///< Has mSeekIndex been read or built yet?
+  U32 mFramesWritten;		///< Frames encoded so far (for building mSeekIndex on write)
+  bool loadSeekIndex();		///< Reads the index from the end of the stream, or builds it from the frame headers
+  void writeSeekIndex();	///< Writes out mSeekIndex, following the terminator
   /// @}
   
   /// @name Simple enum of speex modes 
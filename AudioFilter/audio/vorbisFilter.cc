@@ -15,6 +15,12 @@ VorbisFilter::VorbisFilter()
    //
    mDetectHeaders = true;
    vi = NULL;
+   mQuality = 8;
+   mVBRQuality = -1;
+   mEncoding = false;
+   mEncoderReady = false;
+   mWriteFormat = CHANNEL_STEREO_16;
+   mPendingBytes = 0;
 }
 
 //--------------------------------------------------------------------------
@@ -30,6 +36,20 @@ bool VorbisFilter::attachStream(Stream* io_pSlaveStream)
    AssertFatal(m_pStream == NULL,       "Already attached!");
 
    m_pStream      = io_pSlaveStream;
+   vi = NULL;
+
+   // Writing? The encoder is set up by writeHeader(), once the format is known.
+   mEncoding = mEnableWrite && m_pStream->hasCapability(StreamWrite);
+   if (mEncoding)
+   {
+      mAudioCapability = AudioFilter::AudioEncode;
+      mEncoderReady = false;
+      trackedPosition = 0;
+      mPendingBytes = 0;
+      m_pOutputBuffer = NULL;
+      setStatus(Ok);
+      return true;
+   }
    
    // Setup Capabilities for this stream
    mAudioCapability = AudioFilter::AudioSeek | AudioFilter::AudioTime;
@@ -41,14 +61,7 @@ bool VorbisFilter::attachStream(Stream* io_pSlaveStream)
    }
 
    // Success!
-   // Now setup our buffers
-
-   if ( mEnableWrite && (m_pStream->hasCapability(StreamWrite)))
-   	m_pOutputBuffer = new U8[VORBIS_BUFFSIZE];
-   else
-   	m_pOutputBuffer = NULL;
-
-   vi = NULL;
+   m_pOutputBuffer = NULL;
 
    if (mDetectHeaders)
      readHeader();	//Read Vorbis File Info
@@ -60,19 +73,25 @@ bool VorbisFilter::attachStream(Stream* io_pSlaveStream)
 //--------------------------------------------------------------------------
 void VorbisFilter::detachStream()
 {
-   if (mEnableWrite) {
-   	if (m_pOutputBuffer != NULL)
-   	delete [] m_pOutputBuffer;
+   bool failed = false;
+   if (mEncoding) {
+   	failed = getStatus() == IOError; // A write already failed
+   	// Nothing written? The headers still go out, so the file is valid
+   	if (m_pStream && !mEncoderReady && !writeHeader())
+   		failed = true;
+   	if (mEncoderReady && m_pStream && !finishWrite())
+   		failed = true;
+   	mEncoding = false;
    }
+   else
+   	vf.ov_clear();
    
    mAudioCapability = 0; // reset capability's
-   
-   vf.ov_clear();
 
    m_pOutputBuffer = NULL;
 
    m_pStream      = NULL;
-   setStatus(Closed);
+   setStatus(failed ? IOError : Closed);
 }
 
 //--------------------------------------------------------------------------
@@ -141,20 +160,66 @@ bool VorbisFilter::_read(const U32 numBytes, void *pBuffer)
 //--------------------------------------------------------------------------
 bool VorbisFilter::_write(const U32 numBytes, const void *pBuffer)
 {
-  AssertFatal(0, "Write on VorbisFilter not permitted!");
    if (numBytes == 0)
       return true;
 
-   U32 writtenBytes = 0;	// Bytes we have written so far
-   U32 bytesToWrite = 0;	// Bytes we have yet to write
-   U8 *buffer;			// Pointer to where we write
-
    AssertFatal(pBuffer != NULL, "NULL input buffer");
    if (getStatus() == Closed)
    {
       AssertFatal(false, "Attempted write to a closed stream");
       return false;
    }
+   if (!mEncoding)
+   {
+      AssertFatal(false, "Write on VorbisFilter opened for reading!");
+      return false;
+   }
+
+   // The header sets up the encoder
+   if (!mEncoderReady && !writeHeader())
+   {
+      setStatus(IOError);
+      return false;
+   }
+
+   U8 *buffer = (U8*)pBuffer;	// Pointer to where we read from
+   U32 bytesLeft = numBytes;	// Bytes remaining
+   U32 sampleSize = getFormatSize(mWriteFormat);
+   trackedPosition += numBytes;
+
+   // Finish off the sample split by the last write
+   if (mPendingBytes != 0)
+   {
+      U32 bytesToCopy = getMin(sampleSize - mPendingBytes, bytesLeft);
+      dMemcpy(mPendingSample + mPendingBytes, buffer, bytesToCopy);
+      mPendingBytes += bytesToCopy;
+      buffer += bytesToCopy;
+      bytesLeft -= bytesToCopy;
+      if (mPendingBytes == sampleSize)
+      {
+         mPendingBytes = 0;
+         if (!encodeSamples(mPendingSample, 1))
+         {
+            setStatus(IOError);
+            return false;
+         }
+      }
+   }
+
+   // Encode whole samples, and keep the rest for next time
+   U32 samples = bytesLeft / sampleSize;
+   if (samples != 0 && !encodeSamples(buffer, samples))
+   {
+      setStatus(IOError);
+      return false;
+   }
+   buffer += samples * sampleSize;
+   bytesLeft -= samples * sampleSize;
+   if (bytesLeft != 0)
+   {
+      dMemcpy(mPendingSample, buffer, bytesLeft);
+      mPendingBytes = bytesLeft;
+   }
 
    // Tell torque we're ok...
    setStatus(Ok);
@@ -162,10 +227,132 @@ bool VorbisFilter::_write(const U32 numBytes, const void *pBuffer)
    return true;
 }
 
+//--------------------------------------------------------------------------
+bool VorbisFilter::encodeSamples(const U8 *data, U32 samples)
+{
+   const S16 *pcm = (const S16*)data;
+   U32 channels = getFormatChannels(mWriteFormat);
+
+   // Feed the encoder VORBIS_CHUNKSIZE samples at a time, so its buffers stay small
+   while (samples != 0)
+   {
+      U32 count = getMin(samples, (U32)VORBIS_CHUNKSIZE);
+      float **buffer = vorbis_analysis_buffer(&evd, count);
+      for (U32 c=0; c<channels; c++)
+      {
+         float *out = buffer[c];
+         const S16 *in = pcm + c;
+         for (U32 i=0; i<count; i++, in += channels)
+            out[i] = *in * (1.0f / 32768.0f);
+      }
+      vorbis_analysis_wrote(&evd, count);
+
+      pcm += count * channels;
+      samples -= count;
+      if (!flushEncoder(false))
+         return false;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------------
+bool VorbisFilter::flushEncoder(bool all)
+{
+   ogg_packet op;
+   ogg_page og;
+
+   // Encode whatever blocks are ready, and pass the packets on to the ogg stream
+   while (vorbis_analysis_blockout(&evd, &evb) == 1)
+   {
+      vorbis_analysis(&evb, NULL);
+      vorbis_bitrate_addblock(&evb);
+      while (vorbis_bitrate_flushpacket(&evd, &op))
+         ogg_stream_packetin(&eos, &op);
+   }
+
+   // Write out finished pages
+   while (all ? ogg_stream_flush(&eos, &og) : ogg_stream_pageout(&eos, &og))
+   {
+      if (!m_pStream->write(og.header_len, og.header) || !m_pStream->write(og.body_len, og.body))
+         return false;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------------
+bool VorbisFilter::finishWrite()
+{
+   // Anything left of a split sample is dropped
+   vorbis_analysis_wrote(&evd, 0); // End of stream
+   bool success = flushEncoder(true);
+   if (!success)
+      Con::errorf("VorbisFilter: could not write the end of the stream");
+
+   ogg_stream_clear(&eos);
+   vorbis_block_clear(&evb);
+   vorbis_dsp_clear(&evd);
+   vorbis_comment_clear(&evc);
+   vorbis_info_clear(&evi);
+   mEncoderReady = false;
+   return success;
+}
+
+//--------------------------------------------------------------------------
+bool VorbisFilter::writeHeader()
+{
+   if (!mEncoding || mEncoderReady)
+      return false;
+
+   U32 channels = getFormatChannels(mWriteFormat);
+   vorbis_info_init(&evi);
+
+   S32 ret;
+   F32 quality = mQuality > 10 ? 1.0 : mQuality / 10.0;
+   if (mVBRQuality >= .0)
+      ret = vorbis_encode_init_vbr(&evi, channels, mSamplingRate, getMin(mVBRQuality, 1.0f));
+   else
+   {
+      // Average bitrate. Not every bitrate works at every sampling rate, so fall back to the equivalent quality level.
+      ret = vorbis_encode_init(&evi, channels, mSamplingRate, -1, (16000 + getMin(mQuality, (U32)10) * 8000) * channels, -1);
+      if (ret != 0)
+      {
+         vorbis_info_clear(&evi);
+         vorbis_info_init(&evi);
+         ret = vorbis_encode_init_vbr(&evi, channels, mSamplingRate, quality);
+      }
+   }
+   if (ret != 0)
+   {
+      Con::errorf("VorbisFilter: could not set up encoder for %dHz, %d channels", mSamplingRate, channels);
+      vorbis_info_clear(&evi);
+      return false;
+   }
+
+   vorbis_comment_init(&evc);
+   vorbis_comment_add_tag(&evc, "ENCODER", "Torque VorbisFilter");
+   vorbis_analysis_init(&evd, &evi);
+   vorbis_block_init(&evd, &evb);
+
+   // Files are encoded side by side, so the serial number just has to differ between streams
+   ogg_stream_init(&eos, Platform::getRealMilliseconds() ^ (U32)(dsize_t)this);
+
+   // Write out the three header packets, each header starting a new page
+   ogg_packet header, header_comm, header_code;
+   vorbis_analysis_headerout(&evd, &evc, &header, &header_comm, &header_code);
+   ogg_stream_packetin(&eos, &header);
+   ogg_stream_packetin(&eos, &header_comm);
+   ogg_stream_packetin(&eos, &header_code);
+   mEncoderReady = true;
+
+   return flushEncoder(true);
+}
+
 //--------------------------------------------------------------------------
 U32 VorbisFilter::getPosition() const
 {
    AssertFatal(m_pStream != NULL, "Error, not attached");
+   if (mEncoding)
+      return trackedPosition;
    return vf.vf->pcm_offset * getFormatSize((const_cast<VorbisFilter*>(this))->getChannelFormat());
 }
 
@@ -173,7 +360,27 @@ U32 VorbisFilter::getPosition() const
 bool VorbisFilter::setPosition(const U32 newPosition)
 {
    AssertFatal(m_pStream != NULL, "Error, not attached");
-   return vf.ov_pcm_seek(newPosition) >= 0;
+   U32 sampleSize = getFormatSize(getChannelFormat());
+   if (mEncoding || sampleSize == 0)
+      return false;
+   return seekSample(newPosition / sampleSize);
+}
+
+//--------------------------------------------------------------------------
+bool VorbisFilter::seekSample(U32 sample)
+{
+   // ov_pcm_seek() decodes up to the exact sample from the page before it
+   if (mEncoding)
+      return false;
+   return vf.ov_pcm_seek(sample) >= 0;
+}
+
+//--------------------------------------------------------------------------
+U32 VorbisFilter::getSample()
+{
+   if (mEncoding)
+      return Parent::getSample();
+   return vf.vf->pcm_offset;
 }
 
 //--------------------------------------------------------------------------
@@ -185,7 +392,8 @@ U32 VorbisFilter::getNumSamples()
 //--------------------------------------------------------------------------
 bool VorbisFilter::seekTime(F32 time)
 {
-	return vf.ov_time_seek(time) < 0 ? false : true; 
+	// Go through seekSample(), so times round to a sample the same way as the other filters
+	return Parent::seekTime(time);
 }
 
 //--------------------------------------------------------------------------
@@ -212,9 +420,20 @@ bool VorbisFilter::readHeader()
 //--------------------------------------------------------------------------
 U8 VorbisFilter::getChannelFormat()
 {
+	if (mEncoding)
+		return mWriteFormat;
 	if(vi->channels == 1) {
 		return CHANNEL_MONO_16;
 	} else {
 		return CHANNEL_STEREO_16;
 	}
 }
+
+//--------------------------------------------------------------------------
+bool VorbisFilter::setChannelFormat(U8 format)
+{
+	if (!mEncoding || mEncoderReady || (format != CHANNEL_MONO_16 && format != CHANNEL_STEREO_16))
+		return false;
+	mWriteFormat = format;
+	return true;
+}
@@ -9,6 +9,7 @@
 #endif
 
 #include "audio/vorbisStream.h"
+#include "vorbis/vorbisenc.h" // Vorbis encoder
 
 #define VORBIS_BUFFSIZE 32768
 #define VORBIS_CHUNKSIZE 4096
@@ -16,9 +17,14 @@
 //----------------------------------------------------------------------
 /// This class implements Ogg Vorbis Support.
 ///
-/// When attached to a Stream (using attachStream), this class can be used to read raw PCM data from ogg vorbis files (.ogg)
+/// When attached to a Stream (using attachStream), this class can be used to read raw PCM data from ogg vorbis files (.ogg),
+/// or when opened for writing, to encode 16bit mono or stereo PCM data into them.
 ///
-/// @note This filter does not support encoding ogg vorbis data. 
+/// When encoding, a VBR quality from 0 to 1.0 encodes at that vorbis quality level. Otherwise (VBR quality below 0) the quality
+/// (0 - 10) picks an average bitrate, from 16 to 96kbps per channel. The encoder is set up by writeHeader() (or the
+/// first write), and the stream is finished off when detached, so detach the filter before closing the slave stream.
+/// A stream detached before anything was written still gets its headers, so it is a valid (empty) ogg vorbis file. If the
+/// stream could not be finished off, the status is left as IOError after detaching rather than Closed.
 ///
 /// @see AudioFilter for example usage.
 /// 
@@ -56,8 +62,12 @@ class VorbisFilter : public AudioFilter
    /// @{
    // Functions that we can use
   bool readHeader(); ///< Forced user supply of data header
+  bool writeHeader(); ///< Sets up the encoder, and writes the vorbis headers
   U8 getChannelFormat(); ///< Get Formats for each channel used
+  bool setChannelFormat(U8 format); ///< Set format to encode (16bit mono or stereo)
   U32 getNumSamples(); ///< Get Number of Samples
+  bool seekSample(U32 sample); ///< Seek to the exact sample
+  U32 getSample(); ///< Get current sample
   bool seekTime(F32 time);
   F32 getTime();
   F32 getTimeLength();
@@ -71,6 +81,24 @@ class VorbisFilter : public AudioFilter
   vorbis_info *vi;
   long oggRead(char *buffer,int length, int bigendianp,int *bitstream);
   /// @}
+
+  /// @name Vorbis Encoding
+  /// @{
+  bool mEncoding;               ///< Attached for writing?
+  bool mEncoderReady;           ///< Has writeHeader() set up the encoder?
+  U8 mWriteFormat;              ///< Format of the PCM data being encoded
+  U32 trackedPosition;          ///< PCM written so far
+  U8 mPendingSample[4];         ///< Part of a sample left over from the last write
+  U32 mPendingBytes;            ///< Amount of mPendingSample filled
+  ogg_stream_state eos;         ///< Ogg stream being written
+  vorbis_info evi;              ///< Encoder settings
+  vorbis_comment evc;           ///< Comments written in the header
+  vorbis_dsp_state evd;         ///< Encoder state
+  vorbis_block evb;             ///< Block being encoded
+  bool encodeSamples(const U8 *data, U32 samples); ///< Passes whole samples to the encoder
+  bool flushEncoder(bool all);  ///< Writes out any finished pages (all pages if all is set)
+  bool finishWrite();           ///< Ends the stream, and frees the encoder. Returns false if the last pages could not be written
+  /// @}
 };
 
 #endif //_VORBISFILTER_H_
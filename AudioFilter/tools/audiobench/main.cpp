@@ -0,0 +1,643 @@
+//-----------------------------------------------------------------------------
+// (C) 2004 - 2006, Stuart James Urquhart (jamesu@gmail.com). All Rights Reserved.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "platform/event.h"
+#include "platform/platformAssert.h"
+#include "math/mMath.h"
+#include "console/console.h"
+#include "core/tVector.h"
+#include "core/fileStream.h"
+#include "core/memstream.h"
+#include "core/frameAllocator.h"
+#include "core/resManager.h"
+#include "audiobench/audioBenchGame.h"
+#include "audio/audioFilter.h"
+#include "audio/audioFilterManager.h"
+#include "audio/audioConvertFilter.h"
+#include "audio/rawFilter.h"
+
+#if defined(TORQUE_OS_WIN32)
+#include <windows.h>
+#elif defined(TORQUE_OS_LINUX) || defined(TORQUE_OS_MAC_OSX)
+#include <sys/time.h>
+#endif
+
+#define BENCH_SEEKS 32 // Seeks timed per run
+
+AudioBenchGame GameObject;
+
+// FOR SILLY LINK DEPENDANCY
+bool gEditingMission = false;
+
+#if defined(TORQUE_DEBUG)
+const char* const gProgramVersion = "1.0d";
+#else
+const char* const gProgramVersion = "1.0r";
+#endif
+
+// Allocations can only be counted when we're the ones providing operator new
+#if defined(TORQUE_DISABLE_MEMORY_MANAGER)
+#include <stdlib.h>
+#define BENCH_COUNT_ALLOCS
+static U32 gNumAllocs = 0;
+
+void* operator new(size_t size) { gNumAllocs++; return malloc(size ? size : 1); }
+void* operator new[](size_t size) { gNumAllocs++; return malloc(size ? size : 1); }
+void operator delete(void *ptr) { free(ptr); }
+void operator delete[](void *ptr) { free(ptr); }
+#endif
+
+//
+static bool initLibraries()
+{
+   FrameAllocator::init(2 << 20);
+
+   _StringTable::create();
+
+   ResManager::create();
+
+   Con::init();
+
+   Math::init();
+   Platform::init();    // platform specific initialization
+
+   AudioFilterManager::init();
+
+   return(true);
+}
+
+static void shutdownLibraries()
+{
+   // shut down
+   AudioFilterManager::destroy();
+
+   Platform::shutdown();
+   Con::shutdown();
+
+   _StringTable::destroy();
+
+   // asserts should be destroyed LAST
+   FrameAllocator::destroy();
+   PlatformAssert::destroy();
+}
+
+/// Audio to run through the filters
+struct BenchClip
+{
+	const char *name;
+	S32 synthetic;		///< Which synthetic signal to generate, or -1 for a file
+	U8 format;			///< Format of data (files only)
+	U32 rate;			///< Sampling rate of data (files only)
+	U8 *data;			///< Decoded file
+	U32 size;
+};
+
+/// Results of one filter/clip/setting run
+struct BenchResult
+{
+	U32 encodedSize;		///< Size of the encoded audio
+	F64 encodeSpeed;		///< Audio length / time taken to encode (x realtime)
+	F64 decodeSpeed;		///< Audio length / time taken to decode (x realtime)
+	F64 decodeRate;		///< MB/s of PCM out of read()
+	F64 allocsPerFrame;	///< Allocations per read() while decoding (-1 if not counted)
+	F64 seekTime;			///< Average ms to seek to a random sample and read a frame (-1 if not seekable)
+	bool ok;					///< Encoded and decoded the whole clip
+};
+
+static U32 gSeed = 0x1234567;
+static U32 benchRand()
+{
+	// Fixed LCG, so every run benchmarks the same data
+	gSeed = gSeed * 1103515245 + 12345;
+	return gSeed >> 8;
+}
+
+static const char *gSyntheticNames[] = {"tones", "noise"};
+
+static void makeSyntheticPCM(S32 kind, U8 format, U32 rate, U32 seconds, Vector<U8> &out)
+{
+	U32 channels = getFormatChannels(format);
+	U32 samples = rate * seconds;
+	out.setSize(samples * getFormatSize(format));
+	S16 *pcm = (S16*)out.address();
+	gSeed = 0x1234567;
+
+	for (U32 i=0; i<samples; i++)
+	{
+		for (U32 c=0; c<channels; c++)
+		{
+			F32 value;
+			if (kind == 0)
+			{
+				// A chord with some vibrato and a little noise, panned a bit differently on each side; like music
+				F32 t = (F32)i / (F32)rate;
+				F32 vibrato = 1.0f + mSin(t * 2.0f * M_PI * 5.0f) * 0.003f;
+				value = mSin(t * 2.0f * M_PI * 220.0f * vibrato) * (c ? 0.25f : 0.15f) +
+				        mSin(t * 2.0f * M_PI * 277.2f * vibrato) * 0.15f +
+				        mSin(t * 2.0f * M_PI * 329.6f * vibrato) * (c ? 0.15f : 0.25f) +
+				        ((F32)(benchRand() % 2048) / 1024.0f - 1.0f) * 0.01f;
+			}
+			else
+			{
+				// White noise (worst case for the codecs)
+				value = ((F32)(benchRand() % 65536) / 32768.0f - 1.0f) * 0.25f;
+			}
+			*pcm++ = (S16)(value * 32767.0f);
+		}
+	}
+}
+
+static bool loadFileClip(Vector<BenchClip> &list, const char *fileName)
+{
+	AudioFilter *filter = AudioFilterManager::getFilterFromFile(fileName, AudioFilterManager::AudioRead);
+	if (!filter)
+		return false;
+
+	FileStream fs;
+	if (!fs.open(fileName, FileStream::Read) || !filter->attachStream(&fs))
+	{
+		AudioFilterManager::closeFilter(filter);
+		return false;
+	}
+
+	BenchClip *clip = list.increment();
+	clip->name = fileName;
+	clip->synthetic = -1;
+	clip->format = filter->getChannelFormat();
+	clip->rate = filter->getSamplingRate();
+	clip->size = filter->getStreamSize();
+	clip->data = new U8[clip->size ? clip->size : 1];
+	bool ok = filter->read(clip->size, clip->data);
+
+	filter->detachStream();
+	fs.close();
+	AudioFilterManager::closeFilter(filter);
+	if (!ok)
+	{
+		delete [] clip->data;
+		list.pop_back();
+	}
+	return ok;
+}
+
+/// Gets a clip as PCM in the given format and rate
+static bool getClipPCM(const BenchClip &clip, U8 format, U32 rate, U32 seconds, Vector<U8> &out)
+{
+	if (clip.synthetic >= 0)
+	{
+		makeSyntheticPCM(clip.synthetic, format, rate, seconds, out);
+		return true;
+	}
+
+	if (clip.format == format && clip.rate == rate)
+	{
+		out.setSize(clip.size);
+		dMemcpy(out.address(), clip.data, clip.size);
+		return true;
+	}
+
+	// Convert the decoded file
+	MemStream stream(clip.size, clip.data, true, false);
+	RawFilter raw;
+	raw.attachStream(&stream);
+	raw.setChannelFormat(clip.format);
+	raw.setSamplingRate(clip.rate);
+
+	AudioConvertFilter convert(format, rate);
+	if (!convert.attachStream(&raw))
+		return false;
+	out.setSize(convert.getStreamSize());
+	bool ok = convert.read(out.size(), out.address());
+	convert.detachStream();
+	raw.detachStream();
+	return ok;
+}
+
+/// High resolution clock (wraps around, so only use differences)
+static U32 getMicroseconds()
+{
+	// Short clips encode and seek in well under a millisecond, which Platform::getRealMilliseconds() would count as nothing at all
+#if defined(TORQUE_OS_WIN32)
+	static LARGE_INTEGER freq = {0};
+	LARGE_INTEGER count;
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return U32((count.QuadPart / freq.QuadPart) * 1000000 + ((count.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart);
+#elif defined(TORQUE_OS_LINUX) || defined(TORQUE_OS_MAC_OSX)
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return U32(tv.tv_sec) * 1000000 + U32(tv.tv_usec);
+#else
+	return Platform::getRealMilliseconds() * 1000;
+#endif
+}
+
+static F64 toSpeed(F64 length, U32 us)
+{
+	// Anything under the timer resolution is counted as 1us
+	return length / ((F64)(us ? us : 1) / 1000000.0);
+}
+
+/// Finds the closest format and rate the filter will encode
+static bool negotiateFormat(FilterInfo *info, U32 wantRate, U8 *store, U32 storeSize, U8 &format, U32 &rate)
+{
+	static const U8 formats[] = {AudioFilter::CHANNEL_STEREO_16, AudioFilter::CHANNEL_MONO_16};
+
+	MemStream stream(storeSize, store, false, true);
+	AudioFilter *enc = AudioFilterManager::createFilter(info, AudioFilterManager::AudioWrite);
+	if (!enc)
+		return false;
+	if (!enc->attachStream(&stream))
+	{
+		AudioFilterManager::closeFilter(enc);
+		return false;
+	}
+
+	bool found = false;
+	for (U32 i=0; i<sizeof(formats)/sizeof(formats[0]); i++)
+	{
+		if (enc->setChannelFormat(formats[i]))
+		{
+			format = formats[i];
+			found = true;
+			break;
+		}
+	}
+	enc->setSamplingRate(wantRate);
+	rate = enc->getSamplingRate();
+
+	enc->detachStream();
+	AudioFilterManager::closeFilter(enc);
+	return found && rate != 0;
+}
+
+static void runBench(FilterInfo *info, Vector<U8> &pcm, U8 format, U32 rate, U8 quality, F32 vbrQuality,
+                     U32 chunk, U32 iterations, BenchResult &res)
+{
+	U32 storeSize = pcm.size() + pcm.size() / 2 + 65536;
+	U8 *store = new U8[storeSize];
+	U8 *check = new U8[pcm.size() ? pcm.size() : 1];
+	U32 frameSize = getFormatSize(format);
+	F64 length = (F64)(pcm.size() / frameSize) / (F64)rate;
+	U32 bestEncode = 0xFFFFFFFF;
+	U32 bestDecode = 0xFFFFFFFF;
+	U32 bestSeek = 0xFFFFFFFF;
+
+	res.ok = true;
+	res.encodedSize = 0;
+	res.allocsPerFrame = -1;
+	res.seekTime = -1;
+
+	for (U32 iter=0; iter<iterations && res.ok; iter++)
+	{
+		// Encode
+		MemStream out(storeSize, store, false, true);
+		U32 start = getMicroseconds();
+		AudioFilter *enc = AudioFilterManager::createFilter(info, AudioFilterManager::AudioWrite);
+		if (!enc || !enc->attachStream(&out)) {
+			if (enc) AudioFilterManager::closeFilter(enc);
+			res.ok = false;
+			break;
+		}
+		enc->setChannelFormat(format);
+		enc->setSize(pcm.size());
+		enc->setQuality(quality);
+		enc->setVBRQuality(vbrQuality);
+		enc->setSamplingRate(rate);
+		enc->writeHeader();
+		for (U32 pos=0; pos<pcm.size(); pos+=chunk)
+		{
+			U32 toWrite = pcm.size() - pos > chunk ? chunk : pcm.size() - pos;
+			if (!enc->write(toWrite, pcm.address() + pos)) {
+				res.ok = false;
+				break;
+			}
+		}
+		enc->detachStream(); // Encoders finish off the stream here
+		AudioFilterManager::closeFilter(enc);
+		U32 time = getMicroseconds() - start;
+		if (time < bestEncode) bestEncode = time;
+		res.encodedSize = out.getPosition();
+		if (!res.ok)
+			break;
+
+		// Decode
+		MemStream in(res.encodedSize, store, true, false);
+#ifdef BENCH_COUNT_ALLOCS
+		U32 allocStart = 0;
+#endif
+		U32 frames = 0;
+		start = getMicroseconds();
+		AudioFilter *dec = AudioFilterManager::createFilter(info, AudioFilterManager::AudioRead);
+		if (!dec) {
+			res.ok = false;
+			break;
+		}
+		if (!dec->attachStream(&in))
+			res.ok = false;
+		else
+		{
+			// Raw audio has no header to say what it is
+			if (dec->getChannelFormat() != format)
+				dec->setChannelFormat(format);
+			if (dec->getSamplingRate() != rate)
+				dec->setSamplingRate(rate);
+
+			U32 decodedSize = dec->getStreamSize();
+			if (decodedSize != pcm.size())
+				res.ok = false;
+			for (U32 pos=0; pos<decodedSize && res.ok; pos+=chunk)
+			{
+				U32 toRead = decodedSize - pos > chunk ? chunk : decodedSize - pos;
+				if (!dec->read(toRead, check + pos))
+					res.ok = false;
+				frames++;
+#ifdef BENCH_COUNT_ALLOCS
+				// Setting up the decoder (attachStream(), and buffers made by the first read()) isn't counted
+				if (frames == 1)
+					allocStart = gNumAllocs;
+#endif
+			}
+		}
+		time = getMicroseconds() - start;
+		if (time < bestDecode) bestDecode = time;
+#ifdef BENCH_COUNT_ALLOCS
+		if (frames > 1)
+			res.allocsPerFrame = (F64)(gNumAllocs - allocStart) / (F64)(frames - 1);
+#endif
+
+		// Lossless filters should give back exactly what they were given
+		if (res.ok && !dStricmp(info->name, "RAW"))
+			res.ok = dMemcmp(check, pcm.address(), pcm.size()) == 0;
+
+		// Seek to random samples, reading a frame from each
+		if (res.ok && dec->hasAudioCapability(AudioFilter::AudioSeek) && pcm.size() > chunk)
+		{
+			U32 seekSamples = (pcm.size() - chunk) / frameSize;
+			start = getMicroseconds();
+			for (U32 s=0; s<BENCH_SEEKS; s++)
+			{
+				// Seeks should land on the exact sample asked for
+				U32 sample = benchRand() % seekSamples;
+				if (!dec->seekSample(sample) || dec->getSample() != sample || !dec->read(chunk, check)) {
+					res.ok = false;
+					break;
+				}
+			}
+			time = getMicroseconds() - start;
+			if (time < bestSeek) bestSeek = time;
+			res.seekTime = ((F64)bestSeek / 1000.0) / BENCH_SEEKS;
+		}
+
+		dec->detachStream();
+		AudioFilterManager::closeFilter(dec);
+	}
+
+	res.encodeSpeed = toSpeed(length, bestEncode);
+	res.decodeSpeed = toSpeed(length, bestDecode);
+	res.decodeRate = toSpeed((F64)pcm.size() / (1024.0 * 1024.0), bestDecode);
+	delete [] store;
+	delete [] check;
+}
+
+S32 AudioBenchGame::main(int argc, const char** argv)
+{
+   // Set the memory manager page size to 64 megs...
+   setMinimumAllocUnit(64 << 20);
+
+   if(!initLibraries())
+      return 0;
+
+   const char *gOutputFile = NULL;
+   const char *gFilterName = NULL;
+   U32 gIterations = 3;
+   U32 gLength = 10;
+   U32 gRate = 0;
+   U32 gQualityStep = 4;
+   F32 gVBRQuality = -2;
+   U32 gChunkSize = 4096;
+   bool gHelp = false;
+
+   // Parse command line args...
+   S32 i = 1;
+   for (; i < argc; i++) {
+      if (argv[i][0] != '-')
+         break;
+      switch(dToupper(argv[i][1])) {
+         case 'O':
+            gOutputFile = argv[++i];
+            break;
+         case 'F':
+            gFilterName = argv[++i];
+            break;
+         case 'N':
+            gIterations = dAtoi(argv[++i]);
+            break;
+         case 'L':
+            gLength = dAtoi(argv[++i]);
+            break;
+         case 'R':
+            gRate = dAtoi(argv[++i]);
+            break;
+         case 'Q':
+            gQualityStep = dAtoi(argv[++i]);
+            break;
+         case 'V':
+            gVBRQuality = dAtof(argv[++i]);
+            break;
+         case 'B':
+            gChunkSize = dAtoi(argv[++i]);
+            break;
+         default:
+            gHelp = true;
+            break;
+      }
+   }
+
+   if (gHelp || gIterations == 0 || gLength == 0 || gQualityStep == 0 || gChunkSize == 0) {
+      dPrintf("\naudiobench - AudioFilter benchmark\n"
+              "  Program version: %s\n\n"
+              "Usage: audiobench [-o <file>.csv] [-f <filter>] [-n <iterations>] [-l <seconds>] [-r <rate>] [-q <step>] [-v <vbr quality>] [-b <frame size>] [files...]\n"
+			  "        -o : write results to file, rather than the console\n"
+			  "        -f : only benchmark this filter (e.g. SPEEX)\n"
+			  "        -n : number of runs of each test; the fastest is reported (default 3)\n"
+			  "        -l : length of synthetic clips in seconds (default 10)\n"
+			  "        -r : only use this sampling rate\n"
+			  "        -q : step between the quality levels tried (default 4)\n"
+			  "        -v : only use this VBR quality (default tries -1 (off) and 0.5)\n"
+			  "        -b : bytes passed to each read() & write() (default 4096)\n"
+			  "  files... : extra clips to benchmark (e.g. real assets), at their own rate\n\n", gProgramVersion);
+      Vector<FilterInfo*> *filters = AudioFilterManager::getFilterList();
+      dPrintf("Filters available :");
+      for (U32 f=0; f<filters->size(); f++)
+         dPrintf(" %s", (*filters)[f]->name);
+      dPrintf("\n");
+      shutdownLibraries();
+      return 1;
+   }
+
+   // Clips
+   Vector<BenchClip> clipList;
+   for (U32 s=0; s<sizeof(gSyntheticNames)/sizeof(gSyntheticNames[0]); s++)
+   {
+      BenchClip *clip = clipList.increment();
+      clip->name = gSyntheticNames[s];
+      clip->synthetic = s;
+      clip->format = AudioFilter::CHANNEL_UNKNOWN;
+      clip->rate = 0;
+      clip->data = NULL;
+      clip->size = 0;
+   }
+   for (; i < argc; i++)
+   {
+      if (!loadFileClip(clipList, argv[i]))
+         dPrintf("Warning: could not decode '%s', skipping\n", argv[i]);
+   }
+
+   Vector<U32> rates;
+   if (gRate)
+      rates.push_back(gRate);
+   else
+   {
+      rates.push_back(8000);
+      rates.push_back(16000);
+      rates.push_back(22050);
+      rates.push_back(44100);
+      rates.push_back(48000);
+   }
+
+   Vector<F32> vbrQualities;
+   if (gVBRQuality >= -1)
+      vbrQualities.push_back(gVBRQuality);
+   else
+   {
+      vbrQualities.push_back(-1);
+      vbrQualities.push_back(0.5);
+   }
+
+   FileStream out;
+   if (gOutputFile && !out.open(gOutputFile, FileStream::Write))
+   {
+      dPrintf("Error: could not open output file '%s'!\n", gOutputFile);
+      shutdownLibraries();
+      return 1;
+   }
+
+   char line[1024];
+   dSprintf(line, sizeof(line), "filter,clip,rate,channels,quality,vbr,pcm_size,encoded_size,kbps,encode_xrt,decode_xrt,decode_mbs,allocs_per_frame,seek_ms,ok\n");
+   if (gOutputFile) out.write(dStrlen(line), line);
+   else dPrintf("%s", line);
+
+   S32 failures = 0;
+   Vector<FilterInfo*> *filters = AudioFilterManager::getFilterList();
+   Vector<U8> pcm;
+   U8 probe[4096];
+   for (U32 f=0; f<filters->size(); f++)
+   {
+      FilterInfo *info = (*filters)[f];
+      if (gFilterName && dStricmp(gFilterName, info->name))
+         continue;
+      if (!(info->audioCapability & AudioFilter::AudioEncode))
+      {
+         dPrintf("Warning: filter %s can't encode, skipping\n", info->name);
+         continue;
+      }
+
+      for (U32 c=0; c<clipList.size(); c++)
+      {
+         const BenchClip &clip = clipList[c];
+         Vector<U32> doneRates; // Filters may round rates, so the same one can come up more than once
+
+         for (U32 r=0; r<rates.size(); r++)
+         {
+            U8 format;
+            U32 rate;
+            U32 wantRate = (clip.synthetic < 0 && !gRate) ? clip.rate : rates[r];
+            if (!negotiateFormat(info, wantRate, probe, sizeof(probe), format, rate))
+            {
+               dPrintf("Error: filter %s would not take 16bit audio at %dHz\n", info->name, wantRate);
+               failures++;
+               break;
+            }
+
+            bool done = false;
+            for (U32 d=0; d<doneRates.size(); d++)
+               done |= doneRates[d] == rate;
+            if (done)
+               continue;
+            doneRates.push_back(rate);
+
+            if (!getClipPCM(clip, format, rate, gLength, pcm))
+            {
+               dPrintf("Error: could not convert %s to %dHz\n", clip.name, rate);
+               failures++;
+               continue;
+            }
+
+            // Quality levels 0, step, 2*step ... and the highest
+            U32 levels = info->qualityLevels ? info->qualityLevels : 1;
+            for (U32 q=0; q<levels; q = (q + gQualityStep >= levels && q != levels-1) ? levels-1 : q + gQualityStep)
+            {
+               for (U32 v=0; v<vbrQualities.size(); v++)
+               {
+                  if (levels == 1 && v != 0)
+                     break; // Nothing to vary
+
+                  BenchResult res;
+                  runBench(info, pcm, format, rate, q, vbrQualities[v], gChunkSize, gIterations, res);
+                  if (!res.ok)
+                     failures++;
+
+                  F64 length = (F64)(pcm.size() / getFormatSize(format)) / (F64)rate;
+                  dSprintf(line, sizeof(line), "%s,%s,%d,%d,%d,%g,%d,%d,%.1f,%.2f,%.2f,%.2f,%.2f,%.3f,%d\n",
+                           info->name,
+                           clip.name,
+                           rate,
+                           getFormatChannels(format),
+                           q,
+                           vbrQualities[v],
+                           pcm.size(),
+                           res.encodedSize,
+                           length > 0 ? (res.encodedSize * 8.0) / (length * 1000.0) : 0.0,
+                           res.encodeSpeed,
+                           res.decodeSpeed,
+                           res.decodeRate,
+                           res.allocsPerFrame,
+                           res.seekTime,
+                           res.ok ? 1 : 0);
+                  if (gOutputFile) out.write(dStrlen(line), line);
+                  else dPrintf("%s", line);
+               }
+            }
+
+            // Files are only run at their own rate, unless asked otherwise
+            if (clip.synthetic < 0 && !gRate)
+               break;
+         }
+      }
+   }
+
+   if (gOutputFile)
+      out.close();
+   for (U32 c=0; c<clipList.size(); c++)
+      delete [] clipList[c].data;
+
+   if (failures)
+      dPrintf("Error: %d tests failed to encode or decode!\n", failures);
+
+   shutdownLibraries();
+   return failures ? 1 : 0;
+}
+
+void GameReactivate()
+{
+
+}
+
+void GameDeactivate( bool )
+{
+
+}
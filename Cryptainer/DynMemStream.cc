@@ -43,9 +43,9 @@ bool DynMemStream::_write(const U32 in_numBytes, const void *in_pBuffer)
 
    bool success     = true;
    if ((m_currentPosition + in_numBytes) > cm_bufferSize) {
-      // TODO: could be a bit more accurate...
+      // Grow by enough blocks to fit the new data
       U32 newSize = (((m_currentPosition + in_numBytes) - cm_bufferSize) / m_blockSize)+1;
-      newSize *= m_blockSize;
+      newSize = cm_bufferSize + (newSize * m_blockSize);
       m_pBufferBase = dRealloc((U8*)m_pBufferBase, newSize);
       AssertFatal(m_pBufferBase, "Failed to reallocate buffer!");
       cm_bufferSize = newSize;
@@ -58,7 +58,7 @@ bool DynMemStream::_write(const U32 in_numBytes, const void *in_pBuffer)
    // Advance the stream position
    m_currentPosition += in_numBytes;
    if (m_currentPosition > m_writSize)
-      m_writSize += in_numBytes;
+      m_writSize = m_currentPosition;
 
    if (m_currentPosition == cm_bufferSize)
    //setStatus(EOS);
@@ -8,6 +8,10 @@
 #include "core/filterState.h"
 
 FilterState *FilterState::mRoot = NULL;
+U32 FilterState::smNumCreated = 0;
+U32 FilterState::smNumReused = 0;
+U32 FilterState::smDecodeThreads = 1;
+void *FilterState::smPoolMutex = NULL;
 
 static const char *FilterStateString[] = {
 		"basic",
@@ -122,6 +126,10 @@ U32 FilterState::fromString(const char *name, bool write)
 
 void FilterState::registerHandler(FilterState *aHandler)
 {
+	// Handlers are registered by static constructors, before any other threads are about
+	if (!smPoolMutex)
+		smPoolMutex = Mutex::createMutex();
+
 	aHandler->mNext = mRoot;
 	mRoot = aHandler;
 }
@@ -139,6 +147,76 @@ FilterState *FilterState::findHandler(U32 aTag)
 	return NULL;
 }
 
+// Pooling
+//------------------------------------------------------------------------------
+FilterState *FilterState::acquire(U32 flags)
+{
+	FilterState *state = NULL;
+
+	Mutex::lockMutex(smPoolMutex);
+	for (FilterState **walker = &mPool; *walker; walker = &(*walker)->mPoolNext)
+	{
+		if ((*walker)->mPoolFlags == flags) {
+			state = *walker;
+			*walker = state->mPoolNext;
+			mPoolCount--;
+			smNumReused++;
+			break;
+		}
+	}
+	Mutex::unlockMutex(smPoolMutex);
+
+	if (state) {
+		state->mPoolNext = NULL;
+		return state;
+	}
+
+	state = init(flags);
+	state->mHandler = this;
+	state->mPoolFlags = flags;
+	return state;
+}
+
+void FilterState::release(FilterState *state)
+{
+	if (!state)
+		return;
+
+	FilterState *handler = state->mHandler;
+	if (handler)
+	{
+		state->recycle();
+
+		Mutex::lockMutex(smPoolMutex);
+		if (handler->mPoolCount < FILTERSTATE_POOL_SIZE) {
+			state->mPoolNext = handler->mPool;
+			handler->mPool = state;
+			handler->mPoolCount++;
+			state = NULL;
+		}
+		Mutex::unlockMutex(smPoolMutex);
+	}
+
+	if (state)
+		delete state;
+}
+
+void FilterState::flushPools()
+{
+	Mutex::lockMutex(smPoolMutex);
+	for (FilterState *handler = mRoot; handler; handler = handler->mNext)
+	{
+		while (handler->mPool) {
+			FilterState *state = handler->mPool;
+			handler->mPool = state->mPoolNext;
+			delete state;
+		}
+		handler->mPoolCount = 0;
+		handler->flushCaches();
+	}
+	Mutex::unlockMutex(smPoolMutex);
+}
+
 // Various useful ConsoleFunction's
 //------------------------------------------------------------------------------
 
@@ -147,6 +225,22 @@ ConsoleFunction(dumpCompressionHandlers, void, 1, 1, "Print a list of compressio
 	FilterState::printHandlers();
 }
 
+ConsoleFunction(flushFilterPools, void, 1, 1, "Frees idle compression and encryption states, and other memory kept for reuse")
+{
+	FilterState::flushPools();
+}
+
+ConsoleFunction(setFilterDecodeThreads, void, 2, 2, "(threads) Most threads used to decode a single large entry (1 decodes on the calling thread only)")
+{
+	S32 threads = dAtoi(argv[1]);
+	FilterState::smDecodeThreads = threads < 1 ? 1 : threads;
+}
+
+ConsoleFunction(getFilterDecodeThreads, S32, 1, 1, "Returns the most threads used to decode a single large entry")
+{
+	return FilterState::smDecodeThreads;
+}
+
 #ifdef TORQUE_DEBUG
 #include "core/resManager.h"
 ConsoleFunction(testFilterState, void, 1, 1, "Tests filter state code")
@@ -10,10 +10,15 @@
 #include "platform/platform.h"
 #endif
 
+#ifndef _PLATFORMMUTEX_H_
+#include "platform/platformMutex.h"
+#endif
+
 #include "core/hash.h"
 
 #define BLOCKREAD_SIZE 4096
 #define BLOCKWRITE_SIZE 2048 * 1024
+#define FILTERSTATE_POOL_SIZE 8 // Number of idle instances each handler keeps around for acquire()
 
 #define NO_BLOCKSIZE
 
@@ -44,6 +49,9 @@
 ///
 /// @warning FilterState does not take into account endian issues with the input data.
 ///
+/// Rather than init() and delete, ResFilter uses acquire() and release(), which keep a few idle instances per handler around for reuse.
+/// Instances go back to the pool via recycle(), which by default calls reset().
+///
 /// Adding a FilterState is relatively easy, as they are linked together by a static linked list, which is initialized at runtime via static constructors on each FilterState derivative.
 /// @see BasicState for an example of a basic FilterState.
 class FilterState
@@ -80,12 +88,23 @@ public:
 	static const char *toString(U32 flags);
 	static U32         fromString(const char *name, bool write);
 
-	FilterState(){;}
-	FilterState(U32 flags){mFlags = flags;}
+	FilterState(){mPool = NULL; mPoolCount = 0; mHandler = NULL; mPoolNext = NULL; mPoolFlags = 0; smNumCreated++;}
+	FilterState(U32 flags){mFlags = flags; mPool = NULL; mPoolCount = 0; mHandler = NULL; mPoolNext = NULL; mPoolFlags = 0; smNumCreated++;}
 	virtual ~FilterState(){;}
 
 	virtual FilterState *init(U32 flags) {return new FilterState(flags);}
 
+	/// @name Pooling
+	/// @{
+	FilterState *acquire(U32 flags);				///< As init(), but reuses an idle instance created with the same flags if there is one
+	static void release(FilterState *state);	///< Hands state from acquire() back to its handler (deleting it if the pool is full)
+	static void flushPools();						///< Deletes every idle instance
+	virtual void recycle() {reset();}			///< Called as an instance goes back to the pool. Should leave it as init() would
+	virtual void flushCaches() {;}				///< Called on each handler by flushPools(), to free any other memory kept for reuse
+	/// @}
+
+	virtual void setThreads(U32 threads) {;}	///< Lets a write state compress on several threads, where it can
+
 	/// @name Quick reference
 	/// @{
 	virtual U32 dataIn(){return 0;}							///< Data left to read in
@@ -105,6 +124,16 @@ protected:
 	const char *mInfoString;	///< Description of filter
 	/// @}
 
+	/// @name Pooling variables
+	/// @{
+	static void *smPoolMutex;	///< Guards the pools of every handler
+	FilterState *mPool;			///< Idle instances (handlers only)
+	U32 mPoolCount;				///< Number of idle instances (handlers only)
+	FilterState *mHandler;		///< Handler that created us (NULL if we didn't come from acquire())
+	FilterState *mPoolNext;		///< Next idle instance in our handler's pool
+	U32 mPoolFlags;				///< Flags passed to init() when we were created
+	/// @}
+
 public:
 	/// @name Static handler functions
 	/// These are used to manage or search the list of filter handlers
@@ -112,8 +141,16 @@ public:
 	static void registerHandler(FilterState *aHandler);	///< Adds handler to linked list of handlers
 	static FilterState *findHandler(U32 aTag);				///< Finds handler that matches bits with supplied tag
 	static void printHandlers();									///< Prints a list of handlers to the console
+
+	static FilterState *getFirstHandler() {return mRoot;}	///< First handler in the linked list
+	FilterState *getNextHandler() {return mNext;}			///< Next handler in the linked list
+	U32 getTag() {return mTag;}									///< Flags this handler implements
+	const char *getName() {return mShortName;}				///< Short name of handler
 	/// @}
 
+	static U32 smNumCreated;	///< Number of FilterState's constructed so far (for profiling)
+	static U32 smNumReused;		///< Number of times acquire() found an idle instance (for profiling)
+
 	/// @name Compression / Decompression routines
 	/// @{
 	/// Override these in derivative classes
@@ -121,6 +158,17 @@ public:
 	virtual bool reverseProcess() {return false;}	///< The same as process, but the routine goes in reverse
 	virtual void reset() {;}				///< Causes filter to read in headers / write out headers again (on next *Process)
 	virtual bool end() {return true;}	///< Tells the filter to dump out any remaining data, including any EOS markers (used by compressors)
+	virtual bool hasFailed() {return false;}	///< Has process() or end() failed for good? (they also return false when they need more input or output)
+	/// @}
+
+	/// @name Whole buffer decoding
+	///
+	/// Some formats decode faster when all of the stored data is available up front (e.g. by splitting the work between threads).
+	/// These are called on the handler itself, rather than on an instance from init().
+	/// @{
+	virtual bool canDecodeBuffer(U32 outSize) {return false;}	///< Is decodeBuffer() worth using for outSize bytes of output?
+	virtual bool decodeBuffer(const U8 *in, U32 inSize, U8 *out, U32 outSize) {return false;}	///< Decodes a complete stream. Returns false if the caller should use reverseProcess() instead
+	static U32 smDecodeThreads;	///< Most threads decodeBuffer() may use (1, the default, turns parallel decoding off)
 	/// @}
 
 	 /// @name Encryption functions
@@ -22,12 +22,21 @@ private:
 	S32 id;		///< TomCrypt Hash ID
 	S32 size;	///< TomCrypt Hash Size
 	U8 *data;	///< TomCrupt Hash Data
+	void *state;	///< TomCrypt Hash State (whilst hashing data)
 
 public:
 
 	CryptHash(const char *hashName);	///< Constructor. Must provide hash name
 	bool hash(const char *aKey);		///< Creates a hash based on aKey
 
+	/// @name Hashing arbitrary data
+	/// Used to hash data in chunks, e.g. for content hashing. The result ends up in getData().
+	/// @{
+	bool hashBegin();								///< Starts a new hash
+	bool hashData(const U8 *ptr, U32 len);	///< Adds data to the hash
+	bool hashEnd();								///< Finishes the hash
+	/// @}
+
 	/// @name get/set hash data
 	/// @{
 	U8 *getData() {return data;}		///< Obtain a pointer
@@ -45,6 +54,10 @@ class CryptHash
 	CryptHash(const char *hashName) {;}
 	bool hash(const char *aKey) {return false;};
 
+	bool hashBegin() {return false;}
+	bool hashData(const U8 *ptr, U32 len) {return false;}
+	bool hashEnd() {return false;}
+
 	U8 *getData() {return NULL;}
 	void setData(U8 *ptr) {;}
 
@@ -0,0 +1,428 @@
+//-----------------------------------------------------------------------------
+// (C) 2004 - 2006, Stuart James Urquhart (jamesu@gmail.com). All Rights Reserved.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "console/console.h"
+#include "core/memstream.h"
+#include "core/resContainer.h"
+#include "core/resBatchRead.h"
+
+#if defined(TORQUE_OS_LINUX) && defined(TORQUE_USE_IO_URING)
+#include <liburing.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+ResBatchRead::ResBatchRead(ResContainer *container)
+{
+	mContainer = container;
+	mCallback = NULL;
+	mUserData = NULL;
+}
+
+ResBatchRead::~ResBatchRead()
+{
+	clear();
+}
+
+//------------------------------------------------------------------------------
+void ResBatchRead::clear()
+{
+	for (Vector<Entry>::iterator itr = mEntries.begin(); itr != mEntries.end(); itr++)
+	{
+		if (itr->compressed) dFree(itr->compressed);
+		if (itr->data) dFree(itr->data);
+	}
+	mEntries.clear();
+}
+
+//------------------------------------------------------------------------------
+bool ResBatchRead::add(const char *filename)
+{
+	const char *name = dStrrchr(filename, '/');
+	if (!name) name = filename;
+	else name++;
+
+	char path[DIRECTORY_SIZE];
+	U32 len = name - filename;
+	path[0] = '\0';
+	if (len != 0) {
+		if (len > DIRECTORY_SIZE) len = DIRECTORY_SIZE;
+		dStrncpy(path, filename, len);
+		path[len-1] = '\0';
+	}
+
+	ResContainer *owner = mContainer;
+	DirectoryEntry::iterator file = mContainer->getFile(path, name, &owner);
+	if (!file)
+		return false;
+
+	Entry &entry = *(mEntries.increment());
+	entry.name = StringTable->insert(filename);
+	entry.owner = owner;
+	entry.fileOffset = file->fileOffset;
+	entry.compressedSize = file->compressedSize;
+	entry.decompressedSize = file->decompressedSize;
+	entry.flags = file->flags;
+	entry.compressed = NULL;
+	entry.readSize = 0;
+	entry.data = NULL;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+bool ResBatchRead::decodeEntry(Entry &entry)
+{
+	// Same check as ResContainer::getFileStream()
+	if ((entry.flags & FilterState::ENCRYPT_ALL) && (entry.owner->getHash() == NULL))
+		return false;
+
+	entry.data = (U8*)dMalloc(entry.decompressedSize ? entry.decompressedSize : 1);
+	if (entry.decompressedSize == 0)
+		return true;
+
+	if (ResFilter::canDecodeBuffer(entry.flags, entry.decompressedSize) &&
+	    ResFilter::decodeBuffer(entry.flags, entry.compressed, entry.compressedSize, entry.data, entry.decompressedSize))
+		return true;
+
+	MemStream mem(entry.compressedSize, entry.compressed, true, false);
+	ResFilter *filter = ResContainer::getFilter(entry.flags);
+	filter->attachStream(&mem, false);
+	if (entry.owner->getHash()) filter->setHash(entry.owner->getHash());
+	filter->setStreamOffset(0, entry.decompressedSize);
+
+	bool success = filter->read(entry.decompressedSize, entry.data);
+	delete filter;
+
+	if (!success) {
+		dFree(entry.data);
+		entry.data = NULL;
+	}
+	return success;
+}
+
+void ResBatchRead::finishEntry(U32 idx)
+{
+	Entry &entry = mEntries[idx];
+	if (!decodeEntry(entry))
+		Con::errorf("ResBatchRead : could not decode '%s'", entry.name);
+
+	dFree(entry.compressed);
+	entry.compressed = NULL;
+
+	if (mCallback && entry.data)
+		mCallback(idx, entry.name, entry.data, entry.decompressedSize, mUserData);
+}
+
+//------------------------------------------------------------------------------
+Vector<ResBatchRead::Entry> *ResBatchRead::smSortEntries = NULL;
+#if defined(TORQUE_OS_LINUX) && defined(TORQUE_USE_IO_URING)
+bool ResBatchRead::smUringNoRead = false;
+#endif
+
+S32 QSORT_CALLBACK ResBatchRead::compareEntryOffset(const void *a, const void *b)
+{
+	const Entry &ea = (*smSortEntries)[*(const U32*)a];
+	const Entry &eb = (*smSortEntries)[*(const U32*)b];
+	if (ea.owner != eb.owner)
+		return ea.owner < eb.owner ? -1 : 1;
+	if (ea.fileOffset != eb.fileOffset)
+		return ea.fileOffset < eb.fileOffset ? -1 : 1;
+	return 0;
+}
+
+U32 ResBatchRead::read()
+{
+	// Anything left over from a previous read() is done again
+	Vector<U32> order;
+	Vector<U32> solid;
+	for (U32 i=0; i<mEntries.size(); i++)
+	{
+		Entry &entry = mEntries[i];
+		if (entry.data) { dFree(entry.data); entry.data = NULL; }
+		entry.readSize = 0;
+		if (entry.flags & DirectoryEntry::FILE_SOLID)
+		{
+			solid.push_back(i);
+			continue;
+		}
+		if (!entry.compressed) entry.compressed = (U8*)dMalloc(entry.compressedSize ? entry.compressedSize : 1);
+		order.push_back(i);
+	}
+
+	// Files in solid blocks come out of their container's block cache
+	U32 numSolid = readSolid(solid);
+
+	// Read in file order, so sequential reads don't keep jumping backwards
+	smSortEntries = &mEntries;
+	dQsort(order.address(), order.size(), sizeof(U32), compareEntryOffset);
+	smSortEntries = NULL;
+
+#if defined(TORQUE_OS_LINUX) && defined(TORQUE_USE_IO_URING)
+	if (!smUringNoRead)
+		return numSolid + readUring(order);
+#endif
+	return numSolid + readSequential(order);
+}
+
+//------------------------------------------------------------------------------
+U32 ResBatchRead::readSolid(Vector<U32> &solid)
+{
+	U32 numRead = 0;
+	ResContainer *owner = NULL;
+	Stream *strm = NULL;
+
+	for (Vector<U32>::iterator itr = solid.begin(); itr != solid.end(); itr++)
+	{
+		Entry &entry = mEntries[*itr];
+		if (entry.owner != owner)
+		{
+			if (strm) ResourceManager->closeStream(strm);
+			owner = entry.owner;
+			strm = owner->mSourceResource ? ResourceManager->openStream(owner->mSourceResource) : NULL;
+		}
+		if (!strm)
+		{
+			Con::errorf("ResBatchRead : could not open container for '%s'", entry.name);
+			continue;
+		}
+
+		DirectoryEntry::FileInfo info;
+		info.compressedSize = entry.compressedSize;
+		info.decompressedSize = entry.decompressedSize;
+		info.fileOffset = entry.fileOffset;
+		info.flags = entry.flags;
+
+		entry.data = (U8*)dMalloc(entry.decompressedSize ? entry.decompressedSize : 1);
+		if (!owner->readFileData(*strm, info, entry.data))
+		{
+			Con::errorf("ResBatchRead : could not decode '%s'", entry.name);
+			dFree(entry.data);
+			entry.data = NULL;
+			continue;
+		}
+
+		numRead++;
+		if (mCallback)
+			mCallback(*itr, entry.name, entry.data, entry.decompressedSize, mUserData);
+	}
+
+	if (strm) ResourceManager->closeStream(strm);
+	return numRead;
+}
+
+//------------------------------------------------------------------------------
+U32 ResBatchRead::readSequential(Vector<U32> &order)
+{
+	U32 numRead = 0;
+	ResContainer *owner = NULL;
+	Stream *strm = NULL;
+
+	for (Vector<U32>::iterator itr = order.begin(); itr != order.end(); itr++)
+	{
+		Entry &entry = mEntries[*itr];
+
+		// Entries are sorted by container, so each stream is only opened once
+		if (entry.owner != owner)
+		{
+			if (strm) ResourceManager->closeStream(strm);
+			owner = entry.owner;
+			strm = owner->mSourceResource ? ResourceManager->openStream(owner->mSourceResource) : NULL;
+			if (!strm)
+				Con::errorf("ResBatchRead : could not open container for '%s'", entry.name);
+		}
+
+		if (strm && entry.compressedSize != 0)
+		{
+			if (!strm->setPosition(entry.fileOffset) || !strm->read(entry.compressedSize, entry.compressed)) {
+				Con::errorf("ResBatchRead : could not read '%s'", entry.name);
+				dFree(entry.compressed);
+				entry.compressed = NULL;
+				continue;
+			}
+			entry.readSize = entry.compressedSize;
+		}
+		else if (!strm)
+		{
+			dFree(entry.compressed);
+			entry.compressed = NULL;
+			continue;
+		}
+
+		finishEntry(*itr);
+		if (entry.data) numRead++;
+	}
+
+	if (strm) ResourceManager->closeStream(strm);
+	return numRead;
+}
+
+#if defined(TORQUE_OS_LINUX) && defined(TORQUE_USE_IO_URING)
+//------------------------------------------------------------------------------
+U32 ResBatchRead::readUring(Vector<U32> &order)
+{
+	struct io_uring ring;
+	if (io_uring_queue_init(QUEUE_DEPTH, &ring, 0) < 0)
+	{
+		// Kernel without io_uring support
+		return readSequential(order);
+	}
+
+	// Open a descriptor for each container in the batch. Containers we can't open directly
+	// (e.g. ones which aren't plain files on disk) go through readSequential() instead.
+	Vector<ResContainer*> owners;
+	Vector<int> fds;
+	Vector<int> entryFds;
+	Vector<U32> pending;
+	Vector<U32> fallback;
+	entryFds.setSize(mEntries.size());
+
+	for (Vector<U32>::iterator itr = order.begin(); itr != order.end(); itr++)
+	{
+		Entry &entry = mEntries[*itr];
+		S32 ownerIdx = -1;
+		for (U32 i=0; i<owners.size(); i++) {
+			if (owners[i] == entry.owner) { ownerIdx = i; break; }
+		}
+
+		if (ownerIdx == -1)
+		{
+			int fd = -1;
+			ResourceObject *res = entry.owner->mSourceResource;
+			if (res && res->zipPath == NULL)
+			{
+				char fullPath[1024];
+				dSprintf(fullPath, sizeof(fullPath), "%s/%s", res->path, res->name);
+				fd = ::open(fullPath, O_RDONLY);
+			}
+			ownerIdx = owners.size();
+			owners.push_back(entry.owner);
+			fds.push_back(fd);
+		}
+
+		entryFds[*itr] = fds[ownerIdx];
+		if (fds[ownerIdx] < 0)
+			fallback.push_back(*itr);
+		else if (entry.compressedSize == 0)
+			finishEntry(*itr);
+		else
+			pending.push_back(*itr);
+	}
+
+	// Keep the queue full, decoding each file as soon as its data arrives
+	U32 next = 0;
+	U32 queued = 0;		// Prepared, but not yet taken by the kernel
+	U32 inFlight = 0;		// Taken by the kernel, but not yet completed
+	bool abandoned = false;
+	while (next < pending.size() || queued != 0 || inFlight != 0)
+	{
+		while (next < pending.size())
+		{
+			struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+			if (!sqe) break;
+
+			U32 idx = pending[next++];
+			Entry &entry = mEntries[idx];
+			io_uring_prep_read(sqe, entryFds[idx], entry.compressed + entry.readSize, entry.compressedSize - entry.readSize, entry.fileOffset + entry.readSize);
+			io_uring_sqe_set_data(sqe, (void*)(dsize_t)idx);
+			queued++;
+		}
+
+		// The kernel may take fewer reads than we queued (the rest stay queued for the next submit), or none at all
+		S32 submitted = io_uring_submit(&ring);
+		if (submitted > 0) {
+			queued -= submitted;
+			inFlight += submitted;
+		}
+		else if ((submitted < 0 && submitted != -EAGAIN && submitted != -EBUSY) || inFlight == 0)
+		{
+			// Nothing in flight to wait on either, so retrying would spin
+			Con::errorf("ResBatchRead : io_uring submit failed (%d), reading %d files in order instead", submitted, pending.size() - next + queued);
+			abandoned = true;
+			break;
+		}
+
+		struct io_uring_cqe *cqe;
+		if (io_uring_wait_cqe(&ring, &cqe) < 0)
+		{
+			Con::errorf("ResBatchRead : io_uring wait failed, reading %d files in order instead", pending.size() - next + queued + inFlight);
+			abandoned = true;
+			break;
+		}
+
+		do {
+			U32 idx = (U32)(dsize_t)io_uring_cqe_get_data(cqe);
+			S32 res = cqe->res;
+			io_uring_cqe_seen(&ring, cqe);
+			inFlight--;
+
+			Entry &entry = mEntries[idx];
+			if (res > 0)
+			{
+				entry.readSize += res;
+				if (entry.readSize < entry.compressedSize) {
+					// Short read, queue up the rest
+					pending.push_back(idx);
+					continue;
+				}
+				finishEntry(idx);
+			}
+			else if (res == -EINVAL || res == -EOPNOTSUPP)
+			{
+				// Kernel has io_uring but not IORING_OP_READ (before 5.6), so this file and the rest go through readSequential()
+				if (!smUringNoRead)
+					Con::warnf("ResBatchRead : io_uring can't read on this kernel (%d), reading files in order instead", res);
+				smUringNoRead = true;
+				abandoned = true;
+			}
+			else
+			{
+				Con::errorf("ResBatchRead : could not read '%s' (%d)", entry.name, res);
+				dFree(entry.compressed);
+				entry.compressed = NULL;
+			}
+		} while (io_uring_peek_cqe(&ring, &cqe) == 0);
+
+		if (abandoned)
+			break;
+	}
+
+	// Reads still in flight write into buffers readSequential() is about to use, so wait for them to finish
+	struct io_uring_cqe *cqe;
+	while (abandoned && inFlight != 0 && io_uring_wait_cqe(&ring, &cqe) == 0) {
+		io_uring_cqe_seen(&ring, cqe);
+		inFlight--;
+	}
+
+	io_uring_queue_exit(&ring);
+	for (U32 i=0; i<fds.size(); i++) {
+		if (fds[i] >= 0) ::close(fds[i]);
+	}
+
+	// Anything io_uring didn't finish is read the slow way
+	if (abandoned)
+	{
+		for (Vector<U32>::iterator itr = order.begin(); itr != order.end(); itr++)
+		{
+			Entry &entry = mEntries[*itr];
+			if (entryFds[*itr] >= 0 && !entry.data && entry.compressed) {
+				entry.readSize = 0;
+				fallback.push_back(*itr);
+			}
+		}
+	}
+
+	if (fallback.size() != 0)
+		readSequential(fallback);
+
+	U32 numRead = 0;
+	for (Vector<U32>::iterator itr = order.begin(); itr != order.end(); itr++)
+	{
+		if (mEntries[*itr].data) numRead++;
+	}
+	return numRead;
+}
+#endif
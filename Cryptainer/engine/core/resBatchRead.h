@@ -0,0 +1,94 @@
+#ifndef _RESBATCHREAD_H_
+#define _RESBATCHREAD_H_
+
+//-----------------------------------------------------------------------------
+// (C) 2004 - 2006, Stuart James Urquhart (jamesu@gmail.com). All Rights Reserved.
+//-----------------------------------------------------------------------------
+
+#ifndef _PLATFORM_H_
+#include "platform/platform.h"
+#endif
+
+#ifndef _TVECTOR_H_
+#include "core/tVector.h"
+#endif
+
+class ResContainer;
+
+/// ResBatchRead
+///
+/// Reads a batch of files from a container (and any patches mounted over it) in one go.
+///
+/// Rather than each file issuing its own seek+read pairs through ResFilter, the compressed data of every file in the batch
+/// is read up front, then decoded in memory. On Linux, when compiled with TORQUE_USE_IO_URING (and linked against liburing),
+/// all of the reads are submitted to the kernel at once via io_uring, and each file is decoded as soon as its read completes,
+/// so disk latency overlaps with decode. Otherwise the reads are sorted by offset and done in order through the container stream.
+///
+/// e.g.
+///
+///    ResBatchRead batch(container);
+///    batch.add("data/terrain.ter");
+///    batch.add("data/sky.dml");
+///    batch.read();
+///    for (U32 i=0; i<batch.size(); i++)
+///       if (batch.getData(i)) ...
+class ResBatchRead
+{
+public:
+	/// Called as each file in the batch is decoded. data is owned by the batch.
+	typedef void (*Callback)(U32 idx, const char *name, const U8 *data, U32 size, void *userData);
+
+	/// Maximum number of reads in flight at once
+	enum {
+		QUEUE_DEPTH = 64
+	};
+protected:
+	struct Entry
+	{
+		const char *name;			///< Full path of the file from the container root
+		ResContainer *owner;		///< Container holding the file
+		U32 fileOffset;			///< Location of the stored data
+		U32 compressedSize;		///< Size of the stored data
+		U32 decompressedSize;	///< Size of the file
+		U32 flags;					///< ResFilter flags of the file
+		U8 *compressed;			///< Stored data, freed once decoded
+		U32 readSize;				///< Amount of compressed read in so far
+		U8 *data;					///< Decoded file data (NULL if the file could not be read)
+	};
+
+	ResContainer *mContainer;	///< Container the batch is read from
+	Vector<Entry> mEntries;		///< Files in the batch
+	Callback mCallback;			///< Notified when each file is ready
+	void *mUserData;
+
+	static Vector<Entry> *smSortEntries;	///< Entries being sorted by compareEntryOffset()
+	static S32 QSORT_CALLBACK compareEntryOffset(const void *a, const void *b);
+
+	bool decodeEntry(Entry &entry);	///< Decodes entry.compressed into entry.data
+	void finishEntry(U32 idx);			///< Decodes entry and notifies mCallback
+	U32 readSolid(Vector<U32> &solid);			///< Reads entries in solid blocks, via their container's block cache
+	U32 readSequential(Vector<U32> &order);	///< Fallback, reads entries in order through ResourceManager streams
+#if defined(TORQUE_OS_LINUX) && defined(TORQUE_USE_IO_URING)
+	U32 readUring(Vector<U32> &order);			///< Reads entries via io_uring
+	static bool smUringNoRead;		///< Set once the kernel turns down IORING_OP_READ (before 5.6); later batches read in order
+#endif
+public:
+	ResBatchRead(ResContainer *container);
+	~ResBatchRead();
+
+	/// Adds a file to the batch; returns false if the container has no such file
+	bool add(const char *filename);
+	/// Sets a function to be called as each file is decoded
+	void setCallback(Callback cb, void *userData) {mCallback = cb; mUserData = userData;}
+	/// Reads and decodes every file in the batch. Returns the number of files read successfully
+	U32 read();
+	/// Frees all data and empties the batch
+	void clear();
+
+	U32 size() const {return mEntries.size();}
+	const char *getName(U32 idx) const {return mEntries[idx].name;}
+	const U8 *getData(U32 idx) const {return mEntries[idx].data;}		///< Decoded data (NULL if the read failed)
+	U32 getDataSize(U32 idx) const {return mEntries[idx].decompressedSize;}
+};
+
+#endif
@@ -5,7 +5,30 @@
 #include "platform/platform.h"
 #include "console/console.h"
 #include "core/frameAllocator.h"
+#include "core/fileStream.h"
 #include "core/resContainer.h"
+#include "core/resBatchRead.h"
+
+#if defined(TORQUE_OS_WIN32)
+#include <windows.h>
+#elif defined(TORQUE_OS_LINUX) || defined(TORQUE_OS_MAC_OSX)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Access statistics (see ResContainer::smEnableStats)
+bool ResContainer::smEnableStats = false;
+static Vector<ResFilterStats*> gStats;
+static Vector<S32> gStatsBuckets;
+static U32 gTouchCount = 0;
+static FileStream *gTraceStream = NULL;
+
+// Byte counts in the stats dump are U64
+#if defined(TORQUE_COMPILER_VISUALC)
+#define STATS_BYTES "%10I64u"
+#else
+#define STATS_BYTES "%10llu"
+#endif
 
 // ResourceManager Hook
 //------------------------------------------------------------------------------
@@ -25,6 +48,12 @@ ResourceInstance* constructContainer(Stream& stream)
 //------------------------------------------------------------------------------
 void DirectoryEntry::read(Stream &s)
 {
+	mDirty = false;
+	if (mData) {
+		delete [] mData;
+		mData = NULL;
+	}
+
 	s.readString(mDirname);
 	//s.read(sizeof(DirectoryInfo), &mDirectoryInfo);
 	// Endian safe read
@@ -36,14 +65,18 @@ void DirectoryEntry::read(Stream &s)
 	if (mDirectoryInfo.numFiles == 0 || mDirectoryInfo.compressedSize == 0)
 		return;
 
+	// Keep the processed list around, so write() can put it back as-is if nothing changes
+	mData = new U8[mDirectoryInfo.compressedSize];
+	s.read(mDirectoryInfo.compressedSize, mData);
+	MemStream mem(mDirectoryInfo.compressedSize, mData, true, false);
+
 	// Create temp memory
 	U8 *tmpBuffer = new U8[sizeof(FileInfo)*mDirectoryInfo.numFiles];
 	ResFilter *filter = ResContainer::getFilter(mDirectoryInfo.flags);
 
-	U32 origOffset = s.getPosition();
-	filter->attachStream(&s, false);
+	filter->attachStream(&mem, false);
 	if (mObject->mHash) filter->setHash(mObject->mHash);
-	filter->setStreamOffset(origOffset, sizeof(FileInfo)*mDirectoryInfo.numFiles);
+	filter->setStreamOffset(0, sizeof(FileInfo)*mDirectoryInfo.numFiles);
 
 	FileInfo *ptr = (FileInfo*)tmpBuffer;
 	// Read every FileInfo
@@ -61,63 +94,71 @@ void DirectoryEntry::read(Stream &s)
 
 	// Now we can just directly read the vector in from the buffer
 	files.set(tmpBuffer, mDirectoryInfo.numFiles);
-	// Also revert the stream position (since the cache reading nature of ResFilter will likely read too much)
-	s.setPosition(origOffset + mDirectoryInfo.compressedSize);
 
 	delete filter;
 	delete [] tmpBuffer;
 }
 
 //------------------------------------------------------------------------------
-void DirectoryEntry::write(Stream &s)
+void DirectoryEntry::buildData()
 {
-	U8 *tmpBuffer = NULL;
-	MemStream *mem = NULL;
-	ResFilter *filter = NULL;
+	if (mData) {
+		delete [] mData;
+		mData = NULL;
+	}
 
 	// Setup mDirectoryInfo...
 	mDirectoryInfo.numFiles = files.size();
+	mDirectoryInfo.compressedSize = 0;
+	mDirty = false;
 
 	// Special case : if we have no files, skip this unneccesary setup
-	if (mDirectoryInfo.numFiles != 0) {
-		// Create temp memory
-		tmpBuffer = new U8[sizeof(FileInfo)*(mDirectoryInfo.numFiles+1)];
-		mem = new MemStream(sizeof(FileInfo)*(mDirectoryInfo.numFiles+1), tmpBuffer, true, true);
+	if (mDirectoryInfo.numFiles == 0)
+		return;
 
-		// Get the filter to compress...
-		filter = ResContainer::getFilter(mDirectoryInfo.flags);
-		
-		filter->attachStream(mem, true);
-		if (mObject->mHash) filter->setHash(mObject->mHash);
-		filter->setStreamOffset(0, sizeof(FileInfo) * files.size());
-
-		// Write every FileInfo to the tmpBuffer
-		for (DirectoryEntry::iterator itr = begin(); itr != end(); itr++) {
-			//filter->write(sizeof(FileInfo),&*itr);
-			// Endian Safe write
-			const FileInfo *entry = &*itr;
-			filter->write(FILENAME_SIZE, entry->name);
-			filter->write(entry->compressedSize);
-			filter->write(entry->decompressedSize);
-			filter->write(entry->fileOffset);
-			filter->write(entry->flags);
-		}
-		delete filter;
+	// Create temp memory
+	mData = new U8[sizeof(FileInfo)*(mDirectoryInfo.numFiles+1)];
+	MemStream mem(sizeof(FileInfo)*(mDirectoryInfo.numFiles+1), mData, true, true);
+
+	// Get the filter to compress...
+	ResFilter *filter = ResContainer::getFilter(mDirectoryInfo.flags);
+
+	filter->attachStream(&mem, true);
+	if (mObject->mHash) filter->setHash(mObject->mHash);
+	filter->setStreamOffset(0, sizeof(FileInfo) * files.size());
+
+	// Write every FileInfo to mData
+	for (DirectoryEntry::iterator itr = begin(); itr != end(); itr++) {
+		//filter->write(sizeof(FileInfo),&*itr);
+		// Endian Safe write
+		const FileInfo *entry = &*itr;
+		filter->write(FILENAME_SIZE, entry->name);
+		filter->write(entry->compressedSize);
+		filter->write(entry->decompressedSize);
+		filter->write(entry->fileOffset);
+		filter->write(entry->flags);
 	}
+	delete filter;
+
+	mDirectoryInfo.compressedSize = mem.getPosition();
+}
+
+//------------------------------------------------------------------------------
+void DirectoryEntry::write(Stream &s)
+{
+	// Only process the FileInfo list again if it changed
+	if (mDirty || (mData == NULL && files.size() != 0))
+		buildData();
 
 	// Write everything to file
-	mDirectoryInfo.compressedSize = mem ? mem->getPosition() : 0;
 	s.writeString(mDirname);
 	//s.write(sizeof(DirectoryInfo), &mDirectoryInfo);
 	// Endian Safe write
 	s.write(mDirectoryInfo.compressedSize);
 	s.write(mDirectoryInfo.numFiles);
 	s.write(mDirectoryInfo.flags);
-	if (tmpBuffer) {
-		s.write(mDirectoryInfo.compressedSize,tmpBuffer);
-		delete mem;
-		delete [] tmpBuffer;
-	}
+	if (mData)
+		s.write(mDirectoryInfo.compressedSize, mData);
 
 	//Con::printf(">>DirectoryEntry::write: dirName == %s, numFiles == %d, compressedSize == %d (real == %d)", mDirname, mDirectoryInfo.numFiles, mDirectoryInfo.compressedSize, sizeof(FileInfo)*mDirectoryInfo.numFiles);
 }
@@ -130,6 +171,8 @@ DirectoryEntry::DirectoryEntry(ResContainer *obj)
 	mDirectoryInfo.numFiles = 0;
 	mDirectoryInfo.flags = 0;
 	mFullPath = NULL;
+	mData = NULL;
+	mDirty = false;
 }
 
 //------------------------------------------------------------------------------
@@ -140,11 +183,20 @@ DirectoryEntry::DirectoryEntry(ResContainer *obj, const char *name, U32 flags)
 	mDirectoryInfo.numFiles = 0;
 	mDirectoryInfo.flags = flags;
 	mFullPath = NULL;
+	mData = NULL;
+	mDirty = true;
 	dStrncpy(mDirname, name, DIRECTORY_SIZE);
 	mDirname[DIRECTORY_SIZE-1] = '\0';
 	VECTOR_SET_ASSOCIATION(directorys);
 }
 
+//------------------------------------------------------------------------------
+DirectoryEntry::~DirectoryEntry()
+{
+	if (mData)
+		delete [] mData;
+}
+
 //------------------------------------------------------------------------------
 void DirectoryEntry::addFileEntry(const char *name, U32 compressedSize, U32 decompressedSize, U32 fileOffset, U32 flags)
 {
@@ -156,6 +208,7 @@ void DirectoryEntry::addFileEntry(const char *name, U32 compressedSize, U32 deco
 	info->decompressedSize = decompressedSize;
 	info->fileOffset = fileOffset;
 	info->flags = flags;
+	mDirty = true;
 
 	//Con::printf(">^DirectoryEntry::addFileEntry : name == %s, compressedSize == %d (real == %d), offset == %d", name, compressedSize, decompressedSize, fileOffset);
 }
@@ -164,8 +217,10 @@ void DirectoryEntry::addFileEntry(const char *name, U32 compressedSize, U32 deco
 bool DirectoryEntry::delFileEntry(const char *name)
 {
 	DirectoryEntry::iterator itr = findFileEntry(name);
-	if (itr)
+	if (itr) {
 		files.erase((Vector<FileInfo>::iterator)itr);
+		mDirty = true;
+	}
 	return itr ? true : false;
 }
 
@@ -183,8 +238,10 @@ DirectoryEntry::iterator DirectoryEntry::findFileEntry(const char *name)
 void DirectoryEntry::setFlags(const char *name, U32 flags)
 {
 	Vector<FileInfo>::iterator file = (Vector<FileInfo>::iterator)findFileEntry(name);
-	if (file)
+	if (file) {
 		file->flags = flags &~ FilterState::ENCRYPT_ALL;
+		mDirty = true;
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -204,8 +261,44 @@ ResContainer::ResContainer()
 	cStream=NULL;
 	mHash = NULL;
 	mEnableWrite = false;
+	mWriteThreads = 1;
 	mDirectoryOffset = sizeof(U32)*2;
+	mWrittenOffset = U32(-1);
+	mWrittenEnd = U32(-1);
+	mDirListDirty = true;
+	mTransaction = 0;
+	mTransactionStart = 0;
+	mSyncWrites = false;
+	mSnapshotMutex = Mutex::createMutex();
+	mSnapshot = NULL;
+	mSnapshotsHeld = 0;
+	mSnapshotsEnabled = false;
+	mBase = NULL;
+	mBaseHandle = NULL;
+	mSelfHandle = NULL;
+	mIndexDirty = true;
+	mContentHash = NULL;
+	mSolidData = NULL;
+	mSolidFlags = 0;
+	mSolidMaxSize = SOLID_BLOCKSIZE;
+	mSolidCacheSize = 0;
+	mSolidTick = 0;
 	VECTOR_SET_ASSOCIATION(files);
+	VECTOR_SET_ASSOCIATION(mPatches);
+	VECTOR_SET_ASSOCIATION(mIndex);
+	VECTOR_SET_ASSOCIATION(mIndexBuckets);
+	VECTOR_SET_ASSOCIATION(mContent);
+	VECTOR_SET_ASSOCIATION(mContentBuckets);
+	VECTOR_SET_ASSOCIATION(mSolidFiles);
+	VECTOR_SET_ASSOCIATION(mSolidCache);
+}
+
+//------------------------------------------------------------------------------
+ResContainer::~ResContainer()
+{
+	close();
+	AssertFatal(mSnapshotsHeld == 0, "ResContainer::~ResContainer : snapshots still held by readers!");
+	Mutex::destroyMutex(mSnapshotMutex);
 }
 
 //------------------------------------------------------------------------------
@@ -232,12 +325,53 @@ bool ResContainer::read(Stream &s)
 		entry->read(s);
 	}
 
+	// The directory's in memory now match what is in the stream
+	mWrittenOffset = mDirectoryOffset;
+	mWrittenEnd = s.getPosition();
+	mDirListDirty = false;
+
+	markIndexDirty();
 	return true;
 }
 
 //------------------------------------------------------------------------------
 bool ResContainer::write(Stream &s)
 {
+	// Changes to our own stream are held back until the transaction is committed
+	if (mTransaction && &s == cStream)
+		return true;
+
+	// Any solid block being built needs to be in the container before the directory's are
+	if (mSolidData && &s == cStream)
+		writeSolidBlock();
+
+	// If the list is where the header says it is, the changed list goes after it rather than over it.
+	// The old list stays valid until the header is pointed at the new one.
+	bool relocate = (&s == cStream) && (mWrittenOffset == mDirectoryOffset) && (mWrittenEnd != U32(-1));
+	if (relocate) {
+		bool changed = mDirListDirty;
+		for (U32 i=0; i<directorys.size() && !changed; i++)
+			changed = directorys[i]->isDirty();
+		if (!changed)
+			return true; // Nothing to do
+		mDirectoryOffset = mWrittenEnd;
+	}
+
+	//Con::printf(">>ResContainer::write : dirOffset == %d", mDirectoryOffset);
+
+	// Directory's go first, so the header is only changed once the list it points to is complete.
+	// Directory's which haven't changed reuse their processed FileInfo list.
+	U16 numDirs;
+	s.setPosition(mDirectoryOffset);
+	numDirs = directorys.size(); s.write(numDirs);
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin(); itr != directorys.end(); itr++)
+		(*itr)->write(s);
+	U32 listEnd = s.getPosition();
+
+	bool sync = (mSyncWrites || relocate) && &s == cStream;
+	if (sync)
+		syncStream();
+
 	// Header...
 	U32 num;
 	num = 0x44434f4e; // "NOCD"
@@ -245,20 +379,35 @@ bool ResContainer::write(Stream &s)
 	s.write(num);
 	s.write(mDirectoryOffset);
 
-	//Con::printf(">>ResContainer::write : dirOffset == %d", mDirectoryOffset);
+	if (sync)
+		syncStream();
 
-	// Directory's...
-	U16 numDirs;
-	s.setPosition(mDirectoryOffset);
-	numDirs = directorys.size(); s.write(numDirs);
-	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin(); itr != directorys.end(); itr++) {
-		DirectoryEntry *entry = *itr;
-		entry->write(s);
+	// Directory stream offsets now refer to s
+	if (&s == cStream) {
+		mWrittenOffset = mDirectoryOffset;
+		mWrittenEnd = listEnd;
+		mDirListDirty = false;
+		if (mSnapshotsEnabled)
+			publishSnapshot();
 	}
+	else
+		mWrittenOffset = U32(-1);
 
 	return true;
 }
 
+//------------------------------------------------------------------------------
+bool ResContainer::isDirty()
+{
+	if (mSolidData || mDirListDirty || mWrittenOffset != mDirectoryOffset)
+		return true;
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin(); itr != directorys.end(); itr++) {
+		if ((*itr)->isDirty())
+			return true;
+	}
+	return false;
+}
+
 //------------------------------------------------------------------------------
 bool ResContainer::open(bool enableWrite)
 {
@@ -317,10 +466,49 @@ bool ResContainer::initNew(Stream *s)
 //------------------------------------------------------------------------------
 bool ResContainer::close()
 {
+	// Take ourselves out of any patch stack we are part of
+	if (mBase)
+		mBase->unmountPatch(this);
+	for (Vector<ResContainer*>::iterator itr = mPatches.begin(); itr != mPatches.end(); itr++) {
+		(*itr)->mBase = NULL;
+		(*itr)->releaseMountHandles();
+	}
+	mPatches.clear();
+	mIndex.clear();
+	mIndexBuckets.clear();
+	mIndexDirty = true;
+	flushPreloaded();
+
+	// Readers keep any snapshot they hold, but no new ones can be taken
+	Mutex::lockMutex(mSnapshotMutex);
+	swapSnapshot(NULL);
+	Mutex::unlockMutex(mSnapshotMutex);
+	mSnapshotsEnabled = false;
+
+	// An unfinished transaction is thrown away, leaving what the header points to
+	bool aborted = false;
+	if (cStream && mTransaction) {
+		Con::warnf("ResContainer::close : discarding changes from an unfinished transaction");
+		abortTransaction();
+		aborted = true;
+	}
+
 	// Finish with main stream...
+	if (mSolidData)
+	{
+		if (cStream && mEnableWrite)
+			endSolidBlock();
+		else {
+			delete mSolidData;
+			mSolidData = NULL;
+			mSolidFiles.clear();
+		}
+	}
+	flushSolidCache();
+
 	if (cStream)
 	{
-		if (mEnableWrite)
+		if (mEnableWrite && !aborted)
 			write(*cStream);
 		ResourceManager->closeStream(cStream);
 		cStream = NULL;
@@ -330,6 +518,11 @@ bool ResContainer::close()
 		if (*ptr) delete *ptr;
 	directorys.setSize(0);
 	directorys.compact(); // Compact will free any memory used by our container object (if we want to use it again)
+	mWrittenOffset = U32(-1);
+	mWrittenEnd = U32(-1);
+	mDirListDirty = true;
+	mTransaction = 0;
+	setDedup(false);
 
 	return true;
 };
@@ -357,6 +550,33 @@ DirectoryEntry::iterator ResContainer::getFile(ResourceObject *obj)
 
 //------------------------------------------------------------------------------
 DirectoryEntry::iterator ResContainer::getFile(const char *path, const char *name)
+{
+	return getFile(path, name, NULL);
+}
+
+//------------------------------------------------------------------------------
+DirectoryEntry::iterator ResContainer::getFile(const char *path, const char *name, ResContainer **owner)
+{
+	ResContainer *root = getRoot();
+	if (root->mIndexDirty)
+		root->rebuildIndex();
+
+	// Anything in the index has its name in the StringTable, so a failed lookup means we don't have it
+	char buffer[DIRECTORY_SIZE + FILENAME_SIZE + 1];
+	StringTableEntry key = StringTable->lookup(buildEntryName(buffer, sizeof(buffer), path, name));
+	if (!key)
+		return NULL;
+
+	IndexEntry *entry = root->findIndexEntry(key);
+	if (!entry || !entry->owner)
+		return NULL;
+
+	if (owner) *owner = entry->owner;
+	return entry->dir->begin() + entry->fileIdx;
+}
+
+//------------------------------------------------------------------------------
+DirectoryEntry::iterator ResContainer::getLocalFile(const char *path, const char *name)
 {
 	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin();itr != directorys.end();itr++)
 	{
@@ -397,31 +617,130 @@ DirectoryEntry::iterator ResContainer::getFile(const char *filename)
 //------------------------------------------------------------------------------
 ResFilter *ResContainer::getFileStream(ResourceObject *obj)
 {
-	DirectoryEntry::iterator file = getFile(obj);
+	// The newest copy of the file may live in a patch mounted over us
+	const char *filePath = obj->path;
+	if (obj->zipPath != NULL) filePath = filePath + dStrlen(obj->zipPath);
+	if (*filePath == '/') filePath++;
+
+	ResContainer *owner = this;
+	DirectoryEntry::iterator file = getFile(filePath, obj->name, &owner);
 	if (file) {
 		// Firstly, check if the file has crypto enabled, and if we have a hash assigned.
 		// e.g. if we have encryption enabled, but we have no hash, the crypto will very likely fail!
-		if ((file->flags & FilterState::ENCRYPT_ALL) && (mHash == NULL)) return NULL;
+		if ((file->flags & FilterState::ENCRYPT_ALL) && (owner->mHash == NULL)) return NULL;
 		
-		// We have the file, so make a stream instance
-		Stream *strm = ResourceManager->openStream(this->mSourceResource);
+		// Files read ahead by preloadFiles() are already decoded
+		Stream *strm = takePreloaded(filePath, obj->name);
+		bool decoded = strm != NULL;
+
+		// Otherwise we have the file, so make a stream instance
+		if (!decoded)
+			strm = ResourceManager->openStream(owner->mSourceResource);
+		if (!strm) return NULL;
+
+		// Files in solid blocks get a copy of their data from the decoded block
+		if (!decoded && (file->flags & DirectoryEntry::FILE_SOLID))
+		{
+			U32 blockSize = 0;
+			const U8 *block = owner->getSolidBlock(*strm, file->fileOffset, file->flags, blockSize);
+			ResourceManager->closeStream(strm);
+			if (!block || file->compressedSize + file->decompressedSize > blockSize)
+				return NULL;
+
+			strm = new DynMemStream(file->decompressedSize ? file->decompressedSize : 1);
+			strm->write(file->decompressedSize, block + file->compressedSize);
+			decoded = true;
+		}
+
 		// And attach the filter...
-		ResFilter *filter = getFilter(file->flags);
+		ResFilter *filter = getFilter(decoded ? FilterState::PROCESS_BASIC : file->flags);
+
+		if (smEnableStats && owner->mSourceResource)
+		{
+			char buffer[1024];
+			dSprintf(buffer, sizeof(buffer), "%s/%s", owner->mSourceResource->path, owner->mSourceResource->name);
+			StringTableEntry container = StringTable->insert(buffer);
+			StringTableEntry name = StringTable->insert(buildEntryName(buffer, sizeof(buffer), filePath, obj->name));
+
+			Mutex::lockMutex(ResFilter::smStatsMutex);
+			ResFilterStats *stats = findStats(container, name);
+			if (stats->opens++ == 0)
+			{
+				stats->touchOrder = gTouchCount++;
+				if (gTraceStream) {
+					dSprintf(buffer, sizeof(buffer), "%s\t%s\n", container, name);
+					gTraceStream->write(dStrlen(buffer), buffer);
+				}
+			}
+			Mutex::unlockMutex(ResFilter::smStatsMutex);
+			filter->setStats(stats);
+		}
 		
 		filter->attachStream(strm, false);
-		if (mHash) filter->setHash(mHash);
-		filter->setStreamOffset(file->fileOffset, file->decompressedSize);
+		if (decoded)
+			filter->setStreamOffset(0, file->decompressedSize);
+		else {
+			if (owner->mHash) filter->setHash(owner->mHash);
+			filter->setStreamOffset(file->fileOffset, file->decompressedSize);
+		}
 		return filter;
 	}
 
 	return NULL;
 }
 
+//------------------------------------------------------------------------------
+bool ResContainer::readFileData(Stream &s, const DirectoryEntry::FileInfo &file, U8 *out)
+{
+	if ((file.flags & FilterState::ENCRYPT_ALL) && (mHash == NULL))
+		return false;
+
+	if (file.flags & DirectoryEntry::FILE_SOLID)
+	{
+		U32 blockSize = 0;
+		const U8 *block = getSolidBlock(s, file.fileOffset, file.flags, blockSize);
+		if (!block || file.compressedSize + file.decompressedSize > blockSize)
+			return false;
+		dMemcpy(out, block + file.compressedSize, file.decompressedSize);
+		return true;
+	}
+
+	return decodeFileData(s, file, mHash, out);
+}
+
+//------------------------------------------------------------------------------
+bool ResContainer::decodeFileData(Stream &s, const DirectoryEntry::FileInfo &file, CryptHash *hash, U8 *out)
+{
+	if (file.decompressedSize == 0)
+		return true;
+
+	// Large files in a format which can be decoded in parallel are read in whole, then decoded in one go
+	if (ResFilter::canDecodeBuffer(file.flags, file.decompressedSize))
+	{
+		U8 *stored = new U8[file.compressedSize ? file.compressedSize : 1];
+		bool success = s.setPosition(file.fileOffset) && s.read(file.compressedSize, stored) &&
+		               ResFilter::decodeBuffer(file.flags, stored, file.compressedSize, out, file.decompressedSize);
+		delete [] stored;
+		if (success)
+			return true;
+	}
+
+	ResFilter *filter = getFilter(file.flags);
+	filter->attachStream(&s, false);
+	if (hash) filter->setHash(hash);
+	filter->setStreamOffset(file.fileOffset, file.decompressedSize);
+	bool success = filter->read(file.decompressedSize, out);
+	delete filter;
+	return success;
+}
+
 //------------------------------------------------------------------------------
 void ResContainer::addDirectory(const char *name, U32 flags)
 {
 	DirectoryEntry *entry = new DirectoryEntry(this, name, flags &~ FilterState::ENCRYPT_ALL);
 	directorys.push_back(entry);
+	mDirListDirty = true;
+	markIndexDirty();
 }
 
 //------------------------------------------------------------------------------
@@ -432,6 +751,8 @@ bool ResContainer::delDirectory(const char *name)
 		if (!dStrcmp(entry->getName(),name)) {
 			delete *itr;
 			directorys.erase(itr);
+			mDirListDirty = true;
+			markIndexDirty();
 			return true;
 		}
 	}
@@ -464,11 +785,56 @@ DirectoryEntry *ResContainer::getDirectory(const char *filename)
 //------------------------------------------------------------------------------
 bool ResContainer::addFile(const char *name, U8 *ptr, U32 size, U32 flags)
 {
-	if (getFile(name)) delFile(name); // Delete any existing file
+	MemStream source(size, ptr, true, false);
+	return addFile(name, source, size, flags);
+}
+
+//------------------------------------------------------------------------------
+bool ResContainer::addFile(const char *name, Stream &source, U32 size, U32 flags)
+{
+	// Any existing file is only deleted once its replacement has been written, so a failed add leaves it be
+	if (mSolidData && size <= SOLID_MAXFILESIZE)
+	{
+		U32 offset = mSolidData->getStreamSize();
+		U8 *chunk = new U8[ADDFILE_CHUNKSIZE];
+		U32 dataLeft = size;
+		while (dataLeft)
+		{
+			U32 toRead = dataLeft > ADDFILE_CHUNKSIZE ? ADDFILE_CHUNKSIZE : dataLeft;
+			if (!source.read(toRead, chunk) || !mSolidData->write(toRead, chunk))
+				break;
+			dataLeft -= toRead;
+		}
+		delete [] chunk;
+
+		if (dataLeft) {
+			mSolidData->setPosition(offset); // Overwritten by the next file
+			Con::errorf("ResContainer::addFile : could not add '%s' (%d bytes short)", name, dataLeft);
+			return false;
+		}
+
+		// Replaces any copy already in the block (its data is left in the block)
+		StringTableEntry solidName = StringTable->insert(name);
+		for (Vector<SolidFile>::iterator itr = mSolidFiles.begin(); itr != mSolidFiles.end(); itr++) {
+			if (itr->name == solidName) {
+				mSolidFiles.erase(itr);
+				break;
+			}
+		}
+		delFile(name);
+
+		SolidFile *file = mSolidFiles.increment();
+		file->name = solidName;
+		file->offset = offset;
+		file->size = size;
+
+		if (mSolidData->getStreamSize() >= mSolidMaxSize)
+			return writeSolidBlock();
+		return true;
+	}
 	
 	const char *fileName = dStrrchr(name, '/');
 	char filePath[FILENAME_SIZE];
-	bool success = false;
 	if (fileName == NULL) {
 		filePath[0] = '\0'; // Root path, so terminate path string
 		fileName = name;
@@ -481,45 +847,100 @@ bool ResContainer::addFile(const char *name, U8 *ptr, U32 size, U32 flags)
 
 	// Go to end of file data (mDirectoryOffset), and start writing...
 	ResFilter *filter = getFilter(flags);
+	filter->setWriteThreads(mWriteThreads);
 	
 	if (!filter->attachStream(cStream, true)) {
 		delete filter;
 		return false;
 	}
 	if (mHash) filter->setHash(mHash);
-	filter->setStreamOffset(mDirectoryOffset, size*2); // *2 to account for expansion
-	filter->write(size, ptr);
+	filter->setStreamOffset(mDirectoryOffset, size);
+
+	// Pull the data through in chunks, so we never need the whole file in memory
+	bool hasDigest = mContentHash && mContentHash->hashBegin();
+	U8 *chunk = new U8[ADDFILE_CHUNKSIZE];
+	U32 dataLeft = size;
+	bool success = true;
+
+	while (dataLeft)
+	{
+		U32 toRead = dataLeft > ADDFILE_CHUNKSIZE ? ADDFILE_CHUNKSIZE : dataLeft;
+		if (!source.read(toRead, chunk) || !filter->write(toRead, chunk)) {
+			success = false;
+			break;
+		}
+		if (hasDigest)
+			hasDigest = mContentHash->hashData(chunk, toRead);
+		dataLeft -= toRead;
+	}
+
+	delete [] chunk;
+	filter->detachStream(); // Finishes off the compressed stream
+	success = success && !filter->hasWriteFailed();
 	delete filter;
 
+	if (!success) {
+		Con::errorf("ResContainer::addFile : could not add '%s' (%d bytes short)", name, dataLeft);
+		return false;
+	}
+
+	// Now the old copy can go. If its data is removed, the new data moves down with mDirectoryOffset.
+	U32 compressedSize = cStream->getPosition() - mDirectoryOffset;
+	delFile(name);
+
+	// If we already have a copy of this data, point at that instead.
+	// What we just wrote is past the end of the file data, so it will be overwritten.
+	U8 digest[CONTENT_DIGEST_SIZE];
+	if (hasDigest && mContentHash->hashEnd()) {
+		dMemcpy(digest, mContentHash->getData(), CONTENT_DIGEST_SIZE);
+		ContentEntry *content = findContent(digest, size, flags);
+		if (content) {
+			addFileInfo(filePath, fileName, content->compressedSize, size, content->fileOffset, flags);
+			return true;
+		}
+	}
+	else
+		hasDigest = false;
+
 	// Append file to appropriate directory
+	addFileInfo(filePath, fileName, compressedSize, size, mDirectoryOffset, flags);
+	if (hasDigest)
+		addContent(digest, mDirectoryOffset, compressedSize, size, flags);
+
+	mDirectoryOffset += compressedSize;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::addFileInfo(const char *filePath, const char *fileName, U32 compressedSize, U32 size, U32 fileOffset, U32 flags)
+{
+	DirectoryEntry *dir = NULL;
 	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin();itr != directorys.end();itr++)
 	{
-		DirectoryEntry *entry = *itr;
-		if (!dStrcmp(filePath, entry->getName())) {
-			entry->addFileEntry(fileName, cStream->getPosition() - mDirectoryOffset, size, mDirectoryOffset, flags);
-			success = true;
+		if (!dStrcmp(filePath, (*itr)->getName())) {
+			dir = *itr;
 			break;
 		}
 	}
 
-	if (!success) {
+	if (!dir) {
 		// Directory doesn't exist!
 		addDirectory(filePath, flags);
-		directorys[directorys.size()-1]->addFileEntry(fileName, cStream->getPosition() - mDirectoryOffset, size, mDirectoryOffset, flags);
+		dir = directorys.last();
 	}
 
-	mDirectoryOffset = cStream->getPosition();
-	return true;
+	dir->addFileEntry(fileName, compressedSize, size, fileOffset, flags);
+	markIndexDirty();
 }
 
+//------------------------------------------------------------------------------
 bool ResContainer::addFilteredFile(const char *name, U8 *ptr, U32 compressedSize, U32 size, U32 flags)
 {
 	//Con::warnf("addFilteredFile(%s, %d, %d, %d, %d)", name, ptr, compressedSize, size, flags);
-	if (getFile(name)) delFile(name); // Delete any existing file
+	delFile(name); // Delete any existing file
 	
 	const char *fileName = dStrrchr(name, '/');
 	char filePath[FILENAME_SIZE];
-	bool success = false;
 	if (fileName == NULL) {
 		filePath[0] = '\0'; // Root path, so terminate path string
 		fileName = name;
@@ -534,24 +955,17 @@ bool ResContainer::addFilteredFile(const char *name, U8 *ptr, U32 compressedSize
 	cStream->write(compressedSize, ptr);
 	
 	// Append file to appropriate directory
-	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin();itr != directorys.end();itr++)
-	{
-		DirectoryEntry *entry = *itr;
-		if (!dStrcmp(filePath, entry->getName())) {
-			entry->addFileEntry(fileName, compressedSize, size, mDirectoryOffset, flags);
-			success = true;
-			break;
-		}
-	}
-	
-	if (!success) {
-		// Directory doesn't exist!
-		addDirectory(filePath, flags);
-		directorys[directorys.size()-1]->addFileEntry(fileName, compressedSize, size, mDirectoryOffset, flags);
-	}
+	addFileInfo(filePath, fileName, compressedSize, size, mDirectoryOffset, flags);
 
 	mDirectoryOffset = cStream->getPosition();
-	return success;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+bool ResContainer::addWhiteout(const char *name)
+{
+	// A whiteout is an empty entry; it only needs to exist in the directory
+	return addFilteredFile(name, NULL, 0, 0, FilterState::PROCESS_BASIC | DirectoryEntry::FILE_WHITEOUT);
 }
 
 //------------------------------------------------------------------------------
@@ -559,7 +973,6 @@ bool ResContainer::delFile(const char *name)
 {
 	const char *fileName = dStrrchr(name, '/');
 	char filePath[FILENAME_SIZE];
-	U32 targetStart, targetEnd = 0;
 
 	if (fileName == NULL) {
 		fileName = name;
@@ -572,8 +985,7 @@ bool ResContainer::delFile(const char *name)
 	}
 
 	// Find file entry...
-	Vector<DirectoryEntry*>::iterator itr;
-	for (itr = directorys.begin();itr != directorys.end();itr++)
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin();itr != directorys.end();itr++)
 	{
 		DirectoryEntry *entry = *itr;
 		if (!dStrcmp(filePath, entry->getName()))
@@ -582,81 +994,1101 @@ bool ResContainer::delFile(const char *name)
 			if (!myFileEntry)
 				continue;
 
-			targetStart = myFileEntry->fileOffset;
-			targetEnd = myFileEntry->fileOffset + myFileEntry->compressedSize;
+			U32 dataStart = myFileEntry->fileOffset;
+			U32 dataSize = myFileEntry->compressedSize;
+			bool solid = (myFileEntry->flags & DirectoryEntry::FILE_SOLID) != 0;
 
-			// Move file data from targetEnd+ to targetStart
-			U8 myBuff[CHUNK_PROCSIZE];
-			U32 dataLeft = cStream->getStreamSize() - targetEnd;
-			targetEnd = targetStart;
+			// Data may be shared with other entries (see setDedup and solid blocks), in which case it has to stay put
+			bool shared = countFileRefs(dataStart, dataSize, solid) > 1;
 
-			while (dataLeft)
+			if (solid && !shared)
 			{
-				U32 toRead = dataLeft > CHUNK_PROCSIZE ? CHUNK_PROCSIZE : dataLeft;
-				
-				cStream->setPosition(cStream->getStreamSize() - dataLeft);
-				cStream->read(toRead, myBuff);
+				// Last file in the block, so the whole block goes
+				U32 decodedSize = 0;
+				cStream->setPosition(dataStart);
+				cStream->read(&decodedSize);
+				cStream->read(&dataSize);
+				dataSize += SOLID_HEADER_SIZE;
+			}
 
-				cStream->setPosition(targetEnd);
-				cStream->write(toRead, myBuff);
+			if (!entry->delFileEntry(fileName))
+				return false;
 
-				targetEnd += toRead;
-				dataLeft -= toRead;
+			// Moving data down would overwrite what the header points to, so transactions leave a hole instead
+			if (!shared && dataSize != 0 && !mTransaction)
+			{
+				// Likewise for data readers of a snapshot might be reading. Readers are held off while the data is moved.
+				Mutex::lockMutex(mSnapshotMutex);
+				if (mSnapshotsHeld == 0)
+				{
+					removeFileData(dataStart, dataSize);
+					if (mSnapshotsEnabled) {
+						flushStream();
+						swapSnapshot(buildSnapshot());
+					}
+				}
+				Mutex::unlockMutex(mSnapshotMutex);
 			}
 
-			targetStart = myFileEntry->compressedSize;
-			targetEnd = myFileEntry->fileOffset + myFileEntry->compressedSize;
+			markIndexDirty();
+			return true;
+		}
+	}
 
-			if (!entry->delFileEntry(fileName))
-				return false;
+	return false;
+}
 
-			break;
+//------------------------------------------------------------------------------
+U32 ResContainer::countFileRefs(U32 fileOffset, U32 compressedSize, bool solid)
+{
+	U32 count = 0;
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin();itr != directorys.end();itr++)
+	{
+		DirectoryEntry *entry = *itr;
+		for (DirectoryEntry::iterator file = entry->begin(); file != entry->end(); file++)
+		{
+			if (file->fileOffset != fileOffset)
+				continue;
+			// Every file in a solid block shares it
+			if (solid ? (file->flags & DirectoryEntry::FILE_SOLID) != 0 : (!(file->flags & DirectoryEntry::FILE_SOLID) && file->compressedSize == compressedSize))
+				count++;
 		}
 	}
+	return count;
+}
 
-	if (itr == directorys.end())
+//------------------------------------------------------------------------------
+void ResContainer::removeFileData(U32 dataStart, U32 dataSize)
+{
+	U32 dataEnd = dataStart + dataSize;
+
+	// Move file data from dataEnd+ to dataStart
+	U8 myBuff[CHUNK_PROCSIZE];
+	U32 dataLeft = cStream->getStreamSize() - dataEnd;
+	U32 writePos = dataStart;
+
+	while (dataLeft)
 	{
-		return false;
+		U32 toRead = dataLeft > CHUNK_PROCSIZE ? CHUNK_PROCSIZE : dataLeft;
+		
+		cStream->setPosition(cStream->getStreamSize() - dataLeft);
+		cStream->read(toRead, myBuff);
+
+		cStream->setPosition(writePos);
+		cStream->write(toRead, myBuff);
+
+		writePos += toRead;
+		dataLeft -= toRead;
 	}
 
 	// Final pass, move file offsets
 	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin();itr != directorys.end();itr++)
 	{
 		DirectoryEntry *entry = *itr;
-		DirectoryEntry::iterator myFileEntry;
-		for (myFileEntry = entry->begin(); myFileEntry != entry->end(); myFileEntry++)
+		for (DirectoryEntry::iterator myFileEntry = entry->begin(); myFileEntry != entry->end(); myFileEntry++)
 		{
-			if (myFileEntry->fileOffset > targetEnd)
-			{
-				myFileEntry->fileOffset -= targetStart;
+			if (myFileEntry->fileOffset >= dataEnd) {
+				myFileEntry->fileOffset -= dataSize;
+				entry->markDirty();
 			}
 		}
 	}
-	return true;
+
+	for (Vector<ContentEntry>::iterator content = mContent.begin(); content != mContent.end(); content++)
+	{
+		if (content->fileOffset == dataStart && content->compressedSize == dataSize)
+			content->compressedSize = content->fileOffset = U32(-1); // Gone
+		else if (content->fileOffset != U32(-1) && content->fileOffset >= dataEnd)
+			content->fileOffset -= dataSize;
+	}
+
+	// The directory list moved along with everything else
+	mDirectoryOffset -= dataSize;
+
+	// Cached solid blocks are keyed by offset, which may have changed
+	flushSolidCache();
 }
 
+// Transactions
+//------------------------------------------------------------------------------
+bool ResContainer::beginTransaction()
+{
+	if (!cStream || !mEnableWrite)
+		return false;
+
+	if (mTransaction++ == 0)
+	{
+		// Append after the directory list the header points to, rather than over it
+		if (mWrittenOffset == mDirectoryOffset && mWrittenEnd != U32(-1))
+			mDirectoryOffset = mWrittenEnd;
+		mTransactionStart = mDirectoryOffset;
+	}
+	return true;
+}
 
 //------------------------------------------------------------------------------
-void ResContainer::setFullPath(const char *path)
+bool ResContainer::commitTransaction()
 {
-	U32 pathLen = dStrlen(path);
-	
-	// Loop through directory's...
-	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin();itr != directorys.end();itr++)
+	if (mTransaction == 0)
+		return false;
+	if (--mTransaction != 0)
+		return true; // Outermost commit writes everything
+
+	// Nothing appended or changed, so the list the header points to is still current
+	if (mDirectoryOffset == mTransactionStart && !mSolidData && !mDirListDirty)
 	{
-		DirectoryEntry *entry = *itr;
-		const char *dirName = entry->getName();
-		if (dirName[0] != '\0') {// Not root dir
-			const char *buf = ResManager::buildPath(path, dirName);
-			entry->setFullPath(StringTable->insert(buf));
+		bool changed = false;
+		for (Vector<DirectoryEntry*>::iterator itr = directorys.begin(); itr != directorys.end(); itr++) {
+			if ((*itr)->isDirty()) { changed = true; break; }
+		}
+		if (!changed) {
+			if (mWrittenOffset != U32(-1))
+				mDirectoryOffset = mWrittenOffset;
+			return true;
 		}
-		else
-			entry->setFullPath(StringTable->insert(path));
 	}
+
+	mSyncWrites = true;
+	bool success = write(*cStream);
+	mSyncWrites = false;
+	return success;
 }
 
 //------------------------------------------------------------------------------
-void ResContainer::setHash(CryptHash *hash)
+bool ResContainer::abortTransaction()
 {
-	mHash = hash;
+	if (mTransaction == 0)
+		return false;
+	mTransaction = 0;
+
+	if (mSolidData)
+	{
+		delete mSolidData;
+		mSolidData = NULL;
+		mSolidFiles.clear();
+	}
+	flushSolidCache();
+
+	// Anything deduplicated since may point at data we are throwing away
+	bool dedup = getDedup();
+	setDedup(false);
+
+	// Go back to what the header points to. Data appended since is overwritten by the next change.
+	for (Vector<DirectoryEntry*>::iterator ptr = directorys.begin();ptr != directorys.end();ptr++)
+		if (*ptr) delete *ptr;
+	directorys.setSize(0);
+	bool success = read(*cStream);
+
+	setDedup(dedup);
+	return success;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::flushStream()
+{
+	FileStream *fs = dynamic_cast<FileStream*>(cStream);
+	if (fs)
+		fs->flush();
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::syncStream()
+{
+	flushStream();
+
+	// FileStream can't ask the OS to write the file out, but any handle to the file can
+	if (!mSourceResource || mSourceResource->zipPath != NULL)
+		return;
+	char fullPath[1024];
+	dSprintf(fullPath, sizeof(fullPath), "%s/%s", mSourceResource->path, mSourceResource->name);
+
+#if defined(TORQUE_OS_WIN32)
+	// FlushFileBuffers needs write access
+	HANDLE handle = CreateFileA(fullPath, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle != INVALID_HANDLE_VALUE) {
+		FlushFileBuffers(handle);
+		CloseHandle(handle);
+	}
+#elif defined(TORQUE_OS_LINUX) || defined(TORQUE_OS_MAC_OSX)
+	int fd = ::open(fullPath, O_RDONLY);
+	if (fd >= 0) {
+#if defined(F_FULLFSYNC)
+		// fsync only reaches the drive's cache on OS X
+		if (fcntl(fd, F_FULLFSYNC) == -1)
+#endif
+			fsync(fd);
+		::close(fd);
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+U32 ResContainer::preloadFiles(const char **files, U32 count)
+{
+	ResContainer *root = getRoot();
+	ResBatchRead batch(root);
+	for (U32 i=0; i<count; i++)
+	{
+		const char *fileName = files[i];
+		if (*fileName == '/') fileName++;
+		if (!batch.add(fileName))
+			Con::warnf("ResContainer::preloadFiles : no such file '%s'", fileName);
+	}
+
+	U32 numRead = batch.read();
+	for (U32 i=0; i<batch.size(); i++)
+	{
+		const U8 *data = batch.getData(i);
+		if (!data)
+			continue;
+
+		DynMemStream *strm = new DynMemStream(batch.getDataSize(i) ? batch.getDataSize(i) : 1);
+		strm->write(batch.getDataSize(i), data);
+
+		// A file preloaded twice keeps the newer copy
+		StringTableEntry name = batch.getName(i);
+		PreloadEntry *entry = NULL;
+		for (Vector<PreloadEntry>::iterator itr = root->mPreloaded.begin(); itr != root->mPreloaded.end(); itr++) {
+			if (itr->name == name) { entry = itr; break; }
+		}
+		if (entry)
+			delete entry->data;
+		else {
+			entry = root->mPreloaded.increment();
+			entry->name = name;
+		}
+		entry->data = strm;
+	}
+
+	return numRead;
+}
+
+Stream *ResContainer::takePreloaded(const char *path, const char *name)
+{
+	ResContainer *root = getRoot();
+	if (root->mPreloaded.size() == 0)
+		return NULL;
+
+	char buffer[DIRECTORY_SIZE + FILENAME_SIZE + 1];
+	StringTableEntry key = StringTable->lookup(buildEntryName(buffer, sizeof(buffer), path, name));
+	for (Vector<PreloadEntry>::iterator itr = root->mPreloaded.begin(); key && itr != root->mPreloaded.end(); itr++)
+	{
+		if (itr->name == key) {
+			Stream *strm = itr->data;
+			root->mPreloaded.erase(itr);
+			return strm;
+		}
+	}
+	return NULL;
+}
+
+void ResContainer::flushPreloaded()
+{
+	for (Vector<PreloadEntry>::iterator itr = mPreloaded.begin(); itr != mPreloaded.end(); itr++)
+		delete itr->data;
+	mPreloaded.clear();
+}
+
+// DirectorySnapshot
+//------------------------------------------------------------------------------
+DirectorySnapshot::DirectorySnapshot()
+{
+	mPath = NULL;
+	mHash = NULL;
+	mRefCount = 0;
+	VECTOR_SET_ASSOCIATION(mEntries);
+	VECTOR_SET_ASSOCIATION(mBuckets);
+}
+
+//------------------------------------------------------------------------------
+const DirectoryEntry::FileInfo *DirectorySnapshot::find(const char *filename) const
+{
+	// Readers may be on any thread, so names are compared rather than looked up in the StringTable
+	U32 bucket = _StringTable::hashString(filename) & (mBuckets.size() - 1);
+	for (S32 idx = mBuckets[bucket]; idx != -1; idx = mEntries[idx].next)
+	{
+		if (!dStricmp(mEntries[idx].name, filename))
+			return &mEntries[idx].info;
+	}
+	return NULL;
+}
+
+//------------------------------------------------------------------------------
+Stream *DirectorySnapshot::openReader() const
+{
+	if (!mPath)
+		return NULL;
+
+	FileStream *fs = new FileStream();
+	if (!fs->open(mPath, FileStream::Read)) {
+		delete fs;
+		return NULL;
+	}
+	return fs;
+}
+
+//------------------------------------------------------------------------------
+bool DirectorySnapshot::readFile(Stream &s, const DirectoryEntry::FileInfo &file, U8 *out) const
+{
+	if ((file.flags & FilterState::ENCRYPT_ALL) && (mHash == NULL))
+		return false;
+
+	if (file.flags & DirectoryEntry::FILE_SOLID)
+	{
+		U32 blockSize = 0;
+		U8 *block = ResContainer::decodeSolidBlock(s, file.fileOffset, file.flags, mHash, blockSize);
+		if (!block)
+			return false;
+		bool success = file.compressedSize + file.decompressedSize <= blockSize;
+		if (success)
+			dMemcpy(out, block + file.compressedSize, file.decompressedSize);
+		delete [] block;
+		return success;
+	}
+
+	return ResContainer::decodeFileData(s, file, mHash, out);
+}
+
+// Snapshots
+//------------------------------------------------------------------------------
+DirectorySnapshot *ResContainer::buildSnapshot()
+{
+	DirectorySnapshot *snap = new DirectorySnapshot();
+	snap->mHash = mHash;
+	snap->mRefCount = 1; // Ours, until replaced
+
+	if (mSourceResource && mSourceResource->zipPath == NULL)
+	{
+		char buffer[1024];
+		dSprintf(buffer, sizeof(buffer), "%s/%s", mSourceResource->path, mSourceResource->name);
+		snap->mPath = StringTable->insert(buffer);
+	}
+
+	U32 numFiles = 0;
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin(); itr != directorys.end(); itr++)
+		numFiles += (*itr)->numFiles();
+
+	U32 numBuckets = 64;
+	while (numBuckets < numFiles)
+		numBuckets <<= 1;
+	snap->mBuckets.setSize(numBuckets);
+	for (U32 i=0; i<numBuckets; i++)
+		snap->mBuckets[i] = -1;
+	snap->mEntries.reserve(numFiles);
+
+	char buffer[DIRECTORY_SIZE + FILENAME_SIZE + 1];
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin(); itr != directorys.end(); itr++)
+	{
+		DirectoryEntry *dir = *itr;
+		for (DirectoryEntry::iterator file = dir->begin(); file != dir->end(); file++)
+		{
+			if (file->flags & DirectoryEntry::FILE_WHITEOUT)
+				continue;
+
+			StringTableEntry name = StringTable->insert(buildEntryName(buffer, sizeof(buffer), dir->getName(), file->name));
+			U32 bucket = _StringTable::hashString(name) & (numBuckets - 1);
+
+			DirectorySnapshot::Entry *entry = snap->mEntries.increment();
+			entry->name = name;
+			entry->info = *file;
+			entry->next = snap->mBuckets[bucket];
+			snap->mBuckets[bucket] = snap->mEntries.size() - 1;
+		}
+	}
+
+	return snap;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::swapSnapshot(DirectorySnapshot *snap)
+{
+	if (mSnapshot && --mSnapshot->mRefCount == 0)
+		delete mSnapshot;
+	mSnapshot = snap;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::publishSnapshot()
+{
+	mSnapshotsEnabled = true;
+
+	// Readers use their own handles, so anything buffered needs to be in the file first
+	flushStream();
+
+	// Built outside the lock, so readers are only held off for the swap
+	DirectorySnapshot *snap = buildSnapshot();
+	Mutex::lockMutex(mSnapshotMutex);
+	swapSnapshot(snap);
+	Mutex::unlockMutex(mSnapshotMutex);
+}
+
+//------------------------------------------------------------------------------
+DirectorySnapshot *ResContainer::acquireSnapshot()
+{
+	Mutex::lockMutex(mSnapshotMutex);
+	DirectorySnapshot *snap = mSnapshot;
+	if (snap) {
+		snap->mRefCount++;
+		mSnapshotsHeld++;
+	}
+	Mutex::unlockMutex(mSnapshotMutex);
+	return snap;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::releaseSnapshot(DirectorySnapshot *snap)
+{
+	if (!snap)
+		return;
+
+	Mutex::lockMutex(mSnapshotMutex);
+	AssertFatal(mSnapshotsHeld != 0, "ResContainer::releaseSnapshot : snapshot not acquired!");
+	mSnapshotsHeld--;
+	if (--snap->mRefCount == 0)
+		delete snap;
+	Mutex::unlockMutex(mSnapshotMutex);
+}
+
+// Solid blocks
+//------------------------------------------------------------------------------
+bool ResContainer::beginSolidBlock(U32 flags, U32 maxSize)
+{
+	if (!cStream || !mEnableWrite)
+		return false;
+
+	if (mSolidData)
+		endSolidBlock();
+
+	mSolidFlags = flags & (FilterState::PROCESS_ALL | FilterState::ENCRYPT_ALL);
+	mSolidMaxSize = maxSize;
+	mSolidData = new DynMemStream(maxSize + SOLID_MAXFILESIZE);
+	mSolidFiles.clear();
+	return true;
+}
+
+bool ResContainer::endSolidBlock()
+{
+	if (!mSolidData)
+		return false;
+
+	bool success = writeSolidBlock();
+	delete mSolidData;
+	mSolidData = NULL;
+	return success;
+}
+
+bool ResContainer::writeSolidBlock()
+{
+	if (mSolidFiles.size() == 0)
+	{
+		mSolidData->setPosition(0);
+		return true;
+	}
+
+	U32 blockSize = mSolidData->getStreamSize();
+	U32 blockOffset = mDirectoryOffset;
+
+	// Header (stored size is filled in once we know it)
+	cStream->setPosition(blockOffset);
+	cStream->write(blockSize);
+	cStream->write(U32(0));
+
+	ResFilter *filter = getFilter(mSolidFlags);
+	filter->setWriteThreads(mWriteThreads);
+	if (!filter->attachStream(cStream, true)) {
+		delete filter;
+		return false;
+	}
+	if (mHash) filter->setHash(mHash);
+	filter->setStreamOffset(blockOffset + SOLID_HEADER_SIZE, blockSize);
+	bool success = filter->write(blockSize, mSolidData->getData());
+	filter->detachStream(); // Finishes off the compressed stream
+	success = success && !filter->hasWriteFailed();
+	delete filter;
+
+	U32 storedSize = cStream->getPosition() - (blockOffset + SOLID_HEADER_SIZE);
+	cStream->setPosition(blockOffset + sizeof(U32));
+	cStream->write(storedSize);
+
+	if (success)
+	{
+		// Each file points at the block
+		char filePath[FILENAME_SIZE];
+		for (Vector<SolidFile>::iterator itr = mSolidFiles.begin(); itr != mSolidFiles.end(); itr++)
+		{
+			const char *fileName = dStrrchr(itr->name, '/');
+			if (fileName == NULL) {
+				filePath[0] = '\0';
+				fileName = itr->name;
+			}
+			else {
+				dStrncpy(filePath, itr->name, (fileName - itr->name + 1));
+				filePath[fileName - itr->name] = '\0';
+				fileName++;
+			}
+			addFileInfo(filePath, fileName, itr->offset, itr->size, blockOffset, mSolidFlags | DirectoryEntry::FILE_SOLID);
+		}
+		mDirectoryOffset = blockOffset + SOLID_HEADER_SIZE + storedSize;
+	}
+	else
+		Con::errorf("ResContainer::writeSolidBlock : could not write block of %d files", mSolidFiles.size());
+
+	mSolidFiles.clear();
+	mSolidData->setPosition(0);
+	return success;
+}
+
+const U8 *ResContainer::getSolidBlock(Stream &s, U32 blockOffset, U32 flags, U32 &blockSize)
+{
+	mSolidTick++;
+	for (Vector<SolidCacheEntry>::iterator itr = mSolidCache.begin(); itr != mSolidCache.end(); itr++)
+	{
+		if (itr->fileOffset == blockOffset) {
+			itr->lastUsed = mSolidTick;
+			blockSize = itr->size;
+			return itr->data;
+		}
+	}
+
+	if ((flags & FilterState::ENCRYPT_ALL) && (mHash == NULL))
+		return NULL;
+
+	// Not cached, so decode it
+	U32 decodedSize = 0;
+	U8 *data = decodeSolidBlock(s, blockOffset, flags, mHash, decodedSize);
+	if (!data)
+		return NULL;
+
+	// Make room, dropping the least recently used blocks
+	while (mSolidCache.size() != 0 && mSolidCacheSize + decodedSize > SOLID_CACHE_SIZE)
+	{
+		Vector<SolidCacheEntry>::iterator oldest = mSolidCache.begin();
+		for (Vector<SolidCacheEntry>::iterator itr = mSolidCache.begin(); itr != mSolidCache.end(); itr++) {
+			if (itr->lastUsed < oldest->lastUsed)
+				oldest = itr;
+		}
+		mSolidCacheSize -= oldest->size;
+		delete [] oldest->data;
+		mSolidCache.erase(oldest);
+	}
+
+	SolidCacheEntry *entry = mSolidCache.increment();
+	entry->fileOffset = blockOffset;
+	entry->data = data;
+	entry->size = decodedSize;
+	entry->lastUsed = mSolidTick;
+	mSolidCacheSize += decodedSize;
+
+	blockSize = decodedSize;
+	return data;
+}
+
+//------------------------------------------------------------------------------
+U8 *ResContainer::decodeSolidBlock(Stream &s, U32 blockOffset, U32 flags, CryptHash *hash, U32 &blockSize)
+{
+	U32 decodedSize, storedSize;
+	if (!s.setPosition(blockOffset) || !s.read(&decodedSize) || !s.read(&storedSize))
+		return NULL;
+
+	U8 *data = new U8[decodedSize ? decodedSize : 1];
+	ResFilter *filter = getFilter(flags & (FilterState::PROCESS_ALL | FilterState::ENCRYPT_ALL));
+	filter->attachStream(&s, false);
+	if (hash) filter->setHash(hash);
+	filter->setStreamOffset(blockOffset + SOLID_HEADER_SIZE, decodedSize);
+	bool success = decodedSize == 0 || filter->read(decodedSize, data);
+	delete filter;
+
+	if (!success) {
+		Con::errorf("ResContainer::decodeSolidBlock : could not decode block at %d", blockOffset);
+		delete [] data;
+		return NULL;
+	}
+
+	blockSize = decodedSize;
+	return data;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::flushSolidCache()
+{
+	for (Vector<SolidCacheEntry>::iterator itr = mSolidCache.begin(); itr != mSolidCache.end(); itr++)
+		delete [] itr->data;
+	mSolidCache.clear();
+	mSolidCacheSize = 0;
+}
+
+// Content deduplication
+//------------------------------------------------------------------------------
+void ResContainer::setDedup(bool enable)
+{
+	if (enable && !mContentHash) {
+		mContentHash = new CryptHash(ResManager::defaultHash);
+		if (mContentHash->getSize() != CONTENT_DIGEST_SIZE) {
+			Con::errorf("ResContainer::setDedup : hash '%s' unsuitable for content hashing!", ResManager::defaultHash);
+			delete mContentHash;
+			mContentHash = NULL;
+			return;
+		}
+		mContentBuckets.setSize(CONTENT_BUCKETS);
+		for (U32 i=0; i<CONTENT_BUCKETS; i++)
+			mContentBuckets[i] = -1;
+	}
+	else if (!enable && mContentHash) {
+		delete mContentHash;
+		mContentHash = NULL;
+		mContent.clear();
+		mContentBuckets.clear();
+	}
+}
+
+//------------------------------------------------------------------------------
+ResContainer::ContentEntry *ResContainer::findContent(const U8 *digest, U32 size, U32 flags)
+{
+	if (mContentBuckets.size() == 0)
+		return NULL;
+
+	// Digests are well distributed, so the first few bytes make a good bucket key
+	U32 bucket = (digest[0] | (digest[1] << 8)) & (CONTENT_BUCKETS-1);
+	for (S32 idx = mContentBuckets[bucket]; idx != -1; idx = mContent[idx].next)
+	{
+		ContentEntry &content = mContent[idx];
+		if (content.fileOffset == U32(-1) || content.decompressedSize != size)
+			continue;
+		// Data is only the same if it went through the same filters
+		if ((content.flags & (FilterState::PROCESS_ALL | FilterState::ENCRYPT_ALL)) != (flags & (FilterState::PROCESS_ALL | FilterState::ENCRYPT_ALL)))
+			continue;
+		if (!dMemcmp(content.digest, digest, CONTENT_DIGEST_SIZE))
+			return &content;
+	}
+	return NULL;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::addContent(const U8 *digest, U32 fileOffset, U32 compressedSize, U32 size, U32 flags)
+{
+	U32 bucket = (digest[0] | (digest[1] << 8)) & (CONTENT_BUCKETS-1);
+	mContent.increment();
+	ContentEntry &content = mContent.last();
+	dMemcpy(content.digest, digest, CONTENT_DIGEST_SIZE);
+	content.fileOffset = fileOffset;
+	content.compressedSize = compressedSize;
+	content.decompressedSize = size;
+	content.flags = flags;
+	content.next = mContentBuckets[bucket];
+	mContentBuckets[bucket] = mContent.size() - 1;
+}
+
+// Patch stack
+//------------------------------------------------------------------------------
+const char *ResContainer::buildEntryName(char *buffer, U32 size, const char *path, const char *name)
+{
+	if (path == NULL || *path == '\0')
+		dSprintf(buffer, size, "%s", name);
+	else
+		dSprintf(buffer, size, "%s/%s", path, name);
+	return buffer;
+}
+
+//------------------------------------------------------------------------------
+bool ResContainer::mountPatch(ResContainer *patch)
+{
+	ResContainer *root = getRoot();
+	if (patch == NULL || patch == root || patch->mBase != NULL || patch->mPatches.size() != 0)
+	{
+		Con::errorf("ResContainer::mountPatch : patch is already part of a stack!");
+		return false;
+	}
+
+	patch->mBase = root;
+	root->mPatches.push_back(patch);
+	root->mIndexDirty = true;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+bool ResContainer::mountPatch(Resource<ResContainer> &base, Resource<ResContainer> &patch)
+{
+	if (base.isNull() || patch.isNull() || !base->mountPatch(patch))
+		return false;
+
+	// Purging either container would close it, taking the patch out of the stack (or leaving the stack pointing at freed memory),
+	// so both stay locked until the patch is unmounted
+	patch->mBaseHandle = new Resource<ResContainer>(base);
+	patch->mSelfHandle = new Resource<ResContainer>(patch);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::unmountPatch(ResContainer *patch)
+{
+	ResContainer *root = getRoot();
+	for (Vector<ResContainer*>::iterator itr = root->mPatches.begin(); itr != root->mPatches.end(); itr++)
+	{
+		if (*itr == patch) {
+			root->mPatches.erase(itr);
+			patch->mBase = NULL;
+			patch->releaseMountHandles();
+			root->mIndexDirty = true;
+			return;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::releaseMountHandles()
+{
+	// Only unlocks the resources, they are purged later (if at all)
+	delete mBaseHandle;
+	delete mSelfHandle;
+	mBaseHandle = mSelfHandle = NULL;
+}
+
+//------------------------------------------------------------------------------
+ResContainer::IndexEntry *ResContainer::findIndexEntry(StringTableEntry name)
+{
+	if (mIndexBuckets.size() == 0)
+		return NULL;
+
+	U32 bucket = (U32(dsize_t(name)) >> 2) & (mIndexBuckets.size() - 1);
+	for (S32 idx = mIndexBuckets[bucket]; idx != -1; idx = mIndex[idx].next)
+	{
+		if (mIndex[idx].name == name)
+			return &mIndex[idx];
+	}
+	return NULL;
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::indexLayer(ResContainer *layer)
+{
+	char buffer[DIRECTORY_SIZE + FILENAME_SIZE + 1];
+	for (Vector<DirectoryEntry*>::iterator itr = layer->directorys.begin(); itr != layer->directorys.end(); itr++)
+	{
+		DirectoryEntry *dir = *itr;
+		U32 fileIdx = 0;
+		for (DirectoryEntry::iterator file = dir->begin(); file != dir->end(); file++, fileIdx++)
+		{
+			StringTableEntry name = StringTable->insert(buildEntryName(buffer, sizeof(buffer), dir->getName(), file->name));
+			IndexEntry *entry = findIndexEntry(name);
+			if (!entry)
+			{
+				U32 bucket = (U32(dsize_t(name)) >> 2) & (mIndexBuckets.size() - 1);
+				mIndex.increment();
+				entry = &mIndex.last();
+				entry->name = name;
+				entry->next = mIndexBuckets[bucket];
+				mIndexBuckets[bucket] = mIndex.size() - 1;
+			}
+
+			// Newer layers shadow older ones; whiteouts hide the file altogether
+			if (file->flags & DirectoryEntry::FILE_WHITEOUT)
+			{
+				entry->owner = NULL;
+				entry->dir = NULL;
+				entry->fileIdx = 0;
+			}
+			else
+			{
+				entry->owner = layer;
+				entry->dir = dir;
+				entry->fileIdx = fileIdx;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::rebuildIndex()
+{
+	AssertFatal(mBase == NULL, "ResContainer::rebuildIndex : only the root of a stack has an index!");
+
+	// Size the buckets to the number of files in the stack (power of 2)
+	U32 numFiles = 0;
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin(); itr != directorys.end(); itr++)
+		numFiles += (*itr)->numFiles();
+	for (Vector<ResContainer*>::iterator pitr = mPatches.begin(); pitr != mPatches.end(); pitr++)
+		for (Vector<DirectoryEntry*>::iterator itr = (*pitr)->directorys.begin(); itr != (*pitr)->directorys.end(); itr++)
+			numFiles += (*itr)->numFiles();
+
+	U32 numBuckets = 64;
+	while (numBuckets < numFiles)
+		numBuckets <<= 1;
+
+	mIndex.clear();
+	mIndex.reserve(numFiles);
+	mIndexBuckets.setSize(numBuckets);
+	for (U32 i=0; i<numBuckets; i++)
+		mIndexBuckets[i] = -1;
+
+	// Oldest first, so each patch overrides what is beneath it
+	indexLayer(this);
+	for (Vector<ResContainer*>::iterator pitr = mPatches.begin(); pitr != mPatches.end(); pitr++)
+		indexLayer(*pitr);
+
+	mIndexDirty = false;
+}
+
+
+//------------------------------------------------------------------------------
+void ResContainer::setFullPath(const char *path)
+{
+	U32 pathLen = dStrlen(path);
+	
+	// Loop through directory's...
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin();itr != directorys.end();itr++)
+	{
+		DirectoryEntry *entry = *itr;
+		const char *dirName = entry->getName();
+		if (dirName[0] != '\0') {// Not root dir
+			const char *buf = ResManager::buildPath(path, dirName);
+			entry->setFullPath(StringTable->insert(buf));
+		}
+		else
+			entry->setFullPath(StringTable->insert(path));
+	}
+}
+
+//------------------------------------------------------------------------------
+void ResContainer::setHash(CryptHash *hash)
+{
+	if (hash == mHash)
+		return;
+	mHash = hash;
+
+	// Encrypted directory lists need to be processed again with the new key
+	for (Vector<DirectoryEntry*>::iterator itr = directorys.begin(); itr != directorys.end(); itr++) {
+		if ((*itr)->getFlags() & FilterState::ENCRYPT_ALL)
+			(*itr)->markDirty();
+	}
+}
+
+// Access statistics
+//------------------------------------------------------------------------------
+ResFilterStats *ResContainer::findStats(StringTableEntry container, StringTableEntry name)
+{
+	if (gStatsBuckets.size() == 0)
+	{
+		gStatsBuckets.setSize(STATS_BUCKETS);
+		for (U32 i=0; i<STATS_BUCKETS; i++)
+			gStatsBuckets[i] = -1;
+	}
+
+	U32 bucket = ((U32(dsize_t(name)) >> 2) ^ (U32(dsize_t(container)) >> 4)) & (STATS_BUCKETS - 1);
+	for (S32 idx = gStatsBuckets[bucket]; idx != -1; idx = gStats[idx]->next)
+	{
+		if (gStats[idx]->name == name && gStats[idx]->container == container)
+			return gStats[idx];
+	}
+
+	ResFilterStats *stats = new ResFilterStats;
+	dMemset(stats, 0, sizeof(ResFilterStats));
+	stats->container = container;
+	stats->name = name;
+	stats->next = gStatsBuckets[bucket];
+	gStatsBuckets[bucket] = gStats.size();
+	gStats.push_back(stats);
+	return stats;
+}
+
+void ResContainer::dumpStats()
+{
+	U32 opens = 0, rewinds = 0, cacheAllocs = 0;
+	U64 bytesIn = 0, bytesOut = 0;
+	F64 decodeTime = 0;
+
+	Mutex::lockMutex(ResFilter::smStatsMutex);
+	Con::printf("Container access stats (streams still open are counted once they close):");
+	Con::printf("  order  opens     stored    decoded         ms  rewinds  caches  entry");
+	for (Vector<ResFilterStats*>::iterator itr = gStats.begin(); itr != gStats.end(); itr++)
+	{
+		ResFilterStats *stats = *itr;
+		if (stats->opens == 0)
+			continue;
+		Con::printf("  %5u  %5u " STATS_BYTES " " STATS_BYTES " %10.3f  %7u  %6u  %s/%s", stats->touchOrder, stats->opens, stats->bytesIn, stats->bytesOut,
+		            stats->decodeTime / 1000.0, stats->rewinds, stats->cacheAllocs, stats->container, stats->name);
+		opens += stats->opens;
+		bytesIn += stats->bytesIn;
+		bytesOut += stats->bytesOut;
+		decodeTime += stats->decodeTime / 1000.0;
+		rewinds += stats->rewinds;
+		cacheAllocs += stats->cacheAllocs;
+	}
+	Con::printf("  total  %5u " STATS_BYTES " " STATS_BYTES " %10.3f  %7u  %6u", opens, bytesIn, bytesOut, decodeTime, rewinds, cacheAllocs);
+	Mutex::unlockMutex(ResFilter::smStatsMutex);
+}
+
+void ResContainer::resetStats()
+{
+	Mutex::lockMutex(ResFilter::smStatsMutex);
+	for (Vector<ResFilterStats*>::iterator itr = gStats.begin(); itr != gStats.end(); itr++)
+	{
+		ResFilterStats *stats = *itr;
+		stats->touchOrder = 0;
+		stats->opens = 0;
+		stats->bytesIn = 0;
+		stats->bytesOut = 0;
+		stats->decodeTime = 0;
+		stats->rewinds = 0;
+		stats->cacheAllocs = 0;
+	}
+	gTouchCount = 0;
+	Mutex::unlockMutex(ResFilter::smStatsMutex);
+}
+
+bool ResContainer::openTrace(const char *fileName)
+{
+	closeTrace();
+
+	gTraceStream = new FileStream;
+	if (!gTraceStream->open(fileName, FileStream::Write))
+	{
+		Con::errorf("ResContainer::openTrace : could not open '%s'", fileName);
+		delete gTraceStream;
+		gTraceStream = NULL;
+		return false;
+	}
+
+	// Everything opened from now on counts as a first touch
+	resetStats();
+	smEnableStats = true;
+	return true;
+}
+
+void ResContainer::markTrace(const char *label)
+{
+	if (gTraceStream)
+	{
+		char buffer[1024];
+		dSprintf(buffer, sizeof(buffer), "# %s\n", label);
+		gTraceStream->write(dStrlen(buffer), buffer);
+	}
+}
+
+void ResContainer::closeTrace()
+{
+	if (gTraceStream)
+	{
+		gTraceStream->close();
+		delete gTraceStream;
+		gTraceStream = NULL;
+	}
+}
+
+ConsoleFunction(enableContainerStats, void, 2, 2, "(enable) Counts how container entries are read")
+{
+	ResContainer::smEnableStats = dAtob(argv[1]);
+}
+
+ConsoleFunction(dumpContainerStats, void, 1, 1, "Prints access counters for every container entry opened")
+{
+	ResContainer::dumpStats();
+}
+
+ConsoleFunction(resetContainerStats, void, 1, 1, "Zeros access counters for every container entry")
+{
+	ResContainer::resetStats();
+}
+
+ConsoleFunction(traceContainerAccess, bool, 2, 2, "(file) Writes container entries to file in the order they are first opened. Pass \"\" to stop")
+{
+	if (argv[1][0] == '\0')
+	{
+		ResContainer::closeTrace();
+		return true;
+	}
+	return ResContainer::openTrace(argv[1]);
+}
+
+ConsoleFunction(markContainerTrace, void, 2, 2, "(label) Starts a new group of entries in the container access trace")
+{
+	ResContainer::markTrace(argv[1]);
+}
+
+// Transaction ConsoleFunction's
+//------------------------------------------------------------------------------
+#ifdef RES_ENABLECONTAINERWRITE
+static ResContainer *openContainerForWrite(const char *fn, const char *fileName)
+{
+	Resource<ResContainer> con = ResourceManager->load(fileName);
+	if (con.isNull() || !con->open(true))
+	{
+		Con::errorf("%s : could not open '%s' for writing", fn, fileName);
+		return NULL;
+	}
+	return con;
+}
+
+ConsoleFunction(beginContainerTransaction, bool, 2, 2, "(container) Holds back changes to container until commitContainerTransaction()")
+{
+	ResContainer *con = openContainerForWrite("beginContainerTransaction", argv[1]);
+	return con ? con->beginTransaction() : false;
+}
+
+ConsoleFunction(commitContainerTransaction, bool, 2, 2, "(container) Safely writes out changes made to container since beginContainerTransaction()")
+{
+	ResContainer *con = openContainerForWrite("commitContainerTransaction", argv[1]);
+	return con ? con->commitTransaction() : false;
+}
+
+ConsoleFunction(abortContainerTransaction, bool, 2, 2, "(container) Discards changes made to container since beginContainerTransaction()")
+{
+	ResContainer *con = openContainerForWrite("abortContainerTransaction", argv[1]);
+	return con ? con->abortTransaction() : false;
+}
+#endif
+
+// Patch ConsoleFunction's
+//------------------------------------------------------------------------------
+ConsoleFunction(mountContainerPatch, bool, 3, 3, "(base, patch) Stacks the patch container over base")
+{
+	Resource<ResContainer> base = ResourceManager->load(argv[1]);
+	Resource<ResContainer> patch = ResourceManager->load(argv[2]);
+	if (base.isNull() || patch.isNull())
+	{
+		Con::errorf("mountContainerPatch : could not load '%s' or '%s'", argv[1], argv[2]);
+		return false;
+	}
+	return ResContainer::mountPatch(base, patch);
+}
+
+ConsoleFunction(unmountContainerPatch, bool, 3, 3, "(base, patch) Removes the patch container from the stack over base")
+{
+	Resource<ResContainer> base = ResourceManager->load(argv[1]);
+	Resource<ResContainer> patch = ResourceManager->load(argv[2]);
+	if (base.isNull() || patch.isNull() || patch->getRoot() != base->getRoot() || patch->getBase() == NULL)
+	{
+		Con::errorf("unmountContainerPatch : '%s' is not mounted over '%s'", argv[2], argv[1]);
+		return false;
+	}
+	base->unmountPatch(patch);
+	return true;
+}
+
+// Preload ConsoleFunction's
+//------------------------------------------------------------------------------
+ConsoleFunction(preloadContainerFiles, S32, 3, 3, "(container, files) Reads a tab separated list of files from container in one go, "
+                "keeping each in memory until it is next opened. Returns the number of files read")
+{
+	Resource<ResContainer> con = ResourceManager->load(argv[1]);
+	if (con.isNull())
+	{
+		Con::errorf("preloadContainerFiles : could not load '%s'", argv[1]);
+		return 0;
+	}
+
+	// Split up a copy of the list in place
+	char *list = new char[dStrlen(argv[2]) + 1];
+	dStrcpy(list, argv[2]);
+	Vector<const char*> files;
+	for (char *field = list; field; )
+	{
+		char *next = dStrchr(field, '\t');
+		if (next) *next++ = '\0';
+		if (*field) files.push_back(field);
+		field = next;
+	}
+
+	U32 numRead = files.size() ? con->preloadFiles(files.address(), files.size()) : 0;
+	delete [] list;
+	return numRead;
 }
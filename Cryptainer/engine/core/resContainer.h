@@ -26,9 +26,21 @@
 #include "core/resFilter.h"
 #endif
 
+#ifndef _PLATFORMMUTEX_H_
+#include "platform/platformMutex.h"
+#endif
+
 #define DIRECTORY_SIZE 128
 #define FILENAME_SIZE 128
 #define CHUNK_PROCSIZE 4096  // How big the dummy buffer for file deletion is
+#define ADDFILE_CHUNKSIZE 65536 // How much data addFile() pulls from its source at a time
+#define CONTENT_DIGEST_SIZE 32 // Size of content hash (sha256)
+#define CONTENT_BUCKETS 1024   // Number of buckets in content hash table (power of 2)
+#define STATS_BUCKETS 1024     // Number of buckets in access stats table (power of 2)
+#define SOLID_HEADER_SIZE 8          // Size of solid block header (decoded size, stored size)
+#define SOLID_BLOCKSIZE (1024*1024)  // Default amount of file data in a solid block
+#define SOLID_MAXFILESIZE 65536      // Files larger than this are not put in solid blocks
+#define SOLID_CACHE_SIZE (4*1024*1024) // Amount of decoded solid block data a container keeps around
 
 /// DirectoryEntry
 ///
@@ -36,6 +48,9 @@
 ///
 /// The FileInfo list can be Processed, and/or Encrypted like file data in ResContainer, which is advantageous when one does not want a user to easily see information about files in the directory.
 ///
+/// The processed FileInfo list is kept in memory once read or written, and is only rebuilt when the directory changes, so writing out
+/// a container after changing one directory does not re-process every other directory.
+///
 /// @note The directory name is NOT passed though ResFilter.
 class DirectoryEntry
 {
@@ -53,6 +68,14 @@ public:
 		U32 fileOffset;				///< Offset of start of data for file in the Container
 		U32 flags;					///< ResFilter flags for file data
 	};
+
+	/// Entry flags
+	///
+	/// These share FileInfo::flags with the ResFilter flags. ResFilter only looks at the PROCESS_* and ENCRYPT_* bits, so they are ignored when the file data is read.
+	enum {
+		FILE_WHITEOUT = BIT(31),	///< File is deleted; hides the file of the same name in any container beneath this one
+		FILE_SOLID = BIT(29),		///< File is part of the solid block at fileOffset; compressedSize is the offset of the file in the decoded block
+	};
 protected:
 	/// DirectoryInfo
 	///
@@ -73,6 +96,10 @@ private:
 	char mDirname[DIRECTORY_SIZE];	///< name of directory
 	StringTableEntry mFullPath;		///< full path to the directory from container root
 	ResContainer *mObject;			///< Container object
+	U8 *mData;							///< Processed FileInfo list, as last read or written (mDirectoryInfo.compressedSize bytes)
+	bool mDirty;						///< FileInfo list changed since mData was built?
+
+	void buildData();					///< Processes the FileInfo list into mData
 	/// @}
 public:
 	/// @name Useful File iterators & tools
@@ -88,7 +115,7 @@ public:
 
 	/// @name White flags
 	/// @{
-	void setFlags(U32 flags) {mDirectoryInfo.flags = flags;}
+	void setFlags(U32 flags) {mDirectoryInfo.flags = flags; mDirty = true;}
 	void setFlags(const char *name, U32 flags);
 	U32 getFlags()          {return mDirectoryInfo.flags;}
 	U32 getFlags(const char *name);
@@ -104,6 +131,9 @@ public:
 	/// @{
 	void read(Stream &s);	///< Reads DirectoryEntry from Stream
 	void write(Stream &s);	///< Writes DirectoryEntry to Stream
+
+	void markDirty() {mDirty = true;}	///< FileInfo list needs to be processed again on the next write
+	bool isDirty() {return mDirty;}
 	/// @}
 
 	/// @name Management of file records in directory
@@ -117,9 +147,60 @@ public:
 	/// @{
 	DirectoryEntry(ResContainer *obj);
 	DirectoryEntry(ResContainer *obj, const char *name, U32 flags);
+	~DirectoryEntry();
 	/// @}
 };
 
+/// DirectorySnapshot
+///
+/// A copy of a container's file list, as of the last time it was published (see ResContainer::publishSnapshot()).
+///
+/// Snapshots let other threads read from a container while one thread writes to it. A reader takes a reference to the current snapshot,
+/// and opens its own handle to the container file, so it never touches the container's stream or directory's. Snapshots are never changed
+/// once published; the writer publishes a new one instead, and old ones are freed when their last reader releases them. While any reader
+/// holds a snapshot, deleted files leave holes rather than having the data after them moved down.
+///
+/// Only the container's own files are included, not those of patches mounted over it (each patch can publish snapshots of its own, and
+/// a reader wanting the patched view has to check each layer, newest first). Files in solid blocks are decoded by the reader without
+/// going through the container's block cache.
+///
+/// e.g.
+///
+///    DirectorySnapshot *snap = container->acquireSnapshot();
+///    Stream *s = snap->openReader();
+///    const DirectoryEntry::FileInfo *file = snap->find("saves/slot1.sav");
+///    if (file) snap->readFile(*s, *file, buffer);
+///    delete s;
+///    container->releaseSnapshot(snap);
+class DirectorySnapshot
+{
+	friend class ResContainer;
+protected:
+	struct Entry
+	{
+		StringTableEntry name;				///< Full path of the file from the container root
+		DirectoryEntry::FileInfo info;
+		S32 next;								///< Next entry in the bucket chain
+	};
+
+	StringTableEntry mPath;		///< Path of the container file (NULL if it isn't a file on disk)
+	CryptHash *mHash;				///< Key of the container when published
+	Vector<Entry> mEntries;
+	Vector<S32> mBuckets;		///< Hash buckets into mEntries (power of 2)
+	U32 mRefCount;					///< References, including the container's own while we are current
+
+	DirectorySnapshot();
+public:
+	const DirectoryEntry::FileInfo *find(const char *filename) const;	///< Finds file by full path (case insensitive)
+
+	U32 size() const {return mEntries.size();}
+	const char *getName(U32 idx) const {return mEntries[idx].name;}
+	const DirectoryEntry::FileInfo &getFile(U32 idx) const {return mEntries[idx].info;}
+
+	Stream *openReader() const;	///< Opens a new read only handle to the container file. Delete it when done
+	bool readFile(Stream &s, const DirectoryEntry::FileInfo &file, U8 *out) const;	///< Decodes file into out (decompressedSize bytes), reading from s (see openReader())
+};
+
 /// ResContainer
 ///
 /// This is a generic container interface that handles storing files in other files (e.g. zip, tar).
@@ -141,6 +222,141 @@ protected:
 	CryptHash *mHash;							///< Hash'd key
 	U32 mDirectoryOffset;					///< Location in file of directory list
 	bool mEnableWrite;						///< Should we allow write operations?
+	U32 mWriteThreads;						///< Threads new files are compressed on (see ResFilter::setWriteThreads())
+	U32 mWrittenOffset;						///< Location of the directory list the header of cStream points to (-1 if unknown)
+	U32 mWrittenEnd;							///< End of the directory list the header of cStream points to (-1 if unknown)
+	bool mDirListDirty;						///< Directory's added or removed since the list was last written?
+	/// @}
+
+	/// @name Transactions
+	/// @{
+	U32 mTransaction;							///< Depth of beginTransaction() calls
+	U32 mTransactionStart;					///< mDirectoryOffset when the transaction started
+	bool mSyncWrites;							///< Sync cStream before and after writing the header?
+
+	void syncStream();						///< Makes sure everything written to cStream is on disk
+	/// @}
+
+	/// @name Patch stack
+	///
+	/// Patch containers can be stacked over a base container. The base (the root of the stack) keeps a merged index of every
+	/// layer, so a lookup resolves to the newest copy of a file in O(1), regardless of how many patches are mounted.
+	/// @{
+	struct IndexEntry
+	{
+		StringTableEntry name;	///< Full path of the file from the container root
+		ResContainer *owner;		///< Container holding the newest copy (NULL if whited out)
+		DirectoryEntry *dir;		///< Directory holding the newest copy
+		U32 fileIdx;				///< Index of the FileInfo in dir
+		S32 next;					///< Next entry in the bucket chain
+	};
+
+	ResContainer *mBase;					///< Container we are mounted over (NULL if we are the root)
+	Resource<ResContainer> *mBaseHandle;	///< Keeps the container we are mounted over loaded (NULL if mounted without handles)
+	Resource<ResContainer> *mSelfHandle;	///< Keeps us loaded while we are mounted (NULL if mounted without handles)
+	Vector<ResContainer*> mPatches;	///< Patches mounted over us, oldest first (root only)
+	Vector<IndexEntry> mIndex;			///< Merged index of the stack (root only)
+	Vector<S32> mIndexBuckets;			///< Hash buckets into mIndex
+	bool mIndexDirty;						///< Merged index needs rebuilding?
+
+	void releaseMountHandles();			///< Unlocks mBaseHandle and mSelfHandle
+
+	void markIndexDirty() {ResContainer *root = getRoot(); root->mIndexDirty = true; root->flushPreloaded();}
+	void rebuildIndex();						///< Rebuilds the merged index from every layer of the stack
+	void indexLayer(ResContainer *layer);	///< Adds files from layer to the merged index, shadowing older entries
+	IndexEntry *findIndexEntry(StringTableEntry name);
+	/// @}
+
+	/// @name Content deduplication
+	///
+	/// When enabled, the data of every file passed to addFile() is hashed. Files with identical data and flags share one stored copy,
+	/// with each FileInfo pointing at the same fileOffset/compressedSize. delFile() reference counts entries by their fileOffset, so
+	/// shared data is only removed once the last entry using it goes.
+	/// @{
+	struct ContentEntry
+	{
+		U8 digest[CONTENT_DIGEST_SIZE];	///< Hash of the unprocessed file data
+		U32 fileOffset;						///< Location of the stored data (-1 if removed)
+		U32 compressedSize;					///< Size of the stored data
+		U32 decompressedSize;				///< Size of the unprocessed file data
+		U32 flags;								///< ResFilter flags the data was stored with
+		S32 next;								///< Next entry in the bucket chain
+	};
+
+	CryptHash *mContentHash;			///< Hash used to digest file data (NULL if dedup is disabled)
+	Vector<ContentEntry> mContent;	///< Data added since dedup was enabled
+	Vector<S32> mContentBuckets;		///< Hash buckets into mContent
+
+	ContentEntry *findContent(const U8 *digest, U32 size, U32 flags);
+	void addContent(const U8 *digest, U32 fileOffset, U32 compressedSize, U32 size, U32 flags);
+	/// @}
+
+	/// @name Solid blocks
+	///
+	/// Small files can be compressed together in a solid block, sharing one compression state, so redundancy between files is used.
+	/// A block is stored as [U32 decoded size][U32 stored size][filtered data]. Files in a block have FILE_SOLID set, their fileOffset
+	/// pointing at the block, and their compressedSize holding the offset of the file within the decoded block.
+	///
+	/// Decoded blocks are kept in a small LRU cache, so reading the neighbours of a file just read only costs a copy.
+	/// @{
+	struct SolidFile
+	{
+		StringTableEntry name;	///< Full path of the file from the container root
+		U32 offset;				///< Offset of the file in the block
+		U32 size;				///< Size of the file
+	};
+
+	struct SolidCacheEntry
+	{
+		U32 fileOffset;			///< Location of the block
+		U8 *data;				///< Decoded block
+		U32 size;				///< Size of decoded block
+		U32 lastUsed;			///< Tick the block was last read
+	};
+
+	DynMemStream *mSolidData;				///< Block being built (NULL if we aren't building one)
+	U32 mSolidFlags;							///< ResFilter flags for the block being built
+	U32 mSolidMaxSize;						///< Size at which the block being built is written out
+	Vector<SolidFile> mSolidFiles;		///< Files in the block being built
+	Vector<SolidCacheEntry> mSolidCache;	///< Decoded blocks
+	U32 mSolidCacheSize;						///< Total size of decoded blocks
+	U32 mSolidTick;							///< Incremented on every block read
+
+	const U8 *getSolidBlock(Stream &s, U32 blockOffset, U32 flags, U32 &blockSize);	///< Finds decoded block in the cache, reading it in if needed
+	void flushSolidCache();
+	bool writeSolidBlock();
+	/// @}
+
+	/// @name Snapshots
+	/// @{
+	void *mSnapshotMutex;					///< Guards mSnapshot, mSnapshotsHeld and snapshot reference counts
+	DirectorySnapshot *mSnapshot;			///< Current snapshot (NULL if none published)
+	U32 mSnapshotsHeld;						///< References held by readers, over every snapshot
+	bool mSnapshotsEnabled;					///< Publish a new snapshot whenever the container is written?
+
+	DirectorySnapshot *buildSnapshot();	///< Copies the current file list
+	void swapSnapshot(DirectorySnapshot *snap);	///< Makes snap current (mSnapshotMutex must be locked)
+	/// @}
+
+	/// @name Preloading
+	/// @{
+	struct PreloadEntry
+	{
+		StringTableEntry name;	///< Full path of the file from the container root
+		DynMemStream *data;		///< Decoded file, handed over by the next getFileStream() on it
+	};
+
+	Vector<PreloadEntry> mPreloaded;	///< Files read ahead by preloadFiles() (root only)
+
+	Stream *takePreloaded(const char *path, const char *name);	///< Removes a file from mPreloaded, returning its data (NULL if it wasn't preloaded)
+	/// @}
+
+	/// @name File data helpers
+	/// @{
+	void addFileInfo(const char *filePath, const char *fileName, U32 compressedSize, U32 size, U32 fileOffset, U32 flags);	///< Adds FileInfo, creating the directory if needed
+	U32 countFileRefs(U32 fileOffset, U32 compressedSize, bool solid);	///< Number of FileInfo's using the data (or solid block) at fileOffset
+	void removeFileData(U32 dataStart, U32 dataSize);			///< Removes data from the container stream, moving everything after it down
+	void flushStream();												///< Writes out anything buffered in cStream, so other handles to the file can see it
 	/// @}
 public:
 	/// @name Generic I/O for headers in container
@@ -151,8 +367,9 @@ public:
 	bool read(Stream &s);						///< Loads container explicitly from a stream
 	bool read() {return read(*cStream);}	///< Reads in a container file (header and Directory Info)
 	bool write(Stream &s);						///< Explicit write to stream
-	bool write() {return write(*cStream);}	///< Writes out container (header and Directory Info)
-	bool close();									///< Closes container. Deletes stream, and removes entry's
+	bool write() {return write(*cStream);}	///< Writes out container (header and Directory Info). Only changed directory's are processed again, and the list the header points to is never written over (dmfar reclaims old lists).
+	bool isDirty();								///< Has anything changed since the container was last read or written?
+	bool close();									///< Closes container (discarding any unfinished transaction). Deletes stream, and removes entry's
 
 	bool isOpen() {return cStream;}	///< Opened stream?
 	/// @}
@@ -171,7 +388,19 @@ public:
 
 	bool addFilteredFile(const char *name, U8 *ptr, U32 compressedSize, U32 size, U32 flags);	///< Adds a file with already processed data
 	bool addFile(const char *name, U8 *ptr, U32 size, U32 flags);				///< Adds a file to the container (replaces if exists)
+	bool addFile(const char *name, Stream &source, U32 size, U32 flags);	///< Adds size bytes from source's current position, in ADDFILE_CHUNKSIZE chunks (replaces if exists, once the new data is written)
 	bool delFile(const char *name);	///< Removes a file from the container
+	bool addWhiteout(const char *name);	///< Marks a file as deleted, hiding it in containers beneath this one
+
+	bool beginSolidBlock(U32 flags, U32 maxSize = SOLID_BLOCKSIZE);	///< Files up to SOLID_MAXFILESIZE passed to addFile() are compressed together from now on, in blocks of about maxSize
+	bool endSolidBlock();						///< Writes out the block being built, and stops building blocks
+	bool inSolidBlock() {return mSolidData != NULL;}
+
+	void setWriteThreads(U32 threads) {mWriteThreads = threads;}	///< Threads to compress new files on, where the compressor supports it
+	U32 getWriteThreads() {return mWriteThreads;}
+
+	void setDedup(bool enable);				///< Store files with identical data once (applies to files added from now on)
+	bool getDedup() {return mContentHash != NULL;}
 
 	void setHash(CryptHash *hash);			///< Sets the key of the container via a hash object
 	CryptHash *getHash() {return mHash;}	///< Gets the key of the container in the form of a hash
@@ -183,14 +412,84 @@ public:
 	DirectoryEntry::iterator getFile(ResourceObject *obj);///< Gets file entry from ResourceObject
 	DirectoryEntry::iterator getFile(const char *path, const char *name); ///< Gets file entry from path and name
 	DirectoryEntry::iterator getFile(const char *filename); ///< Gets file entry from filename
+	DirectoryEntry::iterator getFile(const char *path, const char *name, ResContainer **owner); ///< Gets newest file entry in the patch stack, and the container holding it
+	DirectoryEntry::iterator getLocalFile(const char *path, const char *name); ///< Gets file entry from this container only, ignoring the patch stack
 	void setStream(Stream *stream) {cStream = stream;}		///< Sets the containers stream
 
+	static const char *buildEntryName(char *buffer, U32 size, const char *path, const char *name); ///< Builds "path/name"
+
 	static ResFilter *getFilter(U32 flags);		///< Wrapper to get filter according to flags
+	/// getFileStream() and readFileData() share the container's solid block cache without locking. Only call them from the thread
+	/// which owns the container (the one writing to it, and the resource manager's); other threads should read through a DirectorySnapshot.
 	ResFilter *getFileStream(ResourceObject *obj);	///< Opens a READ ONLY Stream of file from container
+	bool readFileData(Stream &s, const DirectoryEntry::FileInfo &file, U8 *out);	///< Decodes file into out (decompressedSize bytes), reading from s (a stream of this container)
+
+	static bool decodeFileData(Stream &s, const DirectoryEntry::FileInfo &file, CryptHash *hash, U8 *out);	///< As readFileData(), for files not in solid blocks
+	static U8 *decodeSolidBlock(Stream &s, U32 blockOffset, U32 flags, CryptHash *hash, U32 &blockSize);	///< Reads and decodes a solid block (delete [] when done)
+	/// @}
+
+	/// @name Snapshots
+	///
+	/// See DirectorySnapshot. publishSnapshot() must be called from the thread writing to the container; acquireSnapshot() and
+	/// releaseSnapshot() can be called from any thread.
+	/// @{
+	void publishSnapshot();									///< Makes the current file list available to readers, and does so again after every write()
+	DirectorySnapshot *acquireSnapshot();				///< References the current snapshot (NULL if none published)
+	void releaseSnapshot(DirectorySnapshot *snap);	///< Releases a reference from acquireSnapshot()
+	/// @}
+
+	/// @name Transactions
+	///
+	/// Between beginTransaction() and commitTransaction(), nothing the header points to is overwritten. File data and the new directory list
+	/// are appended after the current list, and deleted files leave holes instead of moving data down. commitTransaction() writes the
+	/// new list, syncs, then points the header at it and syncs again, so a crash at any point leaves either the old or the new container.
+	///
+	/// Any number of files can be saved in one transaction, for the cost of one pair of syncs. The holes (and old directory lists) left
+	/// behind can be reclaimed by repacking the container with dmfar.
+	/// @{
+	bool beginTransaction();					///< Starts (or nests) a transaction. write() does nothing until it is committed
+	bool commitTransaction();				///< Writes out changes made in the outermost transaction
+	bool abortTransaction();				///< Discards every change made since the outermost beginTransaction()
+	bool inTransaction() {return mTransaction != 0;}
+	/// @}
+
+	/// @name Preloading
+	///
+	/// preloadFiles() reads a set of files from the stack in one ResBatchRead, which on Linux can submit every read at once via io_uring.
+	/// Each file is kept in memory until getFileStream() is next asked for it, so the files a level needs can be read in one go before
+	/// the level loads them one by one. Files which are never opened are dropped when the stack next changes, or by flushPreloaded().
+	/// @{
+	U32 preloadFiles(const char **files, U32 count);	///< Reads files ahead of use ("path/name" from the root). Returns the number read
+	void flushPreloaded();										///< Frees preloaded files which haven't been opened
+	/// @}
+
+	/// @name Access statistics
+	///
+	/// When smEnableStats is set, each stream opened by getFileStream() counts how its entry is read (see ResFilterStats).
+	/// Counters are kept for the life of the program, so streams can safely outlive their container.
+	///
+	/// Optionally, the first time each entry is opened a line is written to a trace file ("container<tab>entry"), which dmfar can use to reorder an archive.
+	/// @{
+	static bool smEnableStats;							///< Count accesses?
+	static ResFilterStats *findStats(StringTableEntry container, StringTableEntry name);	///< Finds (or adds) the counters for an entry (lock ResFilter::smStatsMutex first)
+	static void dumpStats();							///< Prints all counters to the console
+	static void resetStats();							///< Zeros all counters
+	static bool openTrace(const char *fileName);	///< Starts writing first-touch lines to fileName (enables stats)
+	static void markTrace(const char *label);		///< Starts a new group of entries in the trace (e.g. "mission load")
+	static void closeTrace();
+	/// @}
+
+	/// @name Patch stack
+	/// @{
+	bool mountPatch(ResContainer *patch);		///< Stacks patch over this container's stack
+	static bool mountPatch(Resource<ResContainer> &base, Resource<ResContainer> &patch);	///< Stacks patch over base, keeping both loaded until the patch is unmounted
+	void unmountPatch(ResContainer *patch);	///< Removes patch from this container's stack
+	ResContainer *getBase() {return mBase;}	///< Container we are mounted over
+	ResContainer *getRoot() {ResContainer *c = this; while (c->mBase) c = c->mBase; return c;}	///< Base of the stack
 	/// @}
 
 	ResContainer();
-	virtual ~ResContainer() {close();}
+	virtual ~ResContainer();
 
 	/// @name Directory iterators
 	/// @{
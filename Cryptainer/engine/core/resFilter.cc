@@ -8,6 +8,35 @@
 #include "core/memstream.h"
 #include "core/resFilter.h"
 #include "core/resManager.h"
+#include "platform/platformMutex.h"
+
+#if defined(TORQUE_OS_WIN32)
+#include <windows.h>
+#elif defined(TORQUE_OS_LINUX) || defined(TORQUE_OS_MAC_OSX)
+#include <sys/time.h>
+#endif
+
+U32 ResFilter::smNumCacheAllocs = 0;
+void *ResFilter::smStatsMutex = Mutex::createMutex();
+
+U32 ResFilter::getMicroseconds()
+{
+	// Most reads take well under a millisecond, which Platform::getRealMilliseconds() would count as nothing at all
+#if defined(TORQUE_OS_WIN32)
+	static LARGE_INTEGER freq = {0};
+	LARGE_INTEGER count;
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return U32((count.QuadPart / freq.QuadPart) * 1000000 + ((count.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart);
+#elif defined(TORQUE_OS_LINUX) || defined(TORQUE_OS_MAC_OSX)
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return U32(tv.tv_sec) * 1000000 + U32(tv.tv_usec);
+#else
+	return Platform::getRealMilliseconds() * 1000;
+#endif
+}
 
 ResFilter::ResFilter(U32 aTag)
  : m_pStream(NULL),
@@ -16,11 +45,17 @@ ResFilter::ResFilter(U32 aTag)
    m_currOffset(0),
    m_decompressedOffset(0),
    compressedCache(NULL),
-   hasWrit(false)
+   cryptCache(NULL),
+   hasWrit(false),
+   mPassthrough(false),
+   mStats(NULL),
+   mWriteThreads(1),
+   mWriteFailed(false)
 {
 	mWriteCompressState = mCompressState = mEncryptState = NULL;
 	mTag = aTag;
 	mResource = NULL;
+	dMemset(&mPendingStats, 0, sizeof(mPendingStats));
 }
 
 ResFilter::~ResFilter()
@@ -32,13 +67,19 @@ bool ResFilter::allocCache(bool enableWrite)
 {
 	deallocCache();
 	compressedCache = new U8[BLOCKWRITE_SIZE];
-	return compressedCache != NULL;
+	if (mEncryptState)
+		cryptCache = new U8[BLOCKWRITE_SIZE+32];
+	smNumCacheAllocs++;
+	if (mStats) mPendingStats.cacheAllocs++;
+	return compressedCache != NULL && (!mEncryptState || cryptCache != NULL);
 }
 
 void ResFilter::deallocCache()
 {
 	if (compressedCache) delete [] compressedCache;
 	compressedCache = NULL;
+	if (cryptCache) delete [] cryptCache;
+	cryptCache = NULL;
 }
 
 bool ResFilter::attachStream(Stream* io_pSlaveStream)
@@ -46,6 +87,27 @@ bool ResFilter::attachStream(Stream* io_pSlaveStream)
 	return attachStream(io_pSlaveStream, true);
 }
 
+//-----------------------------------------------------------------------------
+bool ResFilter::canDecodeBuffer(U32 flags, U32 outSize)
+{
+	// Handlers only know their own format, so encrypted data would have to be decrypted first
+	if (flags & FilterState::ENCRYPT_ALL)
+		return false;
+
+	FilterState *handler = FilterState::findHandler(flags & FilterState::PROCESS_ALL);
+	return handler && handler->canDecodeBuffer(outSize);
+}
+
+bool ResFilter::decodeBuffer(U32 flags, const U8 *in, U32 inSize, U8 *out, U32 outSize)
+{
+	if (flags & FilterState::ENCRYPT_ALL)
+		return false;
+
+	FilterState *handler = FilterState::findHandler(flags & FilterState::PROCESS_ALL);
+	return handler && handler->decodeBuffer(in, inSize, out, outSize);
+}
+
+//-----------------------------------------------------------------------------
 bool ResFilter::attachStream(Stream* io_pSlaveStream, bool enableWrite)
 {
 	AssertFatal(io_pSlaveStream != NULL, "NULL Slave stream?");
@@ -56,6 +118,7 @@ bool ResFilter::attachStream(Stream* io_pSlaveStream, bool enableWrite)
 	m_currOffset  = 0;
 	m_decompressedOffset = 0;
 	hasWrit = false;
+	mWriteFailed = false;
 
 	// Setup state's
 	FilterState *handler = NULL;
@@ -64,13 +127,15 @@ bool ResFilter::attachStream(Stream* io_pSlaveStream, bool enableWrite)
 	// Compression...
 	if (handler = FilterState::findHandler(mTag & FilterState::PROCESS_ALL))
 	{
-		mCompressState = handler->init(mTag & FilterState::PROCESS_ALL);
+		mCompressState = handler->acquire(mTag & FilterState::PROCESS_ALL);
 		mCompressState->dataIn(NULL, 0);
 
 		// Compressors DO require seperate write states
 		// since the compression modifies the filesize, and therefor requires the state to be specifically configured.
 		if (enableWrite) {
-			mWriteCompressState =  handler->init((mTag & FilterState::PROCESS_ALL) | FilterState::FILTER_WRITE);
+			mWriteCompressState =  handler->acquire((mTag & FilterState::PROCESS_ALL) | FilterState::FILTER_WRITE);
+			if (mWriteThreads > 1)
+				mWriteCompressState->setThreads(mWriteThreads);
 		}
 	}
 	else {
@@ -82,13 +147,17 @@ bool ResFilter::attachStream(Stream* io_pSlaveStream, bool enableWrite)
 	if (handler = FilterState::findHandler(mTag & FilterState::ENCRYPT_ALL))
 	{
 		// mEncryptState is a generic encryptor, which requires one to set the key, though we leave that to the external interface
-		mEncryptState = handler->init(mTag);
+		mEncryptState = handler->acquire(mTag);
 
 		// Cryptor's via libtomcrypt do not require seperate write states
 		// typically, they will write a RNG state upon the first write(), or read one upon the first read()
 		// It is therefor important that the filter is reset when the position is changed in the stream (when starting again from 0).
 	}
 
+	// Stored data without encryption is the same in the parent stream as it is to us.
+	// In that case _read() can skip the cache and read directly into the callers buffer.
+	mPassthrough = !enableWrite && ((mTag & FilterState::PROCESS_ALL) == FilterState::PROCESS_BASIC) && (mEncryptState == NULL);
+
 	allocCache(enableWrite);
 
 	setStatus(Ok);
@@ -114,22 +183,31 @@ void ResFilter::detachStream()
 			// However, we also need to take into account if the cache is already full.
 			// To save hastle, we flush the cache, then keep telling the compressor to end,
 			// until it is happy.
-			flushWrite();
+			success = flushWrite();
 			mWriteCompressState->dataIn(NULL, 0);
-			while (!mWriteCompressState->end())
+			while (success && !mWriteCompressState->end())
 			{
-				if (mWriteCompressState->dataOut() == 0)
-					flushWrite();
+				if (mWriteCompressState->hasFailed())
+					success = false;
+				else if (mWriteCompressState->dataOut() == 0)
+					success = flushWrite();
 		    }
-			if (mWriteCompressState->dataOut() < BLOCKWRITE_SIZE)
-				flushWrite();
+			if (success && mWriteCompressState->dataOut() < BLOCKWRITE_SIZE)
+				success = flushWrite();
+		}
+
+		if (!success) {
+			Con::errorf("ResFilter::detachStream() : could not finish writing the stream!");
+			mWriteFailed = true;
 		}
 	}
 
-	// Kill state's
-	if (mCompressState) delete mCompressState;
-	if (mWriteCompressState) delete mWriteCompressState;
-	if (mEncryptState) delete mEncryptState;
+	flushStats();
+
+	// Hand state's back for reuse
+	FilterState::release(mCompressState);
+	FilterState::release(mWriteCompressState);
+	FilterState::release(mEncryptState);
 
 	mWriteCompressState = mCompressState = mEncryptState = NULL; // For you, valgrind
 
@@ -137,11 +215,34 @@ void ResFilter::detachStream()
 	m_startOffset = 0;
 	m_currOffset  = 0;
 	m_decompressedOffset = 0;
+	mPassthrough  = false;
 	deallocCache();
 
 	setStatus(Closed);
 }
 
+void ResFilter::setStats(ResFilterStats *stats)
+{
+	flushStats();
+	mStats = stats;
+}
+
+void ResFilter::flushStats()
+{
+	// Counted without locking as the stream is read, then added in all at once
+	if (mStats)
+	{
+		Mutex::lockMutex(smStatsMutex);
+		mStats->bytesIn += mPendingStats.bytesIn;
+		mStats->bytesOut += mPendingStats.bytesOut;
+		mStats->decodeTime += mPendingStats.decodeTime;
+		mStats->rewinds += mPendingStats.rewinds;
+		mStats->cacheAllocs += mPendingStats.cacheAllocs;
+		Mutex::unlockMutex(smStatsMutex);
+	}
+	dMemset(&mPendingStats, 0, sizeof(mPendingStats));
+}
+
 Stream* ResFilter::getStream()
 {
    return m_pStream;
@@ -186,35 +287,47 @@ bool ResFilter::setPosition(const U32 in_newPosition)
 	if (m_pStream == NULL)
 		return false;
 
+	// Stored data maps 1:1 onto the parent stream, so we can jump straight there
+	if (mPassthrough)
+	{
+		if (in_newPosition > m_streamLen)
+			return false;
+		if (in_newPosition < m_decompressedOffset && mStats) mPendingStats.rewinds++;
+		m_currOffset = in_newPosition;
+		m_decompressedOffset = in_newPosition;
+		mCompressState->dataIn(NULL, 0); // Anything staged is now out of date
+		setStatus(in_newPosition < m_streamLen ? Ok : EOS);
+		return true;
+	}
+
 	/*
 		How we seek :
 
 		1) If the position is < than our current compressed position, we go to the beginning(reset compression buffer), then do 2)
-		2) If the position is > than our compressed position, we read in the difference with read()
+		2) If the position is > than our compressed position, we read in the difference
 	*/
 
-	U8 seekCache[512];
 	if (in_newPosition < m_decompressedOffset)
 	{
-		
+		if (mStats) mPendingStats.rewinds++;
+
 		// Set everything to the beginning
 		m_currOffset = 0;
 		m_decompressedOffset = 0;
 		// Reset cryptor if available
 		if (mEncryptState) mEncryptState->reset();
 		mCompressState->reset();
+		mCompressState->dataIn(NULL, 0);
+		setStatus(Ok);
+	}
 
-		// Then read to the position by dumping to seekCache every time (sloow)
-		U32 seekPos = 0;
-		while (seekPos != in_newPosition)
-		{
-			U32 toRead = seekPos + 512 > in_newPosition ? in_newPosition - seekPos : 512;
-			if (!_read(toRead, &seekCache)) return false;
-			seekPos += toRead;
-		}
+	// Then read to the position by dumping to seekCache every time (sloow)
+	U8 seekCache[512];
+	while (m_decompressedOffset != in_newPosition)
+	{
+		U32 toRead = in_newPosition - m_decompressedOffset > 512 ? 512 : in_newPosition - m_decompressedOffset;
+		if (!_read(toRead, &seekCache)) return false;
 	}
-	else if (in_newPosition != m_decompressedOffset)
-		return _read(in_newPosition - m_decompressedOffset, NULL);
 	return true;
 }
 
@@ -224,6 +337,19 @@ U32 ResFilter::getStreamSize()
 }
 
 bool ResFilter::_read(const U32 in_numBytes, void* out_pBuffer)
+{
+	if (!mStats)
+		return readData(in_numBytes, out_pBuffer);
+
+	U32 startTime = getMicroseconds();
+	U32 startOffset = m_decompressedOffset;
+	bool ret = readData(in_numBytes, out_pBuffer);
+	mPendingStats.decodeTime += getMicroseconds() - startTime;
+	mPendingStats.bytesOut += m_decompressedOffset - startOffset;
+	return ret;
+}
+
+bool ResFilter::readData(const U32 in_numBytes, void* out_pBuffer)
 {
 	AssertFatal(m_pStream != NULL, "Error, stream not attached");
 
@@ -244,11 +370,6 @@ bool ResFilter::_read(const U32 in_numBytes, void* out_pBuffer)
 		fillRead(); // read() after just written data
 	}
 
-	// On the first read, we need to fill up the buffer,
-	// or of course if anything weird happens.
-	if (mCompressState->dataIn() == 0)
-		fillRead();
-
 	U8 *ptr = (U8*)out_pBuffer;        // Pointer to where we are writing to in out_pBuffer
 	U8 *finishRead = ptr + in_numBytes;// Pointer to where we should stop reading
 
@@ -266,6 +387,46 @@ bool ResFilter::_read(const U32 in_numBytes, void* out_pBuffer)
 		finishRead = ptr + realRead;
 	}
 
+	// Large reads of stored data go directly from the parent stream into out_pBuffer,
+	// once anything still staged in compressedCache has been used up.
+	if (mPassthrough && U32(finishRead - ptr) >= BLOCKREAD_SIZE)
+	{
+		U32 staged = mCompressState->dataIn();
+		if (staged != 0)
+		{
+			mCompressState->dataOut(ptr, staged);
+			while (mCompressState->dataOut() != 0) {
+				if (!mCompressState->reverseProcess()) break;
+			}
+			ptr += staged;
+			m_decompressedOffset += staged;
+		}
+
+		U32 directRead = finishRead - ptr;
+		if (m_pStream->getPosition() != (m_startOffset + m_currOffset))
+		{
+			if (!m_pStream->setPosition(m_startOffset + m_currOffset)) {
+				setStatus(EOS);
+				return false;
+			}
+		}
+		if (!m_pStream->read(directRead, ptr)) {
+			setStatus(EOS);
+			return false;
+		}
+		m_currOffset += directRead;
+		m_decompressedOffset += directRead;
+		if (mStats) mPendingStats.bytesIn += directRead;
+
+		setStatus(m_pStream->getStatus());
+		return true;
+	}
+
+	// On the first read, we need to fill up the buffer,
+	// or of course if anything weird happens.
+	if (mCompressState->dataIn() == 0)
+		fillRead();
+
 	// Keep reading utill we have got the desired actualSize of bytes
 	while (ptr != finishRead)
 	{
@@ -307,9 +468,6 @@ bool ResFilter::_read(const U32 in_numBytes, void* out_pBuffer)
 	return true;
 }
 
-// Temporary buffer where encrypted data goes to get decrypted
-static U8 cryptCache[BLOCKWRITE_SIZE+32];
-
 bool ResFilter::fillRead()
 {
 	// Read in *compressed* data
@@ -331,6 +489,7 @@ bool ResFilter::fillRead()
 	if (m_pStream->read(actualReadSize, apprCache) == true)
 	{
 		m_currOffset += actualReadSize;
+		if (mStats) mPendingStats.bytesIn += actualReadSize;
 		// Setup crypt and compress states
 		if (mEncryptState)
 		{
@@ -422,6 +581,12 @@ bool ResFilter::_write(const U32 in_numBytes, const void* in_pBuffer)
 			if (!mWriteCompressState->process())  break;
 		}
 
+		if (mWriteCompressState->hasFailed()) {
+			mWriteFailed = true;
+			setStatus(IOError);
+			return false;
+		}
+
 		// Update ptr, determined by the amount of data left to read in
 		// Ideally should be full size in one pass, unless we ran out of out, or failed
 		U32 decompressedWrite =  ((finishWrite - ptr) - mWriteCompressState->dataIn());
@@ -436,11 +601,13 @@ bool ResFilter::_write(const U32 in_numBytes, const void* in_pBuffer)
 			if (mWriteCompressState->dataOut() != 0) {
 				// Crap! State must have failed
 				AssertFatal(false, "ResFilter::_write() : process() must have failed!");
+				mWriteFailed = true;
 				setStatus(EOS);
 				return false;
 			}
 			// Dump out data
 			if (!flushWrite()) {
+				mWriteFailed = true;
 				setStatus(EOS);
 				return false;
 			}
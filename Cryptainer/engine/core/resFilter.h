@@ -21,6 +21,24 @@
 
 class ResourceObject;
 
+/// Access counters for a container entry
+///
+/// ResFilter counts how the entry is read once they are set via ResFilter::setStats(), adding its counts in when the stream is detached.
+/// Several threads may be reading the same entry, so only touch these while holding ResFilter::smStatsMutex.
+struct ResFilterStats
+{
+	StringTableEntry container;	///< Full path of the container holding the entry
+	StringTableEntry name;	///< Entry name (path/name from the container root)
+	U32 touchOrder;			///< Order in which the entry was first opened
+	U32 opens;					///< Number of times a stream was opened on the entry
+	U64 bytesIn;				///< Stored bytes read from the container
+	U64 bytesOut;				///< Decoded bytes returned from read()
+	U32 decodeTime;			///< Microseconds spent in read(), including reading stored data
+	U32 rewinds;				///< Backward seeks, which restart decoding from the start of the entry
+	U32 cacheAllocs;			///< Read/write caches allocated for the entry
+	S32 next;					///< Next entry in the bucket chain
+};
+
 /// Resource filter main class
 ///
 /// The data in this FilterStream stream goes through two steps (all optional, though a Basic Process is at least required) :
@@ -50,6 +68,11 @@ class ResFilter : public FilterStream
 	FilterState *mEncryptState;			///< Encrypt Handler (crypt's the stream with a key)
 	bool hasWrit;								///< Tells us if _write() has been called. Used on stream detach
 	U32 mTag;									///< Tag that specifies which set of FilterState's to use
+	bool mPassthrough;						///< Data is stored & unencrypted, so large reads can skip compressedCache
+	ResFilterStats *mStats;					///< Access counters to update (NULL if not tracked)
+	ResFilterStats mPendingStats;			///< Counts not yet added to mStats
+	U32 mWriteThreads;						///< Threads the write state may compress on
+	bool mWriteFailed;						///< Did writing fail? (kept after detachStream(), until the next attachStream())
 	/// @}
 	
 	/// @name Details for this stream
@@ -60,6 +83,7 @@ class ResFilter : public FilterStream
 	/// @name I/O buffer
 	/// @{
 	U8 *compressedCache;	///< Compressed data cache
+	U8 *cryptCache;		///< Encrypted data, on its way to or from compressedCache (NULL if we don't encrypt)
 	
 	bool allocCache(bool enableWrite);	///< Allocates new cache data
 	void deallocCache();						///< Free's allocated cache data
@@ -73,6 +97,7 @@ class ResFilter : public FilterStream
 	bool    attachStream(Stream* io_pSlaveStream);						///< Attach to stream; Assume read-only
 	bool    attachStream(Stream* io_pSlaveStream, bool readMode);	///< Attach to stream; Optionally write
 	void    detachStream();														///< Detatch slave stream
+	bool    hasWriteFailed() {return mWriteFailed;}					///< Did any write, or finishing the stream in detachStream(), fail?
 	Stream* getStream();															///< Get slave stream
 	U32     getFlags() {return mTag;}										///< Get tags used to create filter
 	
@@ -90,6 +115,20 @@ class ResFilter : public FilterStream
 	void setHash(CryptHash *hash) {if (mEncryptState) mEncryptState->setHash(hash);}
 
 	static void printHandlers();	///< Prints a list of available FilterState's to the console
+
+	static bool canDecodeBuffer(U32 flags, U32 outSize);	///< Should data stored with flags be decoded in one go with decodeBuffer()?
+	static bool decodeBuffer(U32 flags, const U8 *in, U32 inSize, U8 *out, U32 outSize);	///< Decodes a complete stored stream (see FilterState::decodeBuffer())
+
+	static U32 smNumCacheAllocs;	///< Number of read/write caches allocated so far (for profiling)
+
+	void setStats(ResFilterStats *stats);	///< Sets counters to update (opens are counted by the caller)
+	ResFilterStats *getStats() {return mStats;}
+	void flushStats();						///< Adds counts so far to the counters from setStats()
+
+	static void *smStatsMutex;				///< Guards every ResFilterStats
+	static U32 getMicroseconds();			///< High resolution clock for timing reads (wraps around, so only use differences)
+
+	void setWriteThreads(U32 threads) {mWriteThreads = threads;}	///< Threads to compress on, where the compressor supports it; set before attachStream()
 	
 	bool flushWrite();	///< Flush write buffer to slave stream's current position
 	bool fillRead();		///< Fill read buffer, reading in new data from slave stream's current position
@@ -99,6 +138,7 @@ class ResFilter : public FilterStream
 	protected:
 	
 	bool _read(const U32 in_numBytes,  void* out_pBuffer);
+	bool readData(const U32 in_numBytes,  void* out_pBuffer);	///< Does the actual work of _read()
 	bool _write(const U32 in_numBytes, const void* in_pBuffer);
 
 	ResourceObject *mResource; ///< Pointer to owner resource for tracking (on write)
@@ -6,13 +6,157 @@
 #include "console/console.h"
 #include "core/filterState.h"
 
+#include "platform/platformThread.h"
+
 #include "bzlib.h"
 
+#define BZIP2_PARALLEL_MINSIZE (1024*1024) // Smallest output worth decoding in parallel
+#define BZIP2_MAX_THREADS 16                // Most threads used by decodeBuffer()
+
 extern "C" void bz_internal_error(int errorcode)
 {
 	Con::errorf("BZLIB: internal error %i", errorcode); 
 }
 
+// Parallel decoding
+//
+// A bzip2 stream is a header ("BZh" + block size), a series of blocks, and an end of stream marker. Each block starts with
+// a 48 bit magic number and the CRC of its data, and is independent of the others, but blocks are not byte aligned.
+//
+// To decode blocks in parallel, the stream is scanned for block magic, then each block is copied into a stream of its own,
+// with a header and an end of stream marker (whose combined CRC for a single block is the CRC of the block). The decoded
+// blocks are then joined together. A block magic number can also turn up by chance in compressed data, though any block
+// split in the wrong place fails its CRC check; in which case the stream is left to reverseProcess().
+//------------------------------------------------------------------------------
+static const U64 gBzipMagicMask = ((U64)0xFFFF << 32) | 0xFFFFFFFF;
+static const U64 gBzipBlockMagic = ((U64)0x3141 << 32) | 0x59265359;
+static const U64 gBzipEndMagic = ((U64)0x1772 << 32) | 0x45385090;
+
+static U32 readBits(const U8 *in, U32 bitPos, U32 count)
+{
+	U32 value = 0;
+	for (U32 i=0; i<count; i++, bitPos++)
+		value = (value << 1) | ((in[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+	return value;
+}
+
+static void writeBits(U8 *out, U32 &bitPos, U32 value, U32 count)
+{
+	for (S32 i=count-1; i>=0; i--, bitPos++) {
+		if ((value >> i) & 1)
+			out[bitPos >> 3] |= 0x80 >> (bitPos & 7);
+	}
+}
+
+struct BzipBlockJob
+{
+	const U8 *in;					///< Stored stream
+	U8 level;						///< Block size digit from the header
+	Vector<U32> blockStart;		///< Bit offset of each block's magic, plus the end of stream marker
+	Vector<U8*> blockData;		///< Decoded blocks
+	Vector<U32> blockSize;		///< Size of decoded blocks
+	U32 next;						///< Next block to decode
+	bool failed;					///< Did any block fail to decode?
+	void *mutex;					///< Guards next and failed
+
+	bool decodeBlock(U32 idx);
+	void work();
+};
+
+bool BzipBlockJob::decodeBlock(U32 idx)
+{
+	U32 start = blockStart[idx];
+	U32 numBits = blockStart[idx+1] - start;
+	U32 crc = readBits(in, start + 48, 32);
+
+	// Rebuild the block as a stream of its own, byte aligning it on the way
+	U32 streamSize = 4 + (numBits >> 3) + 12;
+	U8 *stream = new U8[streamSize];
+	dMemset(stream, 0, streamSize);
+	stream[0] = 'B'; stream[1] = 'Z'; stream[2] = 'h'; stream[3] = level;
+
+	const U8 *src = in + (start >> 3);
+	U32 shift = start & 7;
+	U32 numBytes = numBits >> 3;
+	for (U32 i=0; i<numBytes; i++)
+		stream[4 + i] = shift ? (U8)((src[i] << shift) | (src[i+1] >> (8 - shift))) : src[i];
+
+	U32 bitPos = (4 + numBytes) * 8;
+	writeBits(stream, bitPos, readBits(in, start + numBytes * 8, numBits & 7), numBits & 7);
+	writeBits(stream, bitPos, 0x1772, 16);
+	writeBits(stream, bitPos, 0x45385090, 32);
+	writeBits(stream, bitPos, crc, 32);
+
+	// Decoded size isn't known up front (bzip2 run length encodes before the block is sorted), so grow as needed
+	bz_stream bz;
+	bz.bzalloc = NULL;
+	bz.bzfree = NULL;
+	bz.opaque = NULL;
+	if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK) {
+		delete [] stream;
+		return false;
+	}
+
+	U32 outSize = (level - '0') * 100000 * 2;
+	U8 *out = (U8*)dMalloc(outSize);
+	bz.next_in = (char*)stream;
+	bz.avail_in = (bitPos + 7) >> 3;
+	bz.next_out = (char*)out;
+	bz.avail_out = outSize;
+
+	S32 ret;
+	while ((ret = BZ2_bzDecompress(&bz)) == BZ_OK)
+	{
+		if (bz.avail_out != 0)
+			break; // Ran out of input before the end of the stream
+		out = (U8*)dRealloc(out, outSize * 2);
+		bz.next_out = (char*)out + outSize;
+		bz.avail_out = outSize;
+		outSize *= 2;
+	}
+
+	U32 decoded = outSize - bz.avail_out;
+	BZ2_bzDecompressEnd(&bz);
+	delete [] stream;
+
+	if (ret != BZ_STREAM_END) {
+		dFree(out);
+		return false;
+	}
+
+	blockData[idx] = out;
+	blockSize[idx] = decoded;
+	return true;
+}
+
+void BzipBlockJob::work()
+{
+	for (;;)
+	{
+		Mutex::lockMutex(mutex);
+		U32 idx = next++;
+		bool stop = failed || idx >= blockData.size();
+		Mutex::unlockMutex(mutex);
+		if (stop)
+			return;
+
+		if (!decodeBlock(idx)) {
+			Mutex::lockMutex(mutex);
+			failed = true;
+			Mutex::unlockMutex(mutex);
+			return;
+		}
+	}
+}
+
+class BzipBlockThread : public Thread
+{
+	BzipBlockJob *mJob;
+public:
+	BzipBlockThread(BzipBlockJob *job) : Thread(0, 0, false) {mJob = job;}
+	virtual void run(S32 arg) {mJob->work();}
+};
+
 class BzipState : public FilterState
 {
 	private:
@@ -137,6 +281,97 @@ class BzipState : public FilterState
 		return true;
 	}
 
+	bool canDecodeBuffer(U32 outSize)
+	{
+		return outSize >= BZIP2_PARALLEL_MINSIZE && smDecodeThreads > 1;
+	}
+
+	bool decodeBuffer(const U8 *in, U32 inSize, U8 *out, U32 outSize)
+	{
+		if (inSize < 14 || in[0] != 'B' || in[1] != 'Z' || in[2] != 'h' || in[3] < '1' || in[3] > '9')
+			return false;
+
+		BzipBlockJob job;
+		job.in = in;
+		job.level = in[3];
+		job.next = 0;
+		job.failed = false;
+
+		// Find the blocks, and the end of the stream
+		U64 window = 0;
+		U32 endBit = 0;
+		for (U32 i=4; i<inSize && endBit == 0; i++)
+		{
+			for (S32 bit=7; bit>=0; bit--)
+			{
+				window = (window << 1) | ((in[i] >> bit) & 1);
+				U64 tag = window & gBzipMagicMask;
+				U32 bitPos = (i * 8) + (8 - bit);
+				if (bitPos < 32 + 48)
+					continue; // Not enough of the stream in the window yet
+				if (tag == gBzipBlockMagic)
+					job.blockStart.push_back(bitPos - 48);
+				else if (tag == gBzipEndMagic) {
+					endBit = bitPos - 48;
+					break;
+				}
+			}
+		}
+
+		// Only worth it for several blocks; also needs room for the combined CRC after the end marker
+		if (job.blockStart.size() < 2 || endBit == 0 || job.blockStart[0] != 32 || ((endBit + 80 + 7) >> 3) > inSize)
+			return false;
+
+		// The stream CRC combines every block CRC, so checks the blocks were found correctly
+		U32 combinedCRC = 0;
+		for (U32 i=0; i<job.blockStart.size(); i++)
+			combinedCRC = ((combinedCRC << 1) | (combinedCRC >> 31)) ^ readBits(in, job.blockStart[i] + 48, 32);
+		if (combinedCRC != readBits(in, endBit + 48, 32))
+			return false;
+
+		U32 numBlocks = job.blockStart.size();
+		job.blockStart.push_back(endBit);
+		job.blockData.setSize(numBlocks);
+		job.blockSize.setSize(numBlocks);
+		for (U32 i=0; i<numBlocks; i++) {
+			job.blockData[i] = NULL;
+			job.blockSize[i] = 0;
+		}
+
+		// Decode on this thread, plus as many more as are useful
+		job.mutex = Mutex::createMutex();
+		U32 numThreads = getMin(getMin(smDecodeThreads, numBlocks), (U32)BZIP2_MAX_THREADS);
+		Vector<BzipBlockThread*> threads;
+		for (U32 i=1; i<numThreads; i++) {
+			BzipBlockThread *thread = new BzipBlockThread(&job);
+			thread->start();
+			threads.push_back(thread);
+		}
+		job.work();
+		for (U32 i=0; i<threads.size(); i++) {
+			threads[i]->join();
+			delete threads[i];
+		}
+		Mutex::destroyMutex(job.mutex);
+
+		// Join up the blocks
+		bool success = !job.failed;
+		U32 outPos = 0;
+		for (U32 i=0; i<numBlocks; i++)
+		{
+			if (success && job.blockData[i] && outPos + job.blockSize[i] <= outSize) {
+				dMemcpy(out + outPos, job.blockData[i], job.blockSize[i]);
+				outPos += job.blockSize[i];
+			}
+			else
+				success = false;
+			if (job.blockData[i])
+				dFree(job.blockData[i]);
+		}
+
+		return success && outPos == outSize;
+	}
+
 	bool reverseProcess()
 	{
 		// Ok, we need to call inflate() until the output buffer is full.
@@ -6,16 +6,210 @@
 #include "console/console.h"
 #include "core/filterState.h"
 
+#include "platform/platformThread.h"
+
 #include "zlib.h"
 
+#define ZIPARENA_SIZE (2*1024*1024) // Most idle memory ZipArena keeps around
+#define ZIP_DICT_SIZE (32*1024)         // Window deflate can refer back into
+#define ZIP_PARALLEL_CHUNK (128*1024)   // Input compressed by each job in parallel mode
+#define ZIP_PARALLEL_BATCH 4            // Chunks per thread staged before they are compressed
+#define ZIP_MAX_THREADS 16              // Most threads setThreads() will accept
+
+// ZipArena
+//
+// zlib allocates a few large blocks for every stream (the window, and for deflate the hash chains and pending buffer),
+// which are the same size for every stream of the same kind. Blocks freed by finished streams are kept, so the next
+// stream can take them rather than going back to the system allocator.
+//------------------------------------------------------------------------------
+struct ZipArenaBlock
+{
+	U32 size;					// Size of the block, excluding this header
+	ZipArenaBlock *next;		// Next idle block
+};
+
+static ZipArenaBlock *gArenaFree = NULL;
+static U32 gArenaSize = 0;
+static void *gArenaMutex = NULL;
+
+static voidpf zipAlloc(voidpf opaque, uInt items, uInt size)
+{
+	U32 bytes = items * size;
+	ZipArenaBlock *block = NULL;
+
+	Mutex::lockMutex(gArenaMutex);
+	for (ZipArenaBlock **walker = &gArenaFree; *walker; walker = &(*walker)->next)
+	{
+		if ((*walker)->size == bytes) {
+			block = *walker;
+			*walker = block->next;
+			gArenaSize -= bytes;
+			break;
+		}
+	}
+	Mutex::unlockMutex(gArenaMutex);
+
+	if (!block) {
+		block = (ZipArenaBlock*)dMalloc(sizeof(ZipArenaBlock) + bytes);
+		if (!block) return Z_NULL;
+		block->size = bytes;
+	}
+	return (voidpf)(block + 1);
+}
+
+static void zipFree(voidpf opaque, voidpf address)
+{
+	ZipArenaBlock *block = ((ZipArenaBlock*)address) - 1;
+
+	Mutex::lockMutex(gArenaMutex);
+	if (gArenaSize + block->size <= ZIPARENA_SIZE) {
+		block->next = gArenaFree;
+		gArenaFree = block;
+		gArenaSize += block->size;
+		block = NULL;
+	}
+	Mutex::unlockMutex(gArenaMutex);
+
+	if (block)
+		dFree(block);
+}
+
+static void zipFlushArena()
+{
+	Mutex::lockMutex(gArenaMutex);
+	ZipArenaBlock *block = gArenaFree;
+	gArenaFree = NULL;
+	gArenaSize = 0;
+	Mutex::unlockMutex(gArenaMutex);
+
+	while (block) {
+		ZipArenaBlock *next = block->next;
+		dFree(block);
+		block = next;
+	}
+}
+
+// Parallel compression
+//
+// Input is split into chunks, each of which is compressed by its own deflate stream, primed with the 32KB of input
+// before the chunk as its dictionary (so matches can still reach back across the boundary). Every chunk but the last is
+// ended with Z_SYNC_FLUSH, which byte aligns the output without marking the end of the stream, and the last with Z_FINISH.
+// Joined together, the chunks make up one raw deflate stream which inflates just like one compressed in a single pass.
+//------------------------------------------------------------------------------
+struct ZipChunkJob
+{
+	const U8 *in;					///< Staged input, starting with the dictionary for the first chunk
+	Vector<U32> chunkStart;		///< Offset of each chunk in in, plus the end of the last chunk
+	Vector<U8*> chunkData;		///< Compressed chunks
+	Vector<U32> chunkSize;		///< Size of compressed chunks
+	bool finish;					///< Does the last chunk end the stream?
+	U32 next;						///< Next chunk to compress
+	bool failed;					///< Did any chunk fail to compress?
+	void *mutex;					///< Guards next and failed
+
+	bool compressChunk(z_stream_s *zs, U32 idx);
+	void work();
+};
+
+bool ZipChunkJob::compressChunk(z_stream_s *zs, U32 idx)
+{
+	U32 start = chunkStart[idx];
+	U32 size = chunkStart[idx+1] - start;
+	bool last = finish && (idx == chunkData.size()-1);
+
+	deflateReset(zs);
+	U32 dictSize = getMin(start, (U32)ZIP_DICT_SIZE);
+	if (dictSize != 0)
+		deflateSetDictionary(zs, in + start - dictSize, dictSize);
+
+	// Worst case is all stored blocks (as compressBound(), which older zlib lacks), plus the sync marker
+	U32 outSize = size + (size >> 12) + (size >> 14) + (size >> 25) + 13 + 16;
+	U8 *out = (U8*)dMalloc(outSize);
+	if (!out)
+		return false;
+	zs->next_in = (Bytef*)(in + start);
+	zs->avail_in = size;
+	zs->next_out = out;
+	zs->avail_out = outSize;
+
+	S32 ret = deflate(zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+	if ((last && ret != Z_STREAM_END) || (!last && (ret != Z_OK || zs->avail_out == 0)) || zs->avail_in != 0) {
+		dFree(out);
+		return false;
+	}
+
+	chunkData[idx] = out;
+	chunkSize[idx] = outSize - zs->avail_out;
+	return true;
+}
+
+void ZipChunkJob::work()
+{
+	// One deflate stream per thread, reset for each chunk
+	z_stream_s zs;
+	zs.zalloc = zipAlloc;
+	zs.zfree = zipFree;
+	zs.opaque = Z_NULL;
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+		Mutex::lockMutex(mutex);
+		failed = true;
+		Mutex::unlockMutex(mutex);
+		return;
+	}
+
+	for (;;)
+	{
+		Mutex::lockMutex(mutex);
+		U32 idx = next++;
+		bool stop = failed || idx >= chunkData.size();
+		Mutex::unlockMutex(mutex);
+		if (stop)
+			break;
+
+		if (!compressChunk(&zs, idx)) {
+			Mutex::lockMutex(mutex);
+			failed = true;
+			Mutex::unlockMutex(mutex);
+			break;
+		}
+	}
+
+	deflateEnd(&zs);
+}
+
+class ZipChunkThread : public Thread
+{
+	ZipChunkJob *mJob;
+public:
+	ZipChunkThread(ZipChunkJob *job) : Thread(0, 0, false) {mJob = job;}
+	virtual void run(S32 arg) {mJob->work();}
+};
+
 class ZipState : public FilterState
 {
 	private:
 		z_stream_s *m_pZipStream;
 		static ZipState moMyself;
+
+		/// @name Parallel compression (write states with mThreads > 1)
+		/// @{
+		U32 mThreads;			///< Threads to compress on
+		U8 *mPending;			///< Staged input; the last 32KB of previous input, then input yet to be compressed
+		U32 mPendingSize;		///< Amount of mPending in use
+		U32 mPendingMax;		///< Size of mPending
+		U32 mDictSize;			///< Amount of mPending which has already been compressed
+		U8 *mQueue;				///< Compressed data yet to be copied to the output buffer
+		U32 mQueueSize;
+		U32 mQueuePos;
+		U32 mQueueMax;			///< Size of mQueue
+		bool mFinished;		///< Has the end of the stream been compressed?
+		/// @}
+
+		bool mFailed;			///< Has compression failed? (sticky until reset(), as the output is no longer a valid stream)
 	public:
 
 	virtual FilterState *init(U32 flags) {return new ZipState(flags);}
+	virtual void flushCaches() {zipFlushArena();}
 
 	ZipState()
 	{
@@ -26,15 +220,21 @@ class ZipState : public FilterState
 		mInfoString = (char*)ln;
 		registerHandler(this);
 
+		// Created by our static instance, before any other threads are about
+		if (!gArenaMutex)
+			gArenaMutex = Mutex::createMutex();
+
 		m_pZipStream = NULL;
+		mFailed = false;
+		initParallel();
 	}
 
 	ZipState(U32 flags)
 	{
 		m_pZipStream = new z_stream_s;
 
-		m_pZipStream->zalloc = Z_NULL;//myMalloc;
-		m_pZipStream->zfree  = Z_NULL;//myFree;
+		m_pZipStream->zalloc = zipAlloc;
+		m_pZipStream->zfree  = zipFree;
 		m_pZipStream->opaque = Z_NULL;
 
 		m_pZipStream->next_in  = NULL;
@@ -45,22 +245,38 @@ class ZipState : public FilterState
 		m_pZipStream->total_out = 0;
 
 		mFlags = flags;
+		mFailed = false;
 		if (mFlags & FilterState::FILTER_WRITE)
-			deflateInit2(m_pZipStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+			mFailed = deflateInit2(m_pZipStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK;
 		else
 			inflateInit2(m_pZipStream, -MAX_WBITS);
+		initParallel();
+	}
+
+	void initParallel()
+	{
+		mThreads = 1;
+		mPending = NULL;
+		mPendingSize = mPendingMax = mDictSize = 0;
+		mQueue = NULL;
+		mQueueSize = mQueuePos = mQueueMax = 0;
+		mFinished = false;
+	}
+
+	void freeParallel()
+	{
+		if (mPending) dFree(mPending);
+		if (mQueue) dFree(mQueue);
+		initParallel();
 	}
 
 	void reset()
 	{
+		// Keeps the memory zlib has allocated, so this is cheap enough to do every time the state is reused
 		if (mFlags & FilterState::FILTER_WRITE)
-			deflateEnd(m_pZipStream);
+			deflateReset(m_pZipStream);
 		else
-			inflateEnd(m_pZipStream);
-
-		m_pZipStream->zalloc = Z_NULL;//myMalloc;
-		m_pZipStream->zfree  = Z_NULL;//myFree;
-		m_pZipStream->opaque = Z_NULL;
+			inflateReset(m_pZipStream);
 
 		m_pZipStream->next_in  = NULL;
 		m_pZipStream->avail_in = 0;
@@ -69,14 +285,37 @@ class ZipState : public FilterState
 		m_pZipStream->avail_out = 0;
 		m_pZipStream->total_out = 0;
 
-		if (mFlags & FilterState::FILTER_WRITE)
-			deflateInit2(m_pZipStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
-		else
-			inflateInit2(m_pZipStream, -MAX_WBITS);
+		// Staging buffers are kept, as the same file is being written again
+		mPendingSize = mDictSize = 0;
+		mQueueSize = mQueuePos = 0;
+		mFinished = false;
+		mFailed = false;
+	}
+
+	void recycle()
+	{
+		// Staging buffers are large, and the next user may well not want threads
+		reset();
+		freeParallel();
+	}
+
+	void setThreads(U32 threads)
+	{
+		if (!(mFlags & FilterState::FILTER_WRITE))
+			return;
+		AssertFatal(mPendingSize == 0 && mQueueSize == 0, "ZipState::setThreads: data has already been written!");
+
+		threads = getMax(getMin(threads, (U32)ZIP_MAX_THREADS), (U32)1);
+		if (threads != mThreads)
+		{
+			freeParallel();
+			mThreads = threads;
+		}
 	}
 
 	~ZipState()
 	{
+		freeParallel();
 		if (m_pZipStream == NULL) return;
 		if (mFlags & FilterState::FILTER_WRITE)
 			deflateEnd(m_pZipStream);
@@ -109,14 +348,36 @@ class ZipState : public FilterState
 		m_pZipStream->total_out = 0;
 	}
 
+	bool hasFailed()
+	{
+		return mFailed;
+	}
+
 	bool end()
 	{
+		if (mFailed)
+			return false;
+		if (mThreads > 1)
+			return endParallel();
+
 		// NOTE: filter will be unusable following success!
-		return deflate(m_pZipStream, Z_FINISH) == Z_STREAM_END;
+		S32 retVal = deflate(m_pZipStream, Z_FINISH);
+		if (retVal == Z_STREAM_END)
+			return true;
+		if (retVal != Z_OK && retVal != Z_BUF_ERROR) {
+			Con::warnf("ZipState:: error in end (%s)!", m_pZipStream->msg);
+			mFailed = true;
+		}
+		return false; // Output buffer is full
 	}
 
 	bool process()
 	{
+		if (mFailed)
+			return false;
+		if (mThreads > 1)
+			return processParallel();
+
 		// Ok, we need to call deflate() until the output buffer is full.
 		// First check if we are out of data - return false if none to signal end
 		if (m_pZipStream->avail_in == 0)
@@ -136,6 +397,7 @@ class ZipState : public FilterState
 			AssertFatal(retVal !=  Z_BUF_ERROR, "ZlibSubWStream::_write: invalid buffer");
 			if (retVal != Z_OK) {
 				Con::warnf("ZipState:: error in process (%s)!", m_pZipStream->msg);
+				mFailed = true;
 				return false;
 			}
 		}
@@ -143,6 +405,157 @@ class ZipState : public FilterState
 		return true;
 	}
 
+	/// Copies as much of mQueue as will fit into the output buffer
+	void drainQueue()
+	{
+		U32 amount = getMin(mQueueSize - mQueuePos, (U32)m_pZipStream->avail_out);
+		if (amount == 0)
+			return;
+		dMemcpy(m_pZipStream->next_out, mQueue + mQueuePos, amount);
+		m_pZipStream->next_out += amount;
+		m_pZipStream->avail_out -= amount;
+		m_pZipStream->total_out += amount;
+		mQueuePos += amount;
+	}
+
+	/// Compresses everything staged in mPending into mQueue
+	bool compressPending(bool finish)
+	{
+		AssertFatal(mQueuePos == mQueueSize, "ZipState::compressPending: output still queued!");
+
+		ZipChunkJob job;
+		job.in = mPending;
+		job.finish = finish;
+		job.next = 0;
+		job.failed = false;
+		for (U32 pos = mDictSize; pos < mPendingSize; pos += ZIP_PARALLEL_CHUNK)
+			job.chunkStart.push_back(pos);
+		if (finish && job.chunkStart.size() == 0)
+			job.chunkStart.push_back(mPendingSize); // Nothing left, but the stream still needs its final block
+		if (job.chunkStart.size() == 0)
+			return true;
+
+		U32 numChunks = job.chunkStart.size();
+		job.chunkStart.push_back(mPendingSize);
+		job.chunkData.setSize(numChunks);
+		job.chunkSize.setSize(numChunks);
+		for (U32 i=0; i<numChunks; i++) {
+			job.chunkData[i] = NULL;
+			job.chunkSize[i] = 0;
+		}
+
+		// Compress on this thread, plus as many more as are useful
+		job.mutex = Mutex::createMutex();
+		U32 numThreads = getMin(mThreads, numChunks);
+		Vector<ZipChunkThread*> threads;
+		for (U32 i=1; i<numThreads; i++) {
+			ZipChunkThread *thread = new ZipChunkThread(&job);
+			thread->start();
+			threads.push_back(thread);
+		}
+		job.work();
+		for (U32 i=0; i<threads.size(); i++) {
+			threads[i]->join();
+			delete threads[i];
+		}
+		Mutex::destroyMutex(job.mutex);
+
+		// Queue up the chunks in order
+		U32 total = 0;
+		for (U32 i=0; i<numChunks; i++)
+			total += job.chunkSize[i];
+		if (!job.failed && total > mQueueMax) {
+			U8 *queue = (U8*)dRealloc(mQueue, total);
+			if (queue) {
+				mQueue = queue;
+				mQueueMax = total;
+			}
+			else
+				job.failed = true;
+		}
+		mQueueSize = mQueuePos = 0;
+		for (U32 i=0; i<numChunks; i++)
+		{
+			if (!job.failed) {
+				dMemcpy(mQueue + mQueueSize, job.chunkData[i], job.chunkSize[i]);
+				mQueueSize += job.chunkSize[i];
+			}
+			if (job.chunkData[i])
+				dFree(job.chunkData[i]);
+		}
+
+		// Keep the tail of the input as the dictionary for the next batch
+		U32 keep = getMin(mPendingSize, (U32)ZIP_DICT_SIZE);
+		dMemmove(mPending, mPending + mPendingSize - keep, keep);
+		mPendingSize = mDictSize = keep;
+
+		if (job.failed) {
+			Con::errorf("ZipState:: could not compress chunk in parallel!");
+			mFailed = true;
+			return false;
+		}
+		return true;
+	}
+
+	bool processParallel()
+	{
+		// Stage input until there is a full batch, then compress it. Stops when either the input runs out,
+		// or the output buffer fills up (in which case the caller flushes it and calls again).
+		if (!mPending) {
+			mPendingMax = ZIP_DICT_SIZE + ZIP_PARALLEL_CHUNK * ZIP_PARALLEL_BATCH * mThreads;
+			mPending = (U8*)dMalloc(mPendingMax);
+			if (!mPending) {
+				mPendingMax = 0;
+				mFailed = true;
+				return false;
+			}
+		}
+
+		for (;;)
+		{
+			drainQueue();
+			if (m_pZipStream->avail_out == 0 || m_pZipStream->avail_in == 0)
+				return false;
+
+			U32 amount = getMin(mPendingMax - mPendingSize, (U32)m_pZipStream->avail_in);
+			dMemcpy(mPending + mPendingSize, m_pZipStream->next_in, amount);
+			m_pZipStream->next_in += amount;
+			m_pZipStream->avail_in -= amount;
+			m_pZipStream->total_in += amount;
+			mPendingSize += amount;
+
+			if (mPendingSize == mPendingMax && !compressPending(false))
+				return false;
+		}
+	}
+
+	bool endParallel()
+	{
+		drainQueue();
+		if (mQueuePos != mQueueSize)
+			return false; // Output buffer is full
+
+		if (!mFinished)
+		{
+			mFinished = true;
+			if (!mPending) {
+				// Nothing was ever written
+				mPendingMax = ZIP_DICT_SIZE;
+				mPending = (U8*)dMalloc(mPendingMax);
+				if (!mPending) {
+					mPendingMax = 0;
+					mFailed = true;
+					return false;
+				}
+			}
+			if (!compressPending(true))
+				return false;
+			drainQueue();
+		}
+
+		return mQueuePos == mQueueSize;
+	}
+
 	bool reverseProcess()
 	{
 		// Ok, we need to call inflate() until the output buffer is full.
@@ -240,6 +240,15 @@ class TomcryptState : public FilterState
 	{
 		IVactive = false;
 	}
+
+	virtual void recycle()
+	{
+		// Don't hang on to the previous user's key
+		key = NULL;
+		mDataIn = mDataOut = NULL;
+		mDataInSize = mDataOutSize = 0;
+		reset();
+	}
 };
 
 TomcryptState TomcryptState::mMyself;
@@ -250,6 +259,7 @@ CryptHash::CryptHash(const char *hashName)
 {
 	id = find_hash(hashName);
 	data = NULL;
+	state = NULL;
 	size = 0;
 	AssertFatal(id != -1, "CryptHash: hash not found!");
 	if (id == -1) return;
@@ -268,6 +278,29 @@ bool CryptHash::hash(const char *aKey)
 	return errorno == CRYPT_OK;
 }
 
+bool CryptHash::hashBegin()
+{
+	if (id == -1) return false;
+
+	if (!state)
+		state = new hash_state;
+	return hash_descriptor[id].init((hash_state*)state) == CRYPT_OK;
+}
+
+bool CryptHash::hashData(const U8 *ptr, U32 len)
+{
+	AssertFatal(state, "CryptHash::hashData : hashBegin() not called!");
+	if (id == -1 || !state) return false;
+	return hash_descriptor[id].process((hash_state*)state, ptr, len) == CRYPT_OK;
+}
+
+bool CryptHash::hashEnd()
+{
+	AssertFatal(state, "CryptHash::hashEnd : hashBegin() not called!");
+	if (id == -1 || !state) return false;
+	return hash_descriptor[id].done((hash_state*)state, data) == CRYPT_OK;
+}
+
 void CryptHash::setData(U8 *ptr)
 {
 	dMemcpy(data, ptr, size);
@@ -277,6 +310,8 @@ CryptHash::~CryptHash()
 {
 	if (id != -1)
 		delete [] data;
+	if (state)
+		delete (hash_state*)state;
 }
 
 // Hash ConsoleFunction's
@@ -227,6 +227,166 @@ U32 getFilterParams(const char *process, const char *crypt)
 	return res;
 }
 
+U8 *readEntryData(ResContainer *inst, Stream &fs, const DirectoryEntry::FileInfo &file)
+{
+	// Decodes the file (including files in solid blocks); fails if the file is encrypted and we have no hash
+	U8 *data = new U8[file.decompressedSize ? file.decompressedSize : 1];
+	if (!inst->readFileData(fs, file, data))
+	{
+		delete [] data;
+		data = NULL;
+	}
+	return data;
+}
+
+U8 *readEntryBlob(Stream &fs, const DirectoryEntry::FileInfo &file)
+{
+	// Reads the file data exactly as it is stored (processed & encrypted)
+	U8 *data = new U8[file.compressedSize];
+	if (!fs.setPosition(file.fileOffset) || (file.compressedSize != 0 && !fs.read(file.compressedSize, data)))
+	{
+		delete [] data;
+		return NULL;
+	}
+	return data;
+}
+
+const char *getFileName(const char *path)
+{
+	const char *name = dStrrchr(path, '/');
+	if (!name) name = dStrrchr(path, '\\');
+	return name ? name + 1 : path;
+}
+
+bool readAccessTrace(const char *traceFile, const char *archive, Vector<StringTableEntry> &names, Vector<U32> &groups)
+{
+	// Trace files are written by traceContainerAccess(); each line is "container<tab>entry",
+	// in the order the entries were first opened. Lines starting with '#' (from markContainerTrace()) start a new group.
+	FileStream fs;
+	if (!fs.open(traceFile, FileStream::Read))
+		return false;
+
+	U32 size = fs.getStreamSize();
+	char *data = new char[size+1];
+	fs.read(size, data);
+	data[size] = '\0';
+	fs.close();
+
+	const char *archiveName = getFileName(archive);
+	U32 group = 0;
+	bool groupUsed = false;
+	char *line = data;
+	while (*line)
+	{
+		char *end = line;
+		while (*end && *end != '\n') end++;
+		char *next = *end ? end + 1 : end;
+		*end = '\0';
+		if (end != line && end[-1] == '\r') end[-1] = '\0';
+
+		if (*line == '#' || *line == '\0')
+		{
+			if (groupUsed) group++;
+			groupUsed = false;
+		}
+		else
+		{
+			// Only use lines for this archive
+			char *entry = dStrrchr(line, '\t');
+			bool match = true;
+			if (entry)
+			{
+				*entry++ = '\0';
+				match = !dStricmp(getFileName(line), archiveName);
+			}
+			else
+				entry = line;
+
+			if (match)
+			{
+				names.push_back(StringTable->insert(entry));
+				groups.push_back(group);
+				groupUsed = true;
+			}
+		}
+		line = next;
+	}
+
+	delete [] data;
+	return true;
+}
+
+bool copyEntry(ResContainer *from, Stream &fromFs, ResContainer *to, const char *name, const DirectoryEntry::FileInfo &file)
+{
+	if (file.flags & DirectoryEntry::FILE_SOLID)
+	{
+		// Solid blocks hold other files too, so the file is decoded and added again
+		U8 *data = readEntryData(from, fromFs, file);
+		if (!data)
+			return false;
+		bool ret = to->addFile(name, data, file.decompressedSize, file.flags & (FilterState::PROCESS_ALL | FilterState::ENCRYPT_ALL));
+		delete [] data;
+		return ret;
+	}
+
+	// Otherwise the data is copied across as it is stored
+	U8 *blob = readEntryBlob(fromFs, file);
+	if (!blob)
+		return false;
+	to->addFilteredFile(name, blob, file.compressedSize, file.decompressedSize, file.flags);
+	delete [] blob;
+	return true;
+}
+
+bool repackEntry(ResContainer *from, Stream &fromFs, ResContainer *to, const char *name, const DirectoryEntry::FileInfo &file, U32 solidFlags)
+{
+	// Without solid blocks (and for deletion markers) the file goes across as it is
+	if (!solidFlags || (file.flags & DirectoryEntry::FILE_WHITEOUT))
+		return copyEntry(from, fromFs, to, name, file);
+
+	// Otherwise it is decoded, and added to the block being built
+	U8 *data = readEntryData(from, fromFs, file);
+	if (!data)
+		return false;
+	bool ret = to->addFile(name, data, file.decompressedSize, solidFlags);
+	delete [] data;
+	return ret;
+}
+
+// Set of entry names, chained through hash buckets so archives with many files don't take quadratic time to repack
+#define NAMESET_BUCKETS 4096
+
+struct NameSet
+{
+	Vector<StringTableEntry> names;
+	Vector<S32> next;
+	Vector<S32> buckets;
+
+	NameSet()
+	{
+		buckets.setSize(NAMESET_BUCKETS);
+		for (U32 i=0; i<NAMESET_BUCKETS; i++)
+			buckets[i] = -1;
+	}
+
+	static U32 getBucket(StringTableEntry name) {return (U32(dsize_t(name)) >> 2) & (NAMESET_BUCKETS - 1);}
+
+	bool contains(StringTableEntry name)
+	{
+		for (S32 idx = buckets[getBucket(name)]; idx != -1; idx = next[idx])
+			if (names[idx] == name) return true;
+		return false;
+	}
+
+	void insert(StringTableEntry name)
+	{
+		U32 bucket = getBucket(name);
+		names.push_back(name);
+		next.push_back(buckets[bucket]);
+		buckets[bucket] = names.size() - 1;
+	}
+};
+
 bool touchPath(const char *cwd, const char *dir)
 {
 	char buffer[4096];
@@ -240,6 +400,8 @@ typedef enum {
 	DMF_LISTFILES,
 	DMF_EXTRACTFILES,
 	DMF_ADDFILES,
+	DMF_PATCH,
+	DMF_REPACK,
 	DMF_BAD,
 } DMFMode;
 
@@ -263,9 +425,13 @@ S32 DMFArGame::main(int argc, const char** argv)
    const char *gCryptKeyFile = NULL;
    const char *gCryptHashFile = NULL;
    const char *gWorkingDirectory = "./";
+   const char *gTraceFile = NULL;
+   U32 gSolidSize = 0;
+   U32 gThreads = 1;
      
    bool gVerbose = false;
    bool gModeAppend = false;
+   bool gDedup = false;
    DMFMode gMode = DMF_DISPLAYHELP;
 
    dPrintf("\ndmfar - Torque .DMF archiver\n"
@@ -293,6 +459,13 @@ S32 DMFArGame::main(int argc, const char** argv)
             gMode = DMF_ADDFILES;
 			gModeAppend = true;
             break;
+         case 'P':
+            gMode = DMF_PATCH;
+            break;
+         case 'O':
+            gMode = DMF_REPACK;
+            gTraceFile = argv[++i];
+            break;
          case 'F':
             gProcessMethod = argv[++i];
             break;
@@ -311,21 +484,37 @@ S32 DMFArGame::main(int argc, const char** argv)
          case 'V':
             gVerbose = true;
             break;
+         case 'U':
+            gDedup = true;
+            break;
+         case 'B':
+            gSolidSize = dAtoi(argv[++i]);
+            break;
+         case 'J':
+            gThreads = dAtoi(argv[++i]);
+            break;
       }
    }
    U32 args = argc - i;
-   if (gMode == DMF_DISPLAYHELP || (args < 1 || gMode == DMF_BAD) ) {
+   if (gMode == DMF_DISPLAYHELP || (args < 1 || gMode == DMF_BAD) || (gMode == DMF_PATCH && args < 3) || (gMode == DMF_REPACK && args < 2) ) {
       dPrintf("Usage: dmfar [-lear] [-f <filter>] [-c <crypt name>] [-k <key file>] [-h <hash file>] [-w <directory>] <file>.dmf\n"
+			  "       dmfar -p [-k <key file>] [-h <hash file>] <old>.dmf <new>.dmf <patch>.dmf\n"
+			  "       dmfar -o <trace file> [-b <block KB> -f <filter> -c <crypt name> -k <key file> -h <hash file>] <in>.dmf <out>.dmf\n"
 			  "        -e : extract files from archive\n"
 			  "        -l : list files in archive\n"
 			  "        -a : append files to archive\n"
 			  "        -r : overwrite files in archive\n"
+			  "        -p : write a patch holding the differences between two archives\n"
+			  "        -o : rewrite an archive with files in the order they were opened in a trace (see traceContainerAccess())\n"
 			  "        -f : name of the filter used to compress new files & new directories\n"
 			  "        -c : encryption method (default is none)\n"
 			  "        -k : file in which encryption key is stored\n"
 			  "        -h : file in which encryption hash is stored\n"
 			  "        -w : directory in which files are extracted or archived\n"
 			  "        -v : verbose output\n"
+			  "        -u : store files with identical contents once\n"
+			  "        -b : compress small files together in solid blocks of this many KB\n"
+			  "        -j : compress large files on this many threads (zlib only)\n"
 			  "<file>.dmf : container file\n\n");
       
 	  // Print more options here
@@ -356,7 +545,10 @@ S32 DMFArGame::main(int argc, const char** argv)
 					dPrintf("/%s:\n", ent->getName());
 					for (DirectoryEntry::iterator fitr = ent->begin(); fitr != ent->end(); fitr++)
 					{
-						dPrintf("\t%s\n", fitr->name);
+						if (fitr->flags & DirectoryEntry::FILE_WHITEOUT)
+							dPrintf("\t%s (deleted)\n", fitr->name);
+						else
+							dPrintf("\t%s\n", fitr->name);
 					}
 				}
 			}
@@ -413,6 +605,8 @@ S32 DMFArGame::main(int argc, const char** argv)
 
 				   for (DirectoryEntry::iterator fitr = ent->begin(); fitr != ent->end(); fitr++)
 				   {
+					   if (fitr->flags & DirectoryEntry::FILE_WHITEOUT)
+						   continue;
 					   if (gVerbose) dPrintf("\t%s...", fitr->name);
 					   FileStream out;
 					   if (*ent->getName() == '\0') // root
@@ -429,19 +623,15 @@ S32 DMFArGame::main(int argc, const char** argv)
 							   continue;
 						   }
 
-						   ResFilter *filter = new ResFilter(fitr->flags);
-						   filter->attachStream(&fs, false);
-						   filter->setHash(myHash);
-						   filter->setStreamOffset(fitr->fileOffset, fitr->decompressedSize);
-
-						   U8 *obuf = new U8[fitr->decompressedSize];
-						   filter->read(fitr->decompressedSize, obuf);
-						   out.write(fitr->decompressedSize, obuf);
-
-						   delete filter;
-						   delete [] obuf;
-
-						   if (gVerbose) dPrintf("\tOK\n");
+						   U8 *obuf = readEntryData(inst, fs, *fitr);
+						   if (obuf)
+						   {
+							   out.write(fitr->decompressedSize, obuf);
+							   delete [] obuf;
+							   if (gVerbose) dPrintf("\tOK\n");
+						   }
+						   else if (gVerbose)
+							   dPrintf("\tFAILED (Decode)\n");
 						   out.close();
 					   }
 					   else if (gVerbose)
@@ -518,6 +708,12 @@ S32 DMFArGame::main(int argc, const char** argv)
 		else
 			inst->initNew(&fs);
 
+		if (gDedup)
+			inst->setDedup(true);
+		inst->setWriteThreads(gThreads);
+		if (gSolidSize)
+			inst->beginSolidBlock(tag ^ FilterState::FILTER_WRITE, gSolidSize * 1024);
+
 		// Now scan for files and add them!
 
 		Vector < Platform::FileInfo > fileInfoVec;
@@ -535,14 +731,6 @@ S32 DMFArGame::main(int argc, const char** argv)
 			dSprintf(buffer, 2048, "%s/%s", rInfo.pFullPath, rInfo.pFileName);
 			if (in.open(buffer, FileStream::Read))
 			{
-				// TODO: cut off cwd?
-				U8 *data;
-				U32 datasize = in.getStreamSize();
-
-				data = new U8[datasize];
-				in.read(datasize, data);
-				in.close();
-
 				// Strip off working directory from path
 				const char *realPath = rInfo.pFullPath + wdname;
 				if (*realPath == '\0')
@@ -552,12 +740,19 @@ S32 DMFArGame::main(int argc, const char** argv)
 					dSprintf(buffer, 2048, "%s/%s", realPath, rInfo.pFileName);
 				}
 
-				inst->addFile(buffer, data, datasize, tag ^ FilterState::FILTER_WRITE);
-				if (gVerbose) dPrintf("%s\n", buffer);
-				delete [] data;
+				// File data is streamed into the container, so large files don't need to fit in memory
+				if (inst->addFile(buffer, in, in.getStreamSize(), tag ^ FilterState::FILTER_WRITE)) {
+					if (gVerbose) dPrintf("%s\n", buffer);
+				}
+				else {
+					dPrintf("Error: could not add '%s'!\n", buffer);
+					success = 1;
+				}
+				in.close();
 			}
 		}
 
+	   inst->endSolidBlock();
 	   inst->write(fs);
 	   inst->openExisting(NULL, false);
 	   fs.close();
@@ -566,6 +761,243 @@ S32 DMFArGame::main(int argc, const char** argv)
 	      delete myHash;
    }
 
+   else if (gMode == DMF_PATCH)
+   {
+		// Write a container holding the files that changed between two archives.
+		// Stored data is copied across as-is, so the patch must be mounted with the same key as the new archive.
+		const char *oldArchive = argv[i++];
+		const char *newArchive = argv[i++];
+		const char *patchArchive = argv[i++];
+		char buffer[2048];
+		FileStream oldFs, newFs, patchFs;
+		ResContainer *oldInst = new ResContainer();
+		ResContainer *newInst = new ResContainer();
+		ResContainer *patchInst = NULL;
+		U32 numChanged = 0, numDeleted = 0;
+
+		CryptHash *myHash = getCryptParams(gCryptMethod, gCryptKeyFile, gCryptHashFile);
+		if (myHash)
+		{
+			oldInst->setHash(myHash);
+			newInst->setHash(myHash);
+		}
+
+		if (!oldFs.open(oldArchive, FileStream::Read) || !oldInst->read(oldFs))
+		{
+			dPrintf("Error: could not open archive '%s'!\n", oldArchive);
+			success = 1;
+		}
+		else if (!newFs.open(newArchive, FileStream::Read) || !newInst->read(newFs))
+		{
+			dPrintf("Error: could not open archive '%s'!\n", newArchive);
+			success = 1;
+		}
+		else if (!patchFs.open(patchArchive, FileStream::Write))
+		{
+			dPrintf("Error: could not open output file '%s'!\n", patchArchive);
+			success = 1;
+		}
+		else
+		{
+			patchInst = new ResContainer();
+			if (myHash)
+				patchInst->setHash(myHash);
+			patchInst->initNew(&patchFs);
+
+			// Files that are new, or differ from the old archive
+			for (ResContainer::iterator ditr = newInst->begin(); ditr != newInst->end(); ditr++)
+			{
+				DirectoryEntry *ent = *ditr;
+				for (DirectoryEntry::iterator fitr = ent->begin(); fitr != ent->end(); fitr++)
+				{
+					if (fitr->flags & DirectoryEntry::FILE_WHITEOUT)
+						continue;
+
+					bool changed = true;
+					DirectoryEntry::iterator oitr = oldInst->getFile(ent->getName(), fitr->name);
+					if (oitr && oitr->decompressedSize == fitr->decompressedSize)
+					{
+						U8 *oldData = readEntryData(oldInst, oldFs, *oitr);
+						U8 *newData = readEntryData(newInst, newFs, *fitr);
+						if (oldData && newData)
+							changed = dMemcmp(oldData, newData, fitr->decompressedSize) != 0;
+						delete [] oldData;
+						delete [] newData;
+					}
+
+					if (!changed)
+						continue;
+
+					ResContainer::buildEntryName(buffer, 2048, ent->getName(), fitr->name);
+					if (!copyEntry(newInst, newFs, patchInst, buffer, *fitr))
+					{
+						dPrintf("Error: could not read '%s' from '%s'!\n", fitr->name, newArchive);
+						success = 1;
+						continue;
+					}
+					if (gVerbose) dPrintf("M %s\n", buffer);
+					numChanged++;
+				}
+			}
+
+			// Files that have been removed
+			for (ResContainer::iterator ditr = oldInst->begin(); ditr != oldInst->end(); ditr++)
+			{
+				DirectoryEntry *ent = *ditr;
+				for (DirectoryEntry::iterator fitr = ent->begin(); fitr != ent->end(); fitr++)
+				{
+					if (fitr->flags & DirectoryEntry::FILE_WHITEOUT)
+						continue;
+					if (newInst->getFile(ent->getName(), fitr->name))
+						continue;
+
+					ResContainer::buildEntryName(buffer, 2048, ent->getName(), fitr->name);
+					patchInst->addWhiteout(buffer);
+					if (gVerbose) dPrintf("D %s\n", buffer);
+					numDeleted++;
+				}
+			}
+
+			patchInst->write(patchFs);
+			patchInst->openExisting(NULL, false);
+			dPrintf("%d files changed, %d files deleted\n", numChanged, numDeleted);
+		}
+
+		patchFs.close();
+		newFs.close();
+		oldFs.close();
+		if (patchInst)
+			delete patchInst;
+		delete newInst;
+		delete oldInst;
+		if (myHash)
+			delete myHash;
+   }
+
+   else if (gMode == DMF_REPACK)
+   {
+		// Rewrite an archive so files are stored in the order they were first opened,
+		// turning loads into (mostly) sequential reads. Files not in the trace follow in their original order.
+		// Stored data is copied across as-is, so no key is needed, unless files are being put in solid blocks (-b),
+		// or the archive already has solid blocks, in which case files are decoded and compressed again.
+		const char *inArchive = argv[i++];
+		const char *outArchive = argv[i++];
+		char buffer[2048];
+		FileStream inFs, outFs;
+		ResContainer *inInst = new ResContainer();
+		ResContainer *outInst = NULL;
+		Vector<StringTableEntry> traceNames;
+		Vector<U32> traceGroups;
+		NameSet copied;
+		U32 numTraced = 0;
+
+		CryptHash *myHash = getCryptParams(gCryptMethod, gCryptKeyFile, gCryptHashFile);
+		U32 tag = getFilterParams(gProcessMethod, myHash ? gCryptMethod : NULL) ^ FilterState::FILTER_WRITE;
+		if (myHash)
+			inInst->setHash(myHash);
+
+		if (!readAccessTrace(gTraceFile, inArchive, traceNames, traceGroups))
+		{
+			dPrintf("Error: could not open trace file '%s'!\n", gTraceFile);
+			success = 1;
+		}
+		else if (!inFs.open(inArchive, FileStream::Read) || !inInst->read(inFs))
+		{
+			dPrintf("Error: could not open archive '%s'!\n", inArchive);
+			success = 1;
+		}
+		else if (!outFs.open(outArchive, FileStream::Write))
+		{
+			dPrintf("Error: could not open output file '%s'!\n", outArchive);
+			success = 1;
+		}
+		else
+		{
+			outInst = new ResContainer();
+			if (myHash)
+				outInst->setHash(myHash);
+			outInst->initNew(&outFs);
+			outInst->setWriteThreads(gThreads);
+
+			// Keep the directories (and their flags) in the same order
+			for (ResContainer::iterator ditr = inInst->begin(); ditr != inInst->end(); ditr++)
+				outInst->addDirectory((*ditr)->getName(), (*ditr)->getFlags());
+
+			// Traced files first...
+			for (U32 t=0; t<traceNames.size(); t++)
+			{
+				const char *name = dStrrchr(traceNames[t], '/');
+				if (name)
+				{
+					dStrncpy(buffer, traceNames[t], name - traceNames[t]);
+					buffer[name - traceNames[t]] = '\0';
+					name++;
+				}
+				else
+				{
+					buffer[0] = '\0';
+					name = traceNames[t];
+				}
+
+				DirectoryEntry::iterator fitr = inInst->getLocalFile(buffer, name);
+				if (!fitr)
+					continue;
+
+				if (copied.contains(traceNames[t]))
+					continue;
+
+				// Each group of the trace gets its own solid blocks
+				if (gSolidSize && (t == 0 || traceGroups[t] != traceGroups[t-1]))
+					outInst->beginSolidBlock(tag, gSolidSize * 1024);
+
+				if (!repackEntry(inInst, inFs, outInst, traceNames[t], *fitr, gSolidSize ? tag : 0))
+				{
+					dPrintf("Error: could not read '%s' from '%s'!\n", traceNames[t], inArchive);
+					success = 1;
+					continue;
+				}
+				if (gVerbose) dPrintf("%d %s\n", traceGroups[t], traceNames[t]);
+				copied.insert(traceNames[t]);
+				numTraced++;
+			}
+
+			// ...then everything else
+			if (gSolidSize)
+				outInst->beginSolidBlock(tag, gSolidSize * 1024);
+			for (ResContainer::iterator ditr = inInst->begin(); ditr != inInst->end(); ditr++)
+			{
+				DirectoryEntry *ent = *ditr;
+				for (DirectoryEntry::iterator fitr = ent->begin(); fitr != ent->end(); fitr++)
+				{
+					StringTableEntry entryName = StringTable->insert(ResContainer::buildEntryName(buffer, 2048, ent->getName(), fitr->name));
+					if (copied.contains(entryName))
+						continue;
+
+					if (!repackEntry(inInst, inFs, outInst, entryName, *fitr, gSolidSize ? tag : 0))
+					{
+						dPrintf("Error: could not read '%s' from '%s'!\n", entryName, inArchive);
+						success = 1;
+						continue;
+					}
+					if (gVerbose) dPrintf("- %s\n", entryName);
+				}
+			}
+
+			outInst->endSolidBlock();
+			outInst->write(outFs);
+			outInst->openExisting(NULL, false);
+			dPrintf("%d files placed from trace, %d groups\n", numTraced, traceGroups.size() ? traceGroups.last() + 1 : 0);
+		}
+
+		outFs.close();
+		inFs.close();
+		if (outInst)
+			delete outInst;
+		delete inInst;
+		if (myHash)
+			delete myHash;
+   }
+
 #ifdef TORQUE_DEBUG
    dPrintf("\nDone, press any key to exit.\n");
    getchar();
@@ -0,0 +1,18 @@
+//-----------------------------------------------------------------------------
+// (C) 2004 - 2006, Stuart James Urquhart (jamesu@gmail.com). All Rights Reserved.
+//-----------------------------------------------------------------------------
+
+#ifndef _H_FILTERBENCHGAME_
+#define _H_FILTERBENCHGAME_
+
+#ifndef _GAMEINTERFACE_H_
+#include "platform/gameInterface.h"
+#endif
+
+class FilterBenchGame : public GameInterface
+{
+  public:
+   S32 main(S32 argc, const char **argv);
+};
+
+#endif  // _H_FILTERBENCHGAME_
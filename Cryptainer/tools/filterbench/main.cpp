@@ -0,0 +1,441 @@
+//-----------------------------------------------------------------------------
+// (C) 2004 - 2006, Stuart James Urquhart (jamesu@gmail.com). All Rights Reserved.
+//-----------------------------------------------------------------------------
+
+#include "platform/platform.h"
+#include "platform/event.h"
+#include "platform/platformAssert.h"
+#include "math/mMath.h"
+#include "console/console.h"
+#include "core/tVector.h"
+#include "core/fileStream.h"
+#include "filterbench/filterBenchGame.h"
+#include "core/frameAllocator.h"
+#include "core/resManager.h"
+#include "core/resFilter.h"
+#include "core/filterState.h"
+#include "DynMemStream.h"
+
+FilterBenchGame GameObject;
+
+// FOR SILLY LINK DEPENDANCY
+bool gEditingMission = false;
+
+#if defined(TORQUE_DEBUG)
+const char* const gProgramVersion = "1.0d";
+#else
+const char* const gProgramVersion = "1.0r";
+#endif
+
+//
+static bool initLibraries()
+{
+   FrameAllocator::init(2 << 20);
+
+   _StringTable::create();
+
+   ResManager::create();
+
+   Con::init();
+
+   Math::init();
+   Platform::init();    // platform specific initialization
+
+   return(true);
+}
+
+static void shutdownLibraries()
+{
+   // shut down
+   Platform::shutdown();
+   Con::shutdown();
+
+   _StringTable::destroy();
+
+   // asserts should be destroyed LAST
+   FrameAllocator::destroy();
+   PlatformAssert::destroy();
+}
+
+/// Block of data to run through the filters
+struct BenchCorpus
+{
+	const char *name;
+	U8 *data;
+	U32 size;
+};
+
+/// Results of one filter/corpus/chunk run
+struct BenchResult
+{
+	U32 storedSize;		///< Size of data after process()
+	F64 processRate;		///< MB/s through process() (write)
+	F64 reverseRate;		///< MB/s through reverseProcess() (read)
+	U32 allocs;				///< FilterState's & ResFilter caches allocated per write+read
+	bool ok;					///< Data read back matched the input
+};
+
+static U32 gSeed = 0x1234567;
+static U32 benchRand()
+{
+	// Fixed LCG, so every run benchmarks the same data
+	gSeed = gSeed * 1103515245 + 12345;
+	return gSeed >> 8;
+}
+
+static void makeSyntheticCorpus(Vector<BenchCorpus> &list, U32 size)
+{
+	static const char *words[] = {"datablock", "player", "vehicle", "mission", "terrain", "%obj", "function", "return", "{", "}", "=", ";", "\n", "\t", "new", "ShapeBaseData", "position", "rotation", "scale", "0", "1", "\"", "if", "else"};
+	BenchCorpus *corpus;
+	U32 i;
+
+	// Zero filled (best case for everything)
+	corpus = list.increment();
+	corpus->name = "zeros";
+	corpus->size = size;
+	corpus->data = new U8[size];
+	dMemset(corpus->data, 0, size);
+
+	// Noise (worst case for compressors)
+	corpus = list.increment();
+	corpus->name = "random";
+	corpus->size = size;
+	corpus->data = new U8[size];
+	for (i=0; i<size; i++)
+		corpus->data[i] = benchRand() & 0xFF;
+
+	// Script-like text
+	corpus = list.increment();
+	corpus->name = "text";
+	corpus->size = size;
+	corpus->data = new U8[size];
+	for (i=0; i<size;)
+	{
+		const char *word = words[benchRand() % (sizeof(words) / sizeof(words[0]))];
+		while (*word && i < size)
+			corpus->data[i++] = *word++;
+		if (i < size)
+			corpus->data[i++] = ' ';
+	}
+
+	// 16bit PCM; a tone with a bit of noise (suits delta16)
+	corpus = list.increment();
+	corpus->name = "pcm16";
+	corpus->size = size & ~1;
+	corpus->data = new U8[size];
+	for (i=0; i<corpus->size/2; i++)
+	{
+		S16 sample = (S16)(mSin(i * 0.0627f) * 12000.0f) + (S16)(benchRand() % 256) - 128;
+		((S16*)corpus->data)[i] = convertHostToLEndian(sample);
+	}
+
+	// Mesh vertex data; smooth floating point positions and normals (suits delta32)
+	corpus = list.increment();
+	corpus->name = "mesh";
+	corpus->size = (size / 24) * 24;
+	corpus->data = new U8[size];
+	for (i=0; i<corpus->size/24; i++)
+	{
+		F32 *vert = ((F32*)corpus->data) + (i*6);
+		F32 x = (F32)(i % 256);
+		F32 y = (F32)(i / 256);
+		vert[0] = convertHostToLEndian(x);
+		vert[1] = convertHostToLEndian(y);
+		vert[2] = convertHostToLEndian(mSin(x * 0.1f) * mCos(y * 0.1f) * 32.0f);
+		vert[3] = convertHostToLEndian(0.0f);
+		vert[4] = convertHostToLEndian(0.0f);
+		vert[5] = convertHostToLEndian(1.0f);
+	}
+}
+
+static bool loadFileCorpus(Vector<BenchCorpus> &list, const char *fileName)
+{
+	FileStream fs;
+	if (!fs.open(fileName, FileStream::Read))
+		return false;
+
+	BenchCorpus *corpus = list.increment();
+	corpus->name = fileName;
+	corpus->size = fs.getStreamSize();
+	corpus->data = new U8[corpus->size ? corpus->size : 1];
+	fs.read(corpus->size, corpus->data);
+	fs.close();
+	return true;
+}
+
+static F64 toRate(U32 size, U32 us)
+{
+	// Anything under the timer resolution is counted as 1us
+	return ((F64)size / (1024.0 * 1024.0)) / ((F64)(us ? us : 1) / 1000000.0);
+}
+
+static void runBench(U32 flags, CryptHash *hash, const BenchCorpus &corpus, U32 chunk, U32 iterations, BenchResult &res)
+{
+	U8 *check = new U8[corpus.size ? corpus.size : 1];
+	U32 bestWrite = 0xFFFFFFFF;
+	U32 bestRead = 0xFFFFFFFF;
+
+	res.ok = true;
+	res.allocs = 0;
+	res.storedSize = 0;
+
+	for (U32 iter=0; iter<iterations && res.ok; iter++)
+	{
+		DynMemStream stored(1 << 20);
+		U32 allocStart = FilterState::smNumCreated + ResFilter::smNumCacheAllocs;
+
+		// process() (timed in microseconds, as small inputs take well under a millisecond)
+		U32 start = ResFilter::getMicroseconds();
+		ResFilter *filter = new ResFilter(flags);
+		filter->attachStream(&stored, true);
+		if (hash) filter->setHash(hash);
+		filter->setStreamOffset(0, corpus.size);
+		for (U32 pos=0; pos<corpus.size; pos+=chunk)
+		{
+			U32 toWrite = corpus.size - pos > chunk ? chunk : corpus.size - pos;
+			if (!filter->write(toWrite, corpus.data + pos)) {
+				res.ok = false;
+				break;
+			}
+		}
+		delete filter;
+		U32 time = ResFilter::getMicroseconds() - start;
+		if (time < bestWrite) bestWrite = time;
+		res.storedSize = stored.getStreamSize();
+
+		// reverseProcess()
+		dMemset(check, 0, corpus.size);
+		start = ResFilter::getMicroseconds();
+		filter = new ResFilter(flags);
+		filter->attachStream(&stored, false);
+		if (hash) filter->setHash(hash);
+		filter->setStreamOffset(0, corpus.size);
+		for (U32 pos=0; pos<corpus.size && res.ok; pos+=chunk)
+		{
+			U32 toRead = corpus.size - pos > chunk ? chunk : corpus.size - pos;
+			if (!filter->read(toRead, check + pos))
+				res.ok = false;
+		}
+		delete filter;
+		time = ResFilter::getMicroseconds() - start;
+		if (time < bestRead) bestRead = time;
+
+		res.allocs = (FilterState::smNumCreated + ResFilter::smNumCacheAllocs) - allocStart;
+		if (res.ok)
+			res.ok = dMemcmp(check, corpus.data, corpus.size) == 0;
+	}
+
+	res.processRate = toRate(corpus.size, bestWrite);
+	res.reverseRate = toRate(corpus.size, bestRead);
+	delete [] check;
+}
+
+static void addUniqueBits(Vector<U32> &list, U32 flags)
+{
+	for (U32 i=0; i<31; i++)
+	{
+		U32 bit = flags & BIT(i);
+		if (!bit)
+			continue;
+		bool found = false;
+		for (U32 j=0; j<list.size(); j++) {
+			if (list[j] == bit) { found = true; break; }
+		}
+		if (!found)
+			list.push_back(bit);
+	}
+}
+
+S32 FilterBenchGame::main(int argc, const char** argv)
+{
+   // Set the memory manager page size to 64 megs...
+   setMinimumAllocUnit(64 << 20);
+
+   if(!initLibraries())
+      return 0;
+
+   const char *gOutputFile = NULL;
+   const char *gProcessMethod = NULL;
+   const char *gCryptMethod = NULL;
+   U32 gIterations = 3;
+   U32 gSyntheticSize = 4096;
+   U32 gChunkSize = 0;
+   bool gHelp = false;
+
+   // Parse command line args...
+   S32 i = 1;
+   for (; i < argc; i++) {
+      if (argv[i][0] != '-')
+         break;
+      switch(dToupper(argv[i][1])) {
+         case 'O':
+            gOutputFile = argv[++i];
+            break;
+         case 'F':
+            gProcessMethod = argv[++i];
+            break;
+         case 'C':
+            gCryptMethod = argv[++i];
+            break;
+         case 'N':
+            gIterations = dAtoi(argv[++i]);
+            break;
+         case 'S':
+            gSyntheticSize = dAtoi(argv[++i]);
+            break;
+         case 'B':
+            gChunkSize = dAtoi(argv[++i]);
+            break;
+         default:
+            gHelp = true;
+            break;
+      }
+   }
+
+   if (gHelp || gIterations == 0) {
+      dPrintf("\nfilterbench - FilterState benchmark\n"
+              "  Program version: %s\n\n"
+              "Usage: filterbench [-o <file>.csv] [-f <filter>] [-c <crypt name>|none] [-n <iterations>] [-s <size KB>] [-b <chunk size>] [files...]\n"
+			  "        -o : write results to file, rather than the console\n"
+			  "        -f : only benchmark this filter\n"
+			  "        -c : only benchmark this encryption method (none for no encryption)\n"
+			  "        -n : number of runs of each test; the fastest is reported (default 3)\n"
+			  "        -s : size of synthetic data sets in KB (default 4096)\n"
+			  "        -b : only use this chunk size for read() & write()\n"
+			  "  files... : extra data sets to benchmark (e.g. real assets)\n\n", gProgramVersion);
+      FilterState::printHandlers();
+      shutdownLibraries();
+      return 1;
+   }
+
+   // Data sets
+   Vector<BenchCorpus> corpusList;
+   makeSyntheticCorpus(corpusList, gSyntheticSize * 1024);
+   for (; i < argc; i++)
+   {
+      if (!loadFileCorpus(corpusList, argv[i]))
+         dPrintf("Warning: could not open '%s', skipping\n", argv[i]);
+   }
+
+   // Every combination of processor & encryptor compiled in
+   Vector<U32> processBits;
+   Vector<U32> cryptBits;
+   for (FilterState *walker = FilterState::getFirstHandler(); walker; walker = walker->getNextHandler())
+   {
+      addUniqueBits(processBits, walker->getTag() & FilterState::PROCESS_ALL);
+      addUniqueBits(cryptBits, walker->getTag() & FilterState::ENCRYPT_ALL);
+   }
+   if (gProcessMethod)
+   {
+      processBits.clear();
+      processBits.push_back(FilterState::fromString(gProcessMethod, false));
+   }
+
+   CryptHash *hash = new CryptHash(ResManager::defaultHash);
+   if (!hash->hash("filterbench"))
+   {
+      delete hash;
+      hash = NULL;
+   }
+   if (!hash || (gCryptMethod && !dStrcmp(gCryptMethod, "none")))
+      cryptBits.clear();
+   else if (gCryptMethod)
+   {
+      cryptBits.clear();
+      cryptBits.push_back(FilterState::fromString(gCryptMethod, false));
+   }
+   cryptBits.push_front(0); // no encryption
+
+   Vector<U32> chunkSizes;
+   if (gChunkSize)
+      chunkSizes.push_back(gChunkSize);
+   else
+   {
+      chunkSizes.push_back(512);
+      chunkSizes.push_back(BLOCKREAD_SIZE);
+      chunkSizes.push_back(64 * 1024);
+      chunkSizes.push_back(1024 * 1024);
+   }
+
+   FileStream out;
+   if (gOutputFile && !out.open(gOutputFile, FileStream::Write))
+   {
+      dPrintf("Error: could not open output file '%s'!\n", gOutputFile);
+      shutdownLibraries();
+      return 1;
+   }
+
+   char line[1024];
+   dSprintf(line, sizeof(line), "filter,crypt,handler,corpus,size,chunk,stored,ratio,process_mbs,reverse_mbs,allocs,ok\n");
+   if (gOutputFile) out.write(dStrlen(line), line);
+   else dPrintf("%s", line);
+
+   S32 failures = 0;
+   for (U32 p=0; p<processBits.size(); p++)
+   {
+      FilterState *handler = FilterState::findHandler(processBits[p]);
+      if (!handler)
+      {
+         dPrintf("Error: no handler for filter '%s'\n", FilterState::toString(processBits[p]));
+         failures++;
+         continue;
+      }
+
+      for (U32 c=0; c<cryptBits.size(); c++)
+      {
+         if (cryptBits[c] && !FilterState::findHandler(cryptBits[c]))
+            continue;
+
+         U32 flags = processBits[p] | cryptBits[c];
+         for (U32 d=0; d<corpusList.size(); d++)
+         {
+            for (U32 s=0; s<chunkSizes.size(); s++)
+            {
+               BenchResult res;
+               runBench(flags, cryptBits[c] ? hash : NULL, corpusList[d], chunkSizes[s], gIterations, res);
+               if (!res.ok)
+                  failures++;
+
+               dSprintf(line, sizeof(line), "%s,%s,%s,%s,%d,%d,%d,%.4f,%.2f,%.2f,%d,%d\n",
+                        FilterState::toString(processBits[p]),
+                        cryptBits[c] ? FilterState::toString(cryptBits[c]) : "none",
+                        handler->getName(),
+                        corpusList[d].name,
+                        corpusList[d].size,
+                        chunkSizes[s],
+                        res.storedSize,
+                        corpusList[d].size ? (F64)res.storedSize / (F64)corpusList[d].size : 1.0,
+                        res.processRate,
+                        res.reverseRate,
+                        res.allocs,
+                        res.ok ? 1 : 0);
+               if (gOutputFile) out.write(dStrlen(line), line);
+               else dPrintf("%s", line);
+            }
+         }
+      }
+   }
+
+   if (gOutputFile)
+      out.close();
+   for (U32 d=0; d<corpusList.size(); d++)
+      delete [] corpusList[d].data;
+   if (hash)
+      delete hash;
+
+   if (failures)
+      dPrintf("Error: %d tests did not read back the data they wrote!\n", failures);
+
+   shutdownLibraries();
+   return failures ? 1 : 0;
+}
+
+void GameReactivate()
+{
+
+}
+
+void GameDeactivate( bool )
+{
+
+}